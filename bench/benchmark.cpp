@@ -0,0 +1,118 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QSysInfo>
+
+const double MIN_SAMPLE_NS = 200000;
+
+namespace {
+    volatile size_t sink;
+
+    double elapsedNs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+void keepAlive(size_t value) {
+    sink = value;
+}
+
+BenchmarkSuite::BenchmarkSuite(const std::string &filter, double minTime, size_t minSamples) :
+    filter_(filter),
+    minTime_(minTime),
+    minSamples_(minSamples) {}
+
+bool BenchmarkSuite::isSelected(const std::string &name) const {
+    return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+void BenchmarkSuite::run(const std::string &name, const std::function<void()> &iteration, size_t bytesPerIteration) {
+    if(!isSelected(name)) {
+        return;
+    }
+
+    // warm up caches and lazily initialized state, then size the batches from a single timed iteration
+    iteration();
+    auto start = std::chrono::steady_clock::now();
+    iteration();
+    auto single = std::max(elapsedNs(start), 1.0);
+    long long batch = std::max(1LL, static_cast<long long>(std::ceil(MIN_SAMPLE_NS / single)));
+
+    std::vector<double> samples;
+    double total = 0;
+    while(total < minTime_ * 1e9 || samples.size() < minSamples_) {
+        start = std::chrono::steady_clock::now();
+        for(long long i = 0; i < batch; ++i) {
+            iteration();
+        }
+        auto sample = elapsedNs(start);
+        total += sample;
+        samples.push_back(sample / batch);
+    }
+
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = batch * samples.size();
+    result.samples = samples.size();
+    result.bytesPerIteration = bytesPerIteration;
+
+    std::sort(samples.begin(), samples.end());
+    result.minNs = samples.front();
+    result.maxNs = samples.back();
+    result.medianNs = samples[samples.size() / 2];
+    for(auto sample : samples) {
+        result.meanNs += sample;
+    }
+    result.meanNs /= samples.size();
+    for(auto sample : samples) {
+        result.stddevNs += (sample - result.meanNs) * (sample - result.meanNs);
+    }
+    result.stddevNs = std::sqrt(result.stddevNs / samples.size());
+
+    std::cerr << name << ": " << result.medianNs << " ns median, " << result.iterations << " iterations" << std::endl;
+    results_.push_back(result);
+}
+
+QJsonDocument BenchmarkSuite::toJson() const {
+    QJsonArray benchmarks;
+    for(auto &result : results_) {
+        QJsonObject benchmark;
+        benchmark["name"] = QString::fromStdString(result.name);
+        benchmark["iterations"] = result.iterations;
+        benchmark["samples"] = result.samples;
+        benchmark["mean_ns"] = result.meanNs;
+        benchmark["median_ns"] = result.medianNs;
+        benchmark["min_ns"] = result.minNs;
+        benchmark["max_ns"] = result.maxNs;
+        benchmark["stddev_ns"] = result.stddevNs;
+        if(result.bytesPerIteration > 0) {
+            benchmark["bytes_per_iteration"] = static_cast<qint64>(result.bytesPerIteration);
+            benchmark["bytes_per_second"] = result.bytesPerIteration * 1e9 / result.medianNs;
+        }
+        benchmarks.append(benchmark);
+    }
+
+    QJsonObject context;
+    context["version"] = QTCHAT_VERSION;
+    context["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    context["host"] = QSysInfo::machineHostName();
+    context["cpu_architecture"] = QSysInfo::currentCpuArchitecture();
+    context["qt_version"] = qVersion();
+#ifdef NDEBUG
+    context["build_type"] = "release";
+#else
+    context["build_type"] = "debug";
+#endif
+
+    QJsonObject root;
+    root["context"] = context;
+    root["benchmarks"] = benchmarks;
+    return QJsonDocument(root);
+}
@@ -0,0 +1,60 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <QJsonDocument>
+
+/**
+ * @brief Timing statistics of a single benchmark, per iteration.
+ */
+struct BenchmarkResult {
+    std::string name;
+    long long iterations = 0;
+    int samples = 0;
+    double meanNs = 0;
+    double medianNs = 0;
+    double minNs = 0;
+    double maxNs = 0;
+    double stddevNs = 0;
+    size_t bytesPerIteration = 0;
+};
+
+/**
+ * @brief Runs microbenchmarks and collects their results.
+ *
+ * Iterations are timed in batches sized so that every sample takes at least a fraction of a millisecond,
+ * which keeps clock overhead out of the results of very short operations. Samples are taken until both
+ * the minimal time and the minimal number of samples are reached.
+ */
+class BenchmarkSuite {
+public:
+    BenchmarkSuite(const std::string &filter = "", double minTime = 0.5, size_t minSamples = 5);
+
+    /**
+     * @brief Runs a benchmark unless it is excluded by the filter.
+     * @param iteration Performs a single iteration of the measured operation
+     * @param bytesPerIteration Amount of data processed by one iteration, used to report throughput
+     */
+    void run(const std::string &name, const std::function<void()> &iteration, size_t bytesPerIteration = 0);
+    bool isSelected(const std::string &name) const;
+
+    const std::vector<BenchmarkResult>& getResults() const { return results_; }
+    QJsonDocument toJson() const;
+
+private:
+    std::string filter_;
+    double minTime_;
+    size_t minSamples_;
+
+    std::vector<BenchmarkResult> results_;
+};
+
+/**
+ * @brief Keeps the compiler from optimizing away a computed value.
+ */
+void keepAlive(size_t value);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,256 @@
+#include "benchmark.h"
+#include "session.h"
+#include "utils.h"
+
+#include <iostream>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QFile>
+#include <QTcpServer>
+
+const std::vector<size_t> PAYLOAD_SIZES = {16, 256, 4096, 65536};
+const std::vector<size_t> BURST_SIZES = {1, 16, 256, 4096};
+const std::vector<unsigned int> RSA_KEY_SIZES = {1024, 2048, 4096};
+const size_t BURST_PAYLOAD_SIZE = 64;
+const size_t SEGMENT_SIZE = 1460; // typical TCP segment payload
+const unsigned int HANDSHAKE_KEY_SIZE = 4096; // same as generated by the default configuration
+const int HANDSHAKE_TIMEOUT = 10000;
+const std::string HANDSHAKE_FAILED_ERROR = "Loopback handshake failed.";
+
+namespace {
+    std::string makeFrame(char type, const std::string &content) {
+        return Utils::convertToHex(content.length() + 8, 5) + "QC" + type + content;
+    }
+
+    void benchmarkFrameParsing(BenchmarkSuite &suite) {
+        for(auto frames : BURST_SIZES) {
+            std::string burst;
+            for(size_t i = 0; i < frames; ++i) {
+                burst += makeFrame('N', std::string(BURST_PAYLOAD_SIZE, 'x'));
+            }
+
+            // the whole burst arrives in a single read
+            suite.run("frame_parser/burst/" + std::to_string(frames), [&] {
+                FrameParser parser;
+                parser.append(burst);
+
+                std::string frame;
+                size_t count = 0;
+                while(parser.next(frame)) {
+                    ++count;
+                }
+                keepAlive(count);
+            }, burst.length());
+
+            // the burst arrives in TCP segments, so frames are split across reads
+            suite.run("frame_parser/segmented/" + std::to_string(frames), [&] {
+                FrameParser parser;
+                std::string frame;
+                size_t count = 0;
+                for(size_t offset = 0; offset < burst.length(); offset += SEGMENT_SIZE) {
+                    parser.append(burst.substr(offset, SEGMENT_SIZE));
+                    while(parser.next(frame)) {
+                        ++count;
+                    }
+                }
+                keepAlive(count);
+            }, burst.length());
+        }
+    }
+
+    void benchmarkConversion(BenchmarkSuite &suite) {
+        auto key = std::make_shared<AESKey>();
+        StandardMessageConverter standardConverter;
+        EncryptedMessageConverter encryptedConverter(key, key);
+
+        for(auto size : PAYLOAD_SIZES) {
+            auto message = std::make_shared<NewChatMessage>(std::string(size, 'x'));
+
+            suite.run("converter/standard/" + std::to_string(size), [&] {
+                auto encoded = standardConverter.convertFromMessage(message.get());
+                auto decoded = standardConverter.convertToMessage(encoded);
+                keepAlive(encoded.length());
+            }, size);
+
+            suite.run("converter/encrypted/" + std::to_string(size), [&] {
+                auto encoded = encryptedConverter.convertFromMessage(message.get());
+                auto decoded = encryptedConverter.convertToMessage(encoded);
+                keepAlive(encoded.length());
+            }, size);
+        }
+    }
+
+    void benchmarkAes(BenchmarkSuite &suite) {
+        auto key = std::make_shared<AESKey>();
+
+        for(auto size : PAYLOAD_SIZES) {
+            auto plaintext = std::string(size, 'x');
+            auto ciphertext = key->encrypt(plaintext);
+
+            suite.run("aes/encrypt/" + std::to_string(size), [&] {
+                keepAlive(key->encrypt(plaintext).length());
+            }, size);
+
+            suite.run("aes/decrypt/" + std::to_string(size), [&] {
+                keepAlive(key->decrypt(ciphertext).length());
+            }, size);
+        }
+    }
+
+    void benchmarkRsa(BenchmarkSuite &suite) {
+        for(auto bits : RSA_KEY_SIZES) {
+            suite.run("rsa/generate_key/" + std::to_string(bits), [bits] {
+                auto keys = RSAKeyGenerator::generateKey(bits);
+                keepAlive(keys.getPublicKey() != nullptr);
+            });
+
+            auto keys = RSAKeyGenerator::generateKey(bits);
+            auto pem = keys.getPublicKey()->encode();
+            auto plaintext = AESKey().encode(); // a session key, as wrapped in the handshake
+            auto ciphertext = keys.getPublicKey()->encrypt(plaintext);
+
+            suite.run("rsa/decode_pem/" + std::to_string(bits), [&] {
+                std::unique_ptr<RSAPublicKey> key(RSAPublicKey::decodeFromPEM(pem));
+                keepAlive(key != nullptr);
+            });
+
+            PublicKeyCache cache;
+            suite.run("rsa/cached_key/" + std::to_string(bits), [&] {
+                keepAlive(cache.get(pem) != nullptr);
+            });
+
+            suite.run("rsa/encrypt/" + std::to_string(bits), [&] {
+                keepAlive(keys.getPublicKey()->encrypt(plaintext).length());
+            });
+
+            suite.run("rsa/decrypt/" + std::to_string(bits), [&] {
+                keepAlive(keys.getPrivateKey()->decrypt(ciphertext).length());
+            });
+        }
+    }
+
+    /**
+     * @brief Runs a complete sender/receiver handshake between two chat sessions over a loopback TCP connection.
+     */
+    void runHandshake(QTcpServer &server, const KeyCombination &keys,
+                      std::shared_ptr<SessionTicketIssuer> ticketIssuer, std::shared_ptr<SessionTicketStore> ticketStore) {
+        UserInfo userInfo("bench");
+        QEventLoop loop;
+        int initialized = 0;
+        bool failed = false;
+
+        auto onInitialized = [&] {
+            if(++initialized == 2) {
+                loop.quit();
+            }
+        };
+        auto onError = [&] {
+            failed = true;
+            loop.quit();
+        };
+
+        std::shared_ptr<ChatSession> receiver;
+        QObject::connect(&server, &QTcpServer::newConnection, &loop, [&] {
+            auto connection = std::make_shared<TcpConnection>(server.nextPendingConnection());
+            receiver = std::make_shared<ChatSession>(connection, userInfo, keys);
+            QObject::connect(receiver.get(), &ChatSession::sessionInitialized, &loop, onInitialized);
+            QObject::connect(receiver.get(), &ChatSession::sessionInitializationError, &loop, onError);
+            receiver->initialize(std::make_unique<EncryptedSessionReceiverHandshakeProcessor>(keys, userInfo, ticketIssuer));
+        });
+
+        auto socket = new QTcpSocket();
+        socket->connectToHost(QHostAddress::LocalHost, server.serverPort());
+        auto sender = std::make_shared<ChatSession>(std::make_shared<TcpConnection>(socket), userInfo, keys);
+        QObject::connect(sender.get(), &ChatSession::connectionEstablished, &loop, [&] {
+            sender->initialize(std::make_unique<EncryptedSessionSenderHandshakeProcessor>(keys, userInfo, ticketStore, "bench", ticketStore != nullptr));
+        });
+        QObject::connect(sender.get(), &ChatSession::sessionInitialized, &loop, onInitialized);
+        QObject::connect(sender.get(), &ChatSession::sessionInitializationError, &loop, onError);
+        QTimer::singleShot(HANDSHAKE_TIMEOUT, &loop, onError);
+
+        loop.exec();
+
+        sender->end();
+        if(receiver != nullptr) {
+            receiver->end();
+        }
+
+        if(failed) {
+            throw std::runtime_error(HANDSHAKE_FAILED_ERROR);
+        }
+    }
+
+    void benchmarkHandshake(BenchmarkSuite &suite) {
+        if(!suite.isSelected("handshake/full") && !suite.isSelected("handshake/resumed")) {
+            return;
+        }
+
+        QTcpServer server;
+        if(!server.listen(QHostAddress::LocalHost, 0)) {
+            throw std::runtime_error(HANDSHAKE_FAILED_ERROR);
+        }
+
+        auto keys = RSAKeyGenerator::generateKey(HANDSHAKE_KEY_SIZE);
+
+        suite.run("handshake/full", [&] {
+            runHandshake(server, keys, nullptr, nullptr);
+        });
+
+        // every resumed handshake issues a new ticket, which the next iteration presents
+        auto ticketIssuer = std::make_shared<SessionTicketIssuer>();
+        auto ticketStore = std::make_shared<SessionTicketStore>();
+        suite.run("handshake/resumed", [&] {
+            runHandshake(server, keys, ticketIssuer, ticketStore);
+        });
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+    QCoreApplication::setApplicationName("qtchat_bench");
+    QCoreApplication::setApplicationVersion(QTCHAT_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Microbenchmarks of QtChat framing, message conversion, cryptography and session handshakes.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption outputOption({"o", "output"}, "Write JSON results to <file> instead of standard output.", "file");
+    QCommandLineOption filterOption({"f", "filter"}, "Only run benchmarks whose name contains <text>.", "text");
+    QCommandLineOption minTimeOption("min-time", "Minimal measured time per benchmark in <seconds>.", "seconds", "0.5");
+    parser.addOption(outputOption);
+    parser.addOption(filterOption);
+    parser.addOption(minTimeOption);
+    parser.process(application);
+
+    BenchmarkSuite suite(parser.value(filterOption).toStdString(), parser.value(minTimeOption).toDouble());
+
+    try {
+        benchmarkFrameParsing(suite);
+        benchmarkConversion(suite);
+        benchmarkAes(suite);
+        benchmarkRsa(suite);
+        benchmarkHandshake(suite);
+    }
+    catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    auto json = suite.toJson().toJson();
+    if(!parser.isSet(outputOption)) {
+        std::cout << json.toStdString();
+        return 0;
+    }
+
+    QFile output(parser.value(outputOption));
+    if(!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        std::cerr << "Cannot open " << parser.value(outputOption).toStdString() << std::endl;
+        return 1;
+    }
+    output.write(json);
+
+    return 0;
+}
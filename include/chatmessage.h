@@ -1,7 +1,7 @@
 #ifndef CHATMESSAGE_H
 #define CHATMESSAGE_H
 
-#include "messaging.h"
+#include "history.h"
 
 #include <QFrame>
 
@@ -14,10 +14,10 @@ class ChatMessage : public QFrame
     Q_OBJECT
 
 public:
-    explicit ChatMessage(const std::string &username, NewChatMessage *message, bool isEditable = false, QWidget *parent = nullptr);
-    explicit ChatMessage(NewChatMessage *message, bool isEditable = false, QWidget *parent = nullptr);
-    std::string getId() { return id_; }
-    void edit(const std::string &newContent);
+    explicit ChatMessage(const std::string &username, const HistoryEntry &entry, QWidget *parent = nullptr);
+    explicit ChatMessage(const HistoryEntry &entry, QWidget *parent = nullptr);
+    MessageId getId() { return id_; }
+    void edit(const HistoryEntry &entry);
     ~ChatMessage();
 
 signals:
@@ -32,7 +32,9 @@ private:
     void hideUsername();
 
     Ui::ChatMessage *ui;
-    std::string id_;
+    MessageId id_;
+    std::string content_;
+    unsigned int version_;
 };
 
 #endif // CHATMESSAGE_H
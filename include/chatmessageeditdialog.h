@@ -14,7 +14,7 @@ class ChatMessageEditDialog : public QDialog
     Q_OBJECT
 
 public:
-    explicit ChatMessageEditDialog(const std::string &id, const std::string &content, QWidget *parent = nullptr);
+    explicit ChatMessageEditDialog(MessageId id, unsigned int version, const std::string &content, QWidget *parent = nullptr);
     ~ChatMessageEditDialog();
 
 signals:
@@ -25,7 +25,9 @@ private slots:
 
 private:
     Ui::ChatMessageEditDialog *ui;
-    std::string id_;
+    MessageId id_;
+    unsigned int version_;
+    std::string content_;
 };
 
 #endif // CHATMESSAGEEDITDIALOG_H
@@ -1,15 +1,31 @@
 #ifndef CHATMESSAGEHISTORY_H
 #define CHATMESSAGEHISTORY_H
 
+#include "history.h"
+#include "messageidmap.h"
 #include "messaging.h"
 #include <chatmessage.h>
 
+#include <list>
+#include <map>
+
 #include <QFrame>
+#include <QTimer>
+
+const size_t MAX_LOADED_HISTORY_PAGES = 8;
 
 namespace Ui {
 class ChatMessageHistory;
 }
 
+/**
+ * @brief Scrollable list of chat messages. New messages and edits are collected and shown together once per
+ * display refresh, and the view only follows new messages while it is scrolled to the bottom.
+ *
+ * Logged messages are shown page by page above the new ones. Earlier pages are read in the background as the
+ * user scrolls up, and the pages which have not been visible for the longest time are unloaded, keeping their
+ * height, once more than MAX_LOADED_HISTORY_PAGES are loaded.
+ */
 class ChatMessageHistory : public QFrame
 {
     Q_OBJECT
@@ -18,21 +34,76 @@ public:
     explicit ChatMessageHistory(QWidget *parent = nullptr);
     ~ChatMessageHistory();
 
+    /**
+     * @brief Shows a message from the history, messages of the user are editable.
+     */
+    bool addEntry(const std::string &sender, const HistoryEntry &entry);
+
+    /**
+     * @brief Shows the messages in the log above the messages added so far, starting with the newest page.
+     */
+    void showHistory(std::shared_ptr<ConversationLog> log, const std::string &ownUsername, const std::string &otherUsername);
+
 signals:
     void messageEdited(std::shared_ptr<EditChatMessage> message);
 
+    /**
+     * @brief Emitted once a batch of new messages and edits is shown, with the ids of the messages shown or edited.
+     */
+    void updatesApplied(const std::vector<MessageId> &ids);
+
 public slots:
-    void addMessage(const std::string &sender, NewChatMessage* message, bool isEditable = false);
-    void handleMessageEdit(EditChatMessage* message);
+    bool addMessage(const std::string &sender, NewChatMessage* message, bool isEditable = false);
+    bool handleMessageEdit(EditChatMessage* message);
 
 private slots:
+    void handleOwnMessageEdit(std::shared_ptr<EditChatMessage> message);
+    void applyPendingUpdates();
+    void updateAnchor(int value);
     void scrollToBottom(int min, int max);
+    void handlePageLoaded(size_t page, const std::vector<HistoryEntry> &entries);
+    void updateVisiblePages();
 
 private:
-    void addChatMessageWidget(ChatMessage *messageWidget);
+    struct PendingMessage {
+        MessageId id;
+        std::string sender; // empty if the previous message has the same sender
+    };
+
+    struct HistoryPage {
+        QWidget *container;
+        std::vector<MessageId> ids;
+        bool loaded = false;
+        bool loading = false;
+    };
+
+    void scheduleUpdate();
+    ChatMessage* createMessageWidget(const std::string &sender, const HistoryEntry &entry);
+    void createPage(size_t page);
+    void requestPage(size_t page);
+    void showPage(size_t page, const std::vector<HistoryEntry> &entries);
+    void touchPage(size_t page);
+    void evictPages();
 
     Ui::ChatMessageHistory *ui;
-    std::unordered_map<std::string, ChatMessage*> messages_;
+    ConversationHistory history_;
+    MessageIdMap<ChatMessage*> messages_;
+
+    QTimer *updateTimer_;
+    std::vector<PendingMessage> pendingMessages_;
+    std::vector<MessageId> pendingEdits_;
+    MessageIdMap<bool> pendingEditIds_;
+    bool anchoredAtBottom_ = true;
+    bool keepBottomDistance_ = false; // content was added above the visible part
+    int lastMaximum_ = 0;
+
+    HistoryPager *pager_ = nullptr;
+    std::string ownUsername_;
+    std::string otherUsername_;
+    std::map<size_t, HistoryPage> pages_;
+    std::list<size_t> recentPages_; // loaded pages, the most recently visible first
+    MessageIdMap<HistoryEntry> unloadedEdits_; // edited while their page was not loaded, until the page is shown
+    size_t firstPage_ = 0;
 
     std::string lastMessageSender_;
 };
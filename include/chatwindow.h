@@ -3,6 +3,10 @@
 
 #include "session.h"
 #include "chatmessagehistory.h"
+#include "filetransfer.h"
+#include "history.h"
+#include "historysync.h"
+#include "outbox.h"
 
 #include <QDialog>
 
@@ -18,21 +22,52 @@ public:
     explicit ChatWindow(std::shared_ptr<ChatSession> chatSession, QWidget *parent = nullptr);
     ~ChatWindow();
 
+    /**
+     * @brief Shows the conversation logged at the path and logs the new messages there, encrypted with the key.
+     */
+    void openHistory(const std::string &path, const std::string &key);
+
+    /**
+     * @brief Sends messages through the outbox while the peer is unreachable or older messages are still queued,
+     * and keeps the window usable after the session ended.
+     */
+    void openOutbox(std::shared_ptr<Outbox> outbox);
+
 public slots:
     void onNewMessageReceived(NewChatMessage *message);
     void onMessageEditReceived(EditChatMessage *message);
 
 signals:
     void messageSent(std::shared_ptr<NewChatMessage> message);
+    void groupInvitationRequested();
 
 private slots:
     void handleMessageEdited(std::shared_ptr<EditChatMessage> message);
     void handleSessionEnded();
+    void handleConnectionLost();
+    void handleConnectionRestored();
     void onSendMessageButtonClicked();
+    void onDiagnosticsButtonToggled(bool checked);
+    void updateDiagnostics();
+    void onFileButtonClicked();
+    void handleFileOffered(MessageId transferId, const std::string &name, unsigned long long size);
+    void handleFileProgress(MessageId transferId, unsigned long long transferred, unsigned long long size);
+    void handleFileFinished(MessageId transferId);
+    void handleFileFailed(MessageId transferId, const std::string &error);
+    void onSearchRequested();
+    void handleEntrySynced(const HistoryEntry &entry, bool added);
 
 private:
+    void sendChatMessage(std::shared_ptr<Message> message);
+
     Ui::ChatWindow *ui;
     std::shared_ptr<ChatSession> chatSession_;
+    QString title_;
+    QTimer *diagnosticsTimer_;
+    FileTransferManager *fileTransfers_;
+    std::shared_ptr<ConversationLog> log_;
+    HistorySync *historySync_ = nullptr;
+    OutboxSender *outbox_ = nullptr;
 };
 
 #endif // CHATWINDOW_H
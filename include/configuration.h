@@ -36,6 +36,13 @@ public:
     UserInfo userInfo;
     int port;
 
+    std::string metricsSocket; // local socket serving the metrics, disabled if empty
+    std::string metricsDumpPath; // file the metrics are periodically written to, disabled if empty
+    int metricsDumpInterval = 10000;
+    bool latencyTimestamps = false; // send chat messages with timestamps for end-to-end latency measurement
+    std::string historyPath; // directory the conversations are logged to, disabled if empty
+    std::string outboxPath; // directory messages to unreachable peers are queued in, disabled if empty
+
 private:
     static std::string getDefaultConfigDirectory();
     static std::unordered_map<std::string, std::string> loadConfigFile(const std::string &path);
@@ -0,0 +1,109 @@
+#ifndef ENCRYPTEDFILE_H
+#define ENCRYPTEDFILE_H
+
+#include <fstream>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <lib/cryptopp/aes.h>
+#include <lib/cryptopp/gcm.h>
+
+const size_t ENCRYPTED_PAGE_SIZE = 4096;
+const size_t ENCRYPTED_PAGE_CACHE_CAPACITY = 32;
+const std::string ENCRYPTED_FILE_JOURNAL_SUFFIX = ".journal";
+
+/**
+ * @brief File encrypted in independent fixed-size pages with AES-GCM, readable and writable at any offset.
+ *
+ * The file starts with the magic "QCEF", a random salt and a check value of the key. Every page holds
+ * ENCRYPTED_PAGE_SIZE bytes of plaintext, only the last one may be shorter, and is stored as a fresh random nonce,
+ * the ciphertext and the tag. The salt and the page number are authenticated with every page, so pages cannot be
+ * moved within a file or between files. Reads and writes only decrypt and encrypt the pages they touch, recently used
+ * pages are cached in plaintext and written pages are encrypted once by flush(). A page failing authentication ends
+ * what can be read.
+ *
+ * Pages are rewritten in place, so a page already on disk, like the last one which grows with every append, is first
+ * written to a journal next to the file (ENCRYPTED_FILE_JOURNAL_SUFFIX). A write torn by a crash is completed from
+ * the journal when the file is opened again, and a torn journal is ignored, as the file was not touched yet. Only new
+ * pages are ever lost, and only when their write was torn.
+ *
+ * The length of the file is not authenticated: whole pages cut off the end, or a copy of the file from an earlier
+ * point in time, are not detected.
+ */
+class EncryptedPageFile {
+public:
+    EncryptedPageFile(const std::string &path, const std::string &key);
+    ~EncryptedPageFile();
+
+    EncryptedPageFile(const EncryptedPageFile&) = delete;
+    EncryptedPageFile& operator=(const EncryptedPageFile&) = delete;
+
+    /**
+     * @brief Opens the file, creating it if it does not exist or is empty. Throws if it cannot be opened, is not
+     * an encrypted file or was encrypted with a different key.
+     */
+    void open();
+    bool isOpen() const { return file_.is_open(); }
+
+    /**
+     * @brief Returns whether the file exists, is not empty and does not start like an encrypted file.
+     */
+    static bool isPlaintext(const std::string &path);
+
+    /**
+     * @brief Replaces a plaintext file with its encryption, so files written before encryption can be opened.
+     * Offsets in the file stay the same. Does nothing if the file is not plaintext, throws if it cannot be converted.
+     */
+    void encryptPlaintext();
+
+    unsigned long long getSize() const { return size_; }
+
+    /**
+     * @brief Reads up to length bytes at the offset, returns the number of bytes read.
+     */
+    size_t read(unsigned long long offset, char *data, size_t length);
+
+    /**
+     * @brief Writes the data at the offset, extending the file as needed. The written pages are encrypted by flush().
+     */
+    void write(unsigned long long offset, const std::string &data);
+
+    /**
+     * @brief Cuts the file off at the given size. A page which cannot be read is dropped whole.
+     */
+    void resize(unsigned long long size);
+    void flush();
+
+private:
+    struct Page {
+        std::string data;
+        bool valid = true; // decrypted and authenticated
+        bool dirty = false;
+        std::list<size_t>::iterator recent;
+    };
+
+    Page& loadPage(size_t number);
+    std::string sealPage(size_t number, const Page &page);
+    bool openPage(size_t number, const std::string &stored, std::string &data);
+    void commit(unsigned long long length, bool truncate);
+    unsigned long long replayJournal(unsigned long long fileSize);
+    unsigned long long getStoredLength(unsigned long long size) const;
+    std::string getAssociatedData(size_t number) const;
+    unsigned long long getPageOffset(size_t number) const;
+    std::string getKeyCheck() const;
+
+    std::string path_;
+    std::string key_;
+    std::string salt_;
+    std::fstream file_;
+    std::fstream journal_;
+    unsigned long long size_ = 0;
+    unsigned long long storedLength_ = 0; // of the file on disk, pages before it are journaled when rewritten
+    std::unordered_map<size_t, Page> pages_;
+    std::list<size_t> recent_; // page numbers, most recently used first
+    CryptoPP::GCM<CryptoPP::AES>::Encryption encryptor_;
+    CryptoPP::GCM<CryptoPP::AES>::Decryption decryptor_;
+};
+
+#endif // ENCRYPTEDFILE_H
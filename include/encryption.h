@@ -5,9 +5,15 @@
 #include "modes.h"
 #include <QString>
 
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
 #include <lib/cryptopp/rsa.h>
 #include <lib/cryptopp/pem.h>
 
+const size_t DEFAULT_PUBLIC_KEY_CACHE_CAPACITY = 256;
+
 /**
  * @brief An abstract class for a key which can be encoded to string.
  */
@@ -34,12 +40,19 @@ public:
 
 /**
  * @brief Represents an RSA public key. Can encrypt messages.
+ * The OAEP encryptor and PEM encoding are set up once and kept for the key's lifetime. Encryption uses the calling
+ * thread's random generator, so a key can be shared between threads.
  */
 struct RSAPublicKey : public EncryptingKey {
     RSAPublicKey(long e, long n);
-    RSAPublicKey(CryptoPP::RSA::PublicKey &key) : publicKey_(key) {}
+    RSAPublicKey(CryptoPP::RSA::PublicKey &key);
     std::string encrypt(const std::string &message) override;
-    std::string encode() const override;
+    std::string encode() const override { return encoded_; }
+
+    /**
+     * @brief Returns whether the signature over the message was made with the matching private key (RSA-PSS, SHA-256).
+     */
+    bool verify(const std::string &message, const std::string &signature) const;
 
     /**
      * @brief Decodes the public key from its PEM representation
@@ -50,17 +63,26 @@ struct RSAPublicKey : public EncryptingKey {
 
 private:
     CryptoPP::RSA::PublicKey publicKey_;
+    CryptoPP::RSAES_OAEP_SHA_Encryptor encryptor_;
+    std::string encoded_;
 };
 
 /**
  * @brief Represents RSA private key. Can decrypt messages.
+ * The OAEP decryptor (holding the CRT parameters) is kept for the key's lifetime. Blinding uses the calling
+ * thread's random generator.
  */
 struct RSAPrivateKey : public DecryptingKey {
     RSAPrivateKey(long e, long n, long d);
-    RSAPrivateKey(CryptoPP::RSA::PrivateKey &key) : privateKey_(key) {}
+    RSAPrivateKey(CryptoPP::RSA::PrivateKey &key) : privateKey_(key), decryptor_(key) {}
     std::string decrypt(const std::string &message) override;
     std::string encode() const override;
 
+    /**
+     * @brief Signs the message (RSA-PSS, SHA-256), proving possession of the key to holders of the public key.
+     */
+    std::string sign(const std::string &message) const;
+
     /**
      * @brief Decodes the private key from its PEM representation
      * @param key PEM representation of the key
@@ -70,10 +92,37 @@ struct RSAPrivateKey : public DecryptingKey {
 
 private:
     CryptoPP::RSA::PrivateKey privateKey_;
+    CryptoPP::RSAES_OAEP_SHA_Decryptor decryptor_;
+};
+
+/**
+ * @brief Keeps decoded public keys of peers, keyed by the SHA-256 fingerprint of their PEM representation,
+ * so repeated handshakes with known peers skip parsing and encryptor setup. The least recently used key is evicted.
+ */
+class PublicKeyCache {
+public:
+    PublicKeyCache(size_t capacity = DEFAULT_PUBLIC_KEY_CACHE_CAPACITY) : capacity_(capacity) {}
+    static PublicKeyCache& shared();
+
+    /**
+     * @brief Returns the decoded key for its PEM representation, decoding it only if it is not cached.
+     */
+    std::shared_ptr<RSAPublicKey> get(const std::string &pem);
+    static std::string getFingerprint(const std::string &pem);
+
+private:
+    typedef std::pair<std::string, std::shared_ptr<RSAPublicKey>> Entry;
+
+    size_t capacity_;
+    std::list<Entry> entries_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::mutex mutex_;
 };
 
 /**
  * @brief Represents an AES key. Can encrypt and decrypt messages.
+ * The cipher contexts are keyed once and reused for every message, so bulk data such as file chunks does not pay
+ * for the key schedule on every call.
  */
 struct AESKey : public EncryptingKey, public DecryptingKey {
 public:
@@ -84,7 +133,11 @@ public:
     std::string encode() const;
 
 private:
+    void initializeCiphers();
+
     std::string key_;
+    CryptoPP::ECB_Mode<CryptoPP::AES>::Encryption encryptor_;
+    CryptoPP::ECB_Mode<CryptoPP::AES>::Decryption decryptor_;
 };
 
 /**
@@ -100,6 +153,44 @@ private:
     std::shared_ptr<DecryptingKey> privateKey_;
 };
 
+/**
+ * @brief Derives keys for data stored on disk with HKDF-SHA256.
+ */
+class KeyDerivation {
+public:
+    /**
+     * @brief Derives a key of the given length from secret key material.
+     * @param purpose Distinguishes the keys derived from the same material for different uses
+     */
+    static std::string derive(const std::string &secret, const std::string &purpose, size_t length = 32);
+
+    /**
+     * @brief Derives a key from the user's private key, so what it protects can only be read with that key.
+     */
+    static std::string deriveFromKeys(const KeyCombination &keys, const std::string &purpose, size_t length = 32);
+};
+
+/**
+ * @brief Stores a key for data on disk in a file, wrapped with the user's public key. The data does not depend on
+ * the user's keys, so replacing them only wraps this key again.
+ */
+class WrappedKey {
+public:
+    /**
+     * @brief Returns the key stored at the path, creating the file with the initial key if it does not exist.
+     * Throws if the file cannot be read or written or was wrapped for other keys.
+     */
+    static std::string load(const std::string &path, const KeyCombination &keys, const std::string &initialKey);
+
+    /**
+     * @brief Wraps the key stored at the path for new keys. Does nothing if no key is stored there yet.
+     */
+    static void rewrap(const std::string &path, const KeyCombination &previous, const KeyCombination &keys);
+
+private:
+    static void store(const std::string &path, const KeyCombination &keys, const std::string &key);
+};
+
 /**
  * @brief A static RSA public/private key pair generator.
  */
@@ -0,0 +1,91 @@
+#ifndef FILETRANSFER_H
+#define FILETRANSFER_H
+
+#include "session.h"
+
+#include <fstream>
+#include <map>
+
+const size_t FILE_CHUNK_SIZE = 0x10000;
+const unsigned long long FILE_TRANSFER_WINDOW = 16 * FILE_CHUNK_SIZE; // unacknowledged bytes in flight per transfer
+const unsigned long long FILE_ACKNOWLEDGEMENT_INTERVAL = 4 * FILE_CHUNK_SIZE;
+const long long FILE_SEND_WATERMARK = 2 * FILE_CHUNK_SIZE; // chunks are only queued while the socket buffer is below this
+const std::string FILE_MARKER_SUFFIX = ".part"; // next to a partial download, records the transfer and how much of it was written
+
+/**
+ * @brief Streams files over a chat session in fixed-size chunks.
+ *
+ * Only one chunk per transfer is read ahead, and a chunk is only queued while the connection's send buffer is
+ * nearly empty, so memory does not grow with the file size. Chunks are bulk frames, chat and control frames
+ * are sent ahead of them. Chunks of concurrent transfers are sent in turn. The receiver acknowledges what it has written,
+ * which both limits the data in flight and is where a transfer continues after the session is resumed.
+ * A declined offer, or a transfer either side gives up on, is cancelled on the other side as well.
+ */
+class FileTransferManager : public QObject {
+    Q_OBJECT
+
+public:
+    FileTransferManager(std::shared_ptr<ChatSession> session, QObject *parent = nullptr);
+
+    /**
+     * @brief Offers the file to the other side and sends it once accepted. Throws if the file cannot be read.
+     */
+    MessageId sendFile(const std::string &path);
+
+    /**
+     * @brief Accepts an offered file and stores it at the path, replacing what it holds. Only if a marker next to
+     * the path records a partial download of this same transfer, it continues after the recorded offset.
+     */
+    void acceptFile(MessageId transferId, const std::string &path);
+
+    /**
+     * @brief Declines an offered file, so the sender stops waiting for it.
+     */
+    void declineFile(MessageId transferId);
+
+signals:
+    void fileOffered(MessageId transferId, const std::string &name, unsigned long long size);
+    void progressed(MessageId transferId, unsigned long long transferred, unsigned long long size);
+    void finished(MessageId transferId);
+    void failed(MessageId transferId, const std::string &error);
+
+private slots:
+    void sendChunks();
+    void handleOffer(FileOfferMessage *message);
+    void handleAcknowledgement(FileAcknowledgementMessage *message);
+    void handleChunk(FileChunkMessage *message);
+    void handleCancel(FileCancelMessage *message);
+    void handleConnectionLost();
+    void handleConnectionRestored();
+
+private:
+    struct OutgoingTransfer {
+        std::ifstream file;
+        unsigned long long size = 0;
+        unsigned long long sent = 0;
+        unsigned long long acknowledged = 0;
+        bool paused = true; // until the receiver tells where to continue
+    };
+
+    struct IncomingTransfer {
+        std::ofstream file;
+        std::string markerPath;
+        std::string name;
+        unsigned long long size = 0;
+        unsigned long long received = 0;
+        unsigned long long acknowledged = 0;
+        bool accepted = false;
+    };
+
+    bool sendChunk(MessageId transferId, OutgoingTransfer &transfer);
+    void acknowledge(MessageId transferId, IncomingTransfer &transfer);
+    void cancel(MessageId transferId);
+    unsigned long long readMarker(MessageId transferId, const std::string &path, const IncomingTransfer &transfer);
+
+    std::shared_ptr<ChatSession> session_;
+    std::map<MessageId, OutgoingTransfer> outgoing_;
+    std::map<MessageId, IncomingTransfer> incoming_;
+    std::string buffer_;
+};
+
+#endif // FILETRANSFER_H
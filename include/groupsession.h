@@ -0,0 +1,82 @@
+#ifndef GROUPSESSION_H
+#define GROUPSESSION_H
+
+#include "session.h"
+
+/**
+ * @brief Represents a group conversation on top of established one-to-one chat sessions.
+ *
+ * The hosting client generates a shared group key and distributes it to every member over their chat session.
+ * Messages are encoded and encrypted with the group key once, and the resulting frame buffer is shared by all
+ * member connections. The host relays frames received from one member to the others without decrypting them again.
+ *
+ * Group payload format (encrypted with the group key):
+ * [4B hex sender name length] [sender name] [encoded chat message]
+ */
+class GroupChatSession : public QObject, protected MessageVisitor {
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Creates a new group hosted by this client.
+     */
+    GroupChatSession(UserInfo userInfo);
+
+    /**
+     * @brief Joins a group using an invitation received over the session with its host.
+     */
+    GroupChatSession(UserInfo userInfo, std::shared_ptr<ChatSession> host, GroupKeyMessage *invitation);
+
+    std::string getGroupId() const { return groupId_; }
+    UserInfo getUserInfo() const { return userInfo_; }
+    bool isHost() const { return host_; }
+    size_t getMemberCount() const { return members_.size(); }
+
+    /**
+     * @brief Invites the other side of an initialized chat session into the group. Only the host can add members.
+     */
+    void addMember(std::shared_ptr<ChatSession> member);
+    void removeMember(ChatSession *member);
+
+signals:
+    void newChatMessageReceived(const std::string &sender, NewChatMessage *message);
+    void editedChatMessageReceived(const std::string &sender, EditChatMessage *message);
+    void invalidMessageReceived(const std::string &errorMessage);
+
+public slots:
+    void sendMessage(std::shared_ptr<AbstractChatMessage> message);
+
+protected:
+    void processMessage(KeyMessage *message) override;
+    void processMessage(SessionEndMessage *message) override;
+    void processMessage(UserInfoMessage *message) override;
+    void processMessage(SessionTicketMessage *message) override;
+    void processMessage(ResumeSessionMessage *message) override;
+    void processMessage(GroupKeyMessage *message) override;
+    void processMessage(GroupChatMessage *message) override;
+    void processMessage(FileOfferMessage *message) override;
+    void processMessage(FileAcknowledgementMessage *message) override;
+    void processMessage(FileChunkMessage *message) override;
+    void processMessage(FileCancelMessage *message) override;
+    void processMessage(HistorySyncMessage *message) override;
+    void processMessage(HistoryRecordMessage *message) override;
+    void processMessage(NewChatMessage *message) override;
+    void processMessage(EditChatMessage *message) override;
+
+private:
+    void attachMember(std::shared_ptr<ChatSession> member);
+    void handleGroupMessage(ChatSession *from, GroupChatMessage *message);
+    void fanOut(const QByteArray &frame, ChatSession *except = nullptr);
+    QByteArray buildFrame(const std::string &payload);
+
+    UserInfo userInfo_;
+    std::string groupId_;
+    std::shared_ptr<AESKey> groupKey_;
+    bool host_;
+
+    std::vector<std::shared_ptr<ChatSession>> members_;
+    StandardMessageConverter messageConverter_;
+    std::string currentSender_;
+};
+
+#endif // GROUPSESSION_H
@@ -0,0 +1,41 @@
+#ifndef GROUPWINDOW_H
+#define GROUPWINDOW_H
+
+#include "groupsession.h"
+
+#include <QDialog>
+
+namespace Ui {
+class GroupWindow;
+}
+
+/**
+ * @brief Shows a group conversation and sends messages to it. The group is left when the window is closed.
+ */
+class GroupWindow : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit GroupWindow(std::shared_ptr<GroupChatSession> group, QWidget *parent = nullptr);
+    ~GroupWindow();
+
+    std::shared_ptr<GroupChatSession> getGroup() const { return group_; }
+
+    /**
+     * @brief Shows the current number of members, call after members were added or removed.
+     */
+    void updateMembers();
+
+private slots:
+    void onSendButtonClicked();
+    void handleNewMessage(const std::string &sender, NewChatMessage *message);
+
+private:
+    void addMessage(const std::string &sender, const std::string &content);
+
+    Ui::GroupWindow *ui;
+    std::shared_ptr<GroupChatSession> group_;
+};
+
+#endif // GROUPWINDOW_H
@@ -0,0 +1,176 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "encryptedfile.h"
+#include "messageidmap.h"
+#include "messaging.h"
+#include "search.h"
+
+#include <mutex>
+
+#include <QObject>
+
+const size_t HISTORY_PAGE_SIZE = 50;
+
+/**
+ * @brief A chat message as stored in the conversation history.
+ */
+struct HistoryEntry {
+    MessageId id;
+    bool outgoing;
+    std::string content;
+    unsigned int version;
+};
+
+/**
+ * @brief In-memory model of the loaded part of a conversation. Edits are applied incrementally to the stored contents.
+ */
+class ConversationHistory {
+public:
+    /**
+     * @brief Adds a message, returns false if a message with the same id is already present.
+     */
+    bool addEntry(const HistoryEntry &entry);
+    bool addMessage(NewChatMessage *message, bool outgoing);
+    void removeEntry(MessageId id);
+
+    /**
+     * @brief Applies the edit if it produces the next version of a known message; edits carrying the whole
+     * content may also skip versions. On success the edit's content is set to the rebuilt content.
+     */
+    bool applyEdit(EditChatMessage *message);
+
+    const HistoryEntry* find(MessageId id) const;
+    size_t size() const { return entries_.size(); }
+
+private:
+    MessageIdMap<HistoryEntry> entries_;
+};
+
+/**
+ * @brief Append-only file with the chat messages of one conversation. Edits are stored as deltas whenever
+ * those are smaller, so the log grows by the size of the change rather than the size of the message.
+ *
+ * Every edit record points to the previous record of its message, and an index file next to the log holds
+ * the first and latest record of every message in the order they were logged. Any message can therefore be
+ * read without replaying the log, and opening it only has to look at what was appended after the last index
+ * update. Logged messages and edits are also added to a SearchIndex stored next to the log. The log and its index
+ * are EncryptedPageFiles, so reading a message or appending one only decrypts and encrypts the pages involved.
+ * All methods may be called from different threads.
+ */
+class ConversationLog {
+public:
+    /**
+     * @param key Key of the log's encryption, 32 bytes. The key of the search index is derived from it.
+     */
+    ConversationLog(const std::string &path, const std::string &key);
+    ~ConversationLog();
+
+    /**
+     * @brief Opens the log for reading and appending. Records missing in the index, left by a crash, are indexed,
+     * and a torn last record is cut off. Messages logged after the search index was last written are added to it
+     * again. A log written before logs were encrypted is encrypted first. Throws if the files cannot be opened or
+     * were encrypted with a different key.
+     */
+    void open();
+    void append(NewChatMessage *message, bool outgoing);
+    void append(EditChatMessage *message, bool outgoing);
+
+    size_t getMessageCount();
+
+    /**
+     * @brief Reads the current state of the messages at the given positions in the order they were logged.
+     * Messages which cannot be read are skipped.
+     */
+    std::vector<HistoryEntry> readEntries(size_t first, size_t count);
+
+    /**
+     * @brief Reads the current state of a message, returns false if it is not in the log.
+     */
+    bool readEntry(MessageId id, HistoryEntry &entry);
+
+    /**
+     * @brief Returns the id and current version of every logged message in the order they were logged.
+     */
+    std::vector<SyncItem> getVersions();
+
+    /**
+     * @brief Returns up to limit messages whose current content contains the query, newest first. The query is
+     * matched case insensitively for ASCII letters and needs at least MIN_SEARCH_QUERY_LENGTH characters.
+     */
+    std::vector<HistoryEntry> search(const std::string &query, size_t limit);
+
+private:
+    struct Record {
+        char type;
+        bool outgoing;
+        MessageId id;
+        unsigned int version;
+        unsigned long long previous;
+        std::string payload;
+    };
+
+    struct Slot {
+        MessageId id;
+        unsigned long long first;
+        unsigned long long latest;
+    };
+
+    bool readRecord(unsigned long long offset, Record &record);
+    bool readSlot(size_t position, Slot &slot);
+    void writeSlot(size_t position, const Slot &slot);
+    void writeIndexedLength();
+    bool findSlot(MessageId id, size_t &position, Slot &slot);
+    bool readEntry(const Slot &slot, HistoryEntry &entry);
+    void indexRecord(const Record &record, unsigned long long offset);
+    bool appendRecord(const Record &record);
+    void updateSearchIndex();
+    void addToSearchIndex(size_t position, const std::string &content, unsigned long long indexedLength, size_t indexedMessages);
+
+    std::string path_;
+    std::string indexPath_;
+    std::mutex mutex_;
+    EncryptedPageFile file_;
+    EncryptedPageFile index_;
+    unsigned long long length_ = 0;
+    size_t slotCount_ = 0;
+    MessageIdMap<size_t> positions_; // of the messages looked up so far
+    bool allPositionsKnown_ = false; // positions_ holds every message once the whole index has been scanned
+    SearchIndex search_;
+};
+
+/**
+ * @brief Reads pages of a conversation log on the global thread pool and delivers them to the thread it lives in.
+ * Page n holds the messages logged at positions n * HISTORY_PAGE_SIZE up to the next page. Only messages
+ * logged before the pager was created are paged.
+ */
+class HistoryPager : public QObject {
+    Q_OBJECT
+
+public:
+    HistoryPager(std::shared_ptr<ConversationLog> log, QObject *parent = nullptr);
+    ~HistoryPager();
+
+    std::shared_ptr<ConversationLog> getLog() const { return log_; }
+    size_t getPageCount() const;
+    std::vector<HistoryEntry> readPage(size_t page);
+    void requestPage(size_t page);
+
+signals:
+    void pageLoaded(size_t page, const std::vector<HistoryEntry> &entries);
+
+private:
+    // outlives the pager while pages are loaded, so a finished load never reaches a destroyed pager
+    struct Receiver {
+        std::mutex mutex;
+        HistoryPager *pager;
+    };
+
+    static std::vector<HistoryEntry> readPage(std::shared_ptr<ConversationLog> log, size_t page, size_t messageCount);
+
+    std::shared_ptr<ConversationLog> log_;
+    size_t messageCount_;
+    std::shared_ptr<Receiver> receiver_;
+};
+
+#endif // HISTORY_H
@@ -0,0 +1,89 @@
+#ifndef HISTORYSYNC_H
+#define HISTORYSYNC_H
+
+#include "history.h"
+#include "session.h"
+
+#include <deque>
+
+const size_t SYNC_BRANCHING = 8;
+const size_t SYNC_LIST_THRESHOLD = 16;
+const size_t SYNC_MESSAGE_ITEMS = 2048; // ranges, listed items and requested ids per synchronization message
+const long long SYNC_SEND_WATERMARK = 0x10000; // records are only queued while the socket buffer is below this
+
+/**
+ * @brief Range-based set reconciliation over the ids and versions of the messages of a conversation.
+ *
+ * A range of ids is summarized by the number of messages in it and the sum of their hashes. Ranges whose
+ * summaries differ are split into SYNC_BRANCHING parts until one side has few enough messages in a range to
+ * list them, so the data exchanged grows with the difference between the two sets and only logarithmically
+ * with their size.
+ */
+class SetReconciler {
+public:
+    explicit SetReconciler(std::vector<SyncItem> items);
+
+    /**
+     * @brief Returns the ranges starting a synchronization, covering all ids.
+     */
+    std::vector<SyncRange> initiate() const;
+
+    /**
+     * @brief Compares a range received from the other side with our messages.
+     * @param replies Receives the ranges to send back while the range still differs
+     * @param offered Receives our messages the other side is missing or has an older version of
+     * @param requested Receives the messages we are missing or have an older version of
+     */
+    void reconcile(const SyncRange &range, std::vector<SyncRange> &replies, std::vector<MessageId> &offered, std::vector<MessageId> &requested) const;
+
+    static unsigned long long hash(const SyncItem &item);
+
+private:
+    SyncRange describe(MessageId lower, MessageId upper) const;
+    std::pair<size_t, size_t> find(MessageId lower, MessageId upper) const;
+
+    std::vector<SyncItem> items_; // sorted by id
+    std::vector<unsigned long long> prefixSums_; // of the hashes, prefixSums_[i] covers items_[0, i)
+};
+
+/**
+ * @brief Synchronizes a conversation log with the peer's after the handshake, so messages missed while one side
+ * was offline end up in both logs.
+ *
+ * The side which opened the connection starts, right away and after every resumption. Both sides compare ranges
+ * with a SetReconciler over a snapshot of their log and then send the messages the other side is missing as history
+ * records. Records are bulk frames and only queued while the connection's send buffer is nearly empty.
+ * Only records of messages the peer wrote are logged, records of our own messages are ignored.
+ */
+class HistorySync : public QObject {
+    Q_OBJECT
+
+public:
+    HistorySync(std::shared_ptr<ChatSession> session, std::shared_ptr<ConversationLog> log, QObject *parent = nullptr);
+
+signals:
+    /**
+     * @brief Emitted when a record received from the peer was logged.
+     * @param added Whether the message was not logged before, otherwise this is a newer version of it
+     */
+    void entrySynced(const HistoryEntry &entry, bool added);
+
+private slots:
+    void start();
+    void handleSyncMessage(HistorySyncMessage *message);
+    void handleRecord(HistoryRecordMessage *message);
+    void sendRecords();
+    void handleConnectionLost();
+    void handleConnectionRestored();
+
+private:
+    void loadSnapshot();
+    void send(const std::vector<SyncRange> &ranges, const std::vector<MessageId> &requested);
+
+    std::shared_ptr<ChatSession> session_;
+    std::shared_ptr<ConversationLog> log_;
+    std::unique_ptr<SetReconciler> reconciler_;
+    std::deque<MessageId> offered_;
+};
+
+#endif // HISTORYSYNC_H
@@ -3,9 +3,12 @@
 
 #include "configuration.h"
 #include "connectiondialog.h"
+#include "groupwindow.h"
 #include "messaging.h"
 #include "network.h"
+#include "outbox.h"
 #include "session.h"
+#include "sessionregistry.h"
 
 #include <QMainWindow>
 
@@ -22,14 +25,11 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();    
 
-signals:
-    void configurationChanged();
-
 private slots:
     void onChatRequestReceived(std::shared_ptr<ChatSession> session);
-    void onConnectionEstablished(std::shared_ptr<ChatSession> session, ConnectionDialog *connectionDialog = nullptr);
-    void onSessionEstablished(std::shared_ptr<ChatSession> session, ConnectionDialog *connectionDialog = nullptr);
-    void onDisconnect(std::shared_ptr<ChatSession> session, ConnectionDialog *connectionDialog = nullptr);
+    void onConnectionEstablished(ChatSession *session, std::shared_ptr<const Configuration> configuration, ConnectionDialog *connectionDialog = nullptr);
+    void onSessionEstablished(ChatSession *session, std::shared_ptr<const Configuration> configuration, ConnectionDialog *connectionDialog = nullptr);
+    void onDisconnect(ChatSession *session, ConnectionDialog *connectionDialog = nullptr);
     void handleConfigurationChange(Configuration &configuration);
 
     void onConnectButtonClicked();
@@ -40,12 +40,37 @@ private slots:
 private:
     ConnectionDialog* createConnectionDialog();
     void initializeSessionCreator();
+    void initializeMetricsExporter();
     Configuration loadConfiguration();
 
+    /**
+     * @brief Returns the random key the conversation logs are encrypted with, creating it on first use. It is stored
+     * in the history directory wrapped with the user's public key. Throws if it cannot be read.
+     */
+    std::string getHistoryKey(const Configuration &configuration);
+
+    /**
+     * @brief Returns the outbox in the configured directory for messages to the peer holding the key with the given fingerprint, opening it on
+     * first use. Returns null if outboxes are disabled or it cannot be opened.
+     */
+    std::shared_ptr<Outbox> getOutbox(const Configuration &configuration, const std::string &keyFingerprint);
+
+    /**
+     * @brief Invites the other side of the session into the group hosted here, creating the group first if needed.
+     */
+    void inviteToGroup(ChatSession *session);
+    void joinGroup(ChatSession *session, GroupKeyMessage *invitation);
+    GroupWindow* openGroupWindow(std::shared_ptr<GroupChatSession> group);
+
     Ui::MainWindow *ui_;
 
     std::unique_ptr<ChatSessionCreator> sessionCreator_;
-    Configuration configuration_;
+    MetricsExporter *metricsExporter_;
+    SessionRegistry *sessions_;
+    std::shared_ptr<const Configuration> configuration_; // replaced as a whole, sessions keep the snapshot they were started with
+    std::unordered_map<std::string, std::shared_ptr<Outbox>> outboxes_; // by path, so every file is opened once
+    std::unordered_map<std::string, GroupWindow*> groupWindows_; // by group id, hosted and joined
+    std::string hostedGroupId_;
 
     QString host_;
     int port_;
@@ -0,0 +1,115 @@
+#ifndef MESSAGEIDMAP_H
+#define MESSAGEIDMAP_H
+
+#include "messaging.h"
+
+#include <vector>
+
+const size_t MESSAGE_ID_MAP_INITIAL_CAPACITY = 64;
+
+/**
+ * @brief Hash table from message ids to values with open addressing and linear probing. Ids are consecutive
+ * per sender, so they are spread by Fibonacci hashing. The table is kept at most half full.
+ *
+ * Id 0 marks empty slots and cannot be stored; generated ids are never 0.
+ */
+template<typename T>
+class MessageIdMap {
+public:
+    MessageIdMap() { rehash(MESSAGE_ID_MAP_INITIAL_CAPACITY); }
+
+    /**
+     * @brief Inserts a value or replaces the value stored for the id.
+     */
+    void insert(MessageId id, const T &value) {
+        if(2 * (size_ + 1) > slots_.size()) {
+            rehash(2 * slots_.size());
+        }
+
+        auto index = findSlot(id);
+        if(slots_[index].id == 0) {
+            slots_[index].id = id;
+            ++size_;
+        }
+        slots_[index].value = value;
+    }
+
+    /**
+     * @brief Returns a pointer to the value stored for the id, or nullptr. It is valid until the map is modified.
+     */
+    T* find(MessageId id) {
+        auto index = findSlot(id);
+        return slots_[index].id == 0 ? nullptr : &slots_[index].value;
+    }
+
+    const T* find(MessageId id) const {
+        auto index = findSlot(id);
+        return slots_[index].id == 0 ? nullptr : &slots_[index].value;
+    }
+
+    bool erase(MessageId id) {
+        auto index = findSlot(id);
+        if(slots_[index].id == 0) {
+            return false;
+        }
+
+        // backward shift deletion, so no tombstones are needed
+        auto mask = slots_.size() - 1;
+        auto next = (index + 1) & mask;
+        while(slots_[next].id != 0) {
+            auto home = getHome(slots_[next].id);
+            if(((next - home) & mask) >= ((next - index) & mask)) {
+                slots_[index] = slots_[next];
+                index = next;
+            }
+            next = (next + 1) & mask;
+        }
+
+        slots_[index] = Slot();
+        --size_;
+        return true;
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    struct Slot {
+        MessageId id = 0;
+        T value = T();
+    };
+
+    size_t getHome(MessageId id) const {
+        return (id * 0x9E3779B97F4A7C15ULL) >> shift_;
+    }
+
+    size_t findSlot(MessageId id) const {
+        auto mask = slots_.size() - 1;
+        auto index = getHome(id);
+        while(slots_[index].id != 0 && slots_[index].id != id) {
+            index = (index + 1) & mask;
+        }
+        return index;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> previous(capacity);
+        previous.swap(slots_);
+
+        shift_ = 64;
+        for(auto c = capacity; c > 1; c >>= 1) {
+            --shift_;
+        }
+
+        for(auto &slot : previous) {
+            if(slot.id != 0) {
+                slots_[findSlot(slot.id)] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots_; // the capacity is a power of two
+    size_t size_ = 0;
+    int shift_ = 64;
+};
+
+#endif // MESSAGEIDMAP_H
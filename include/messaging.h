@@ -5,8 +5,52 @@
 #include "encryption.h"
 #include "network.h"
 
+#include <vector>
+
 class MessageVisitor;
 
+const unsigned int GROUP_ID_LENGTH = 16;
+const unsigned int MESSAGE_ID_LENGTH = 8; // bytes on the wire
+
+/**
+ * @brief Globally unique chat message id: a random per-process sender prefix in the upper 32 bits and
+ * a counter in the lower 32 bits. 0 is never a valid id.
+ */
+typedef unsigned long long MessageId;
+
+/**
+ * @brief Replaces the byte range [offset, offset + length) of a message with the replacement.
+ */
+struct DeltaOperation {
+    size_t offset;
+    size_t length;
+    std::string replacement;
+};
+
+/**
+ * @brief A compact difference between two versions of a message content, made of byte range replacements
+ * applied in order.
+ */
+class MessageDelta {
+public:
+    /**
+     * @brief Computes the delta turning the original into the edited content. The common prefix and suffix
+     * are kept, so a local change costs only the changed bytes.
+     */
+    static MessageDelta compute(const std::string &original, const std::string &edited);
+    static MessageDelta decode(const std::string &encoded);
+
+    /**
+     * @brief Applies the delta to the content it was computed against. Throws if it does not fit the content.
+     */
+    std::string apply(const std::string &content) const;
+    std::string encode() const;
+    const std::vector<DeltaOperation>& getOperations() const { return operations_; }
+
+private:
+    std::vector<DeltaOperation> operations_;
+};
+
 /**
  * @brief An abstract class for data messages which can be exchanged between clients.
  */
@@ -36,15 +80,199 @@ public:
 };
 
 /**
- * @brief Represents a message containing user information about the sender.
+ * @brief Represents a message containing user information about the sender, optionally with the sender's public key
+ * and a signature binding it to the session.
  */
 class UserInfoMessage : public Message {
 public:
-    UserInfoMessage(UserInfo &userInfo) : userInfo_(userInfo) {}
+    UserInfoMessage(UserInfo &userInfo, const std::string &publicKey = "", const std::string &signature = "")
+        : userInfo_(userInfo), publicKey_(publicKey), signature_(signature) {}
     UserInfo getUserInfo() { return userInfo_; }
+    std::string getPublicKey() const { return publicKey_; }
+    std::string getSignature() const { return signature_; }
     void process(MessageVisitor *handler) override;
 private:
     UserInfo userInfo_;
+    std::string publicKey_;
+    std::string signature_;
+};
+
+/**
+ * @brief Represents a session resumption ticket issued by the connection receiver.
+ */
+class SessionTicketMessage : public Message {
+public:
+    SessionTicketMessage(const std::string &sessionId, const std::string &ticket, unsigned int lifetime) : sessionId_(sessionId), ticket_(ticket), lifetime_(lifetime) {}
+    std::string getSessionId() const { return sessionId_; }
+    std::string getTicket() const { return ticket_; }
+    unsigned int getLifetime() const { return lifetime_; }
+    void process(MessageVisitor *handler) override;
+private:
+    std::string sessionId_;
+    std::string ticket_;
+    unsigned int lifetime_;
+};
+
+/**
+ * @brief Represents a request to resume a previous session (ticket and client nonce), or its acceptance
+ * (server nonce only).
+ */
+class ResumeSessionMessage : public Message {
+public:
+    ResumeSessionMessage(const std::string &nonce, const std::string &ticket = "") : nonce_(nonce), ticket_(ticket) {}
+    std::string getNonce() const { return nonce_; }
+    std::string getTicket() const { return ticket_; }
+    void process(MessageVisitor *handler) override;
+private:
+    std::string nonce_;
+    std::string ticket_;
+};
+
+/**
+ * @brief Represents an invitation to a group conversation, carrying the shared group key.
+ */
+class GroupKeyMessage : public Message {
+public:
+    GroupKeyMessage(const std::string &groupId, const std::string &key) : groupId_(groupId), key_(key) {}
+    std::string getGroupId() const { return groupId_; }
+    std::string getKey() const { return key_; }
+    void process(MessageVisitor *handler) override;
+private:
+    std::string groupId_;
+    std::string key_;
+};
+
+/**
+ * @brief Represents a message of a group conversation. The payload is encrypted with the group key,
+ * so the same frame can be delivered to every member.
+ */
+class GroupChatMessage : public Message {
+public:
+    GroupChatMessage(const std::string &groupId, const std::string &payload) : groupId_(groupId), payload_(payload) {}
+    std::string getGroupId() const { return groupId_; }
+    std::string getPayload() const { return payload_; }
+    void process(MessageVisitor *handler) override;
+private:
+    std::string groupId_;
+    std::string payload_;
+};
+
+/**
+ * @brief Represents an offer to send a file. Transfer ids are generated like message ids.
+ */
+class FileOfferMessage : public Message {
+public:
+    FileOfferMessage(MessageId transferId, unsigned long long size, const std::string &name) : transferId_(transferId), size_(size), name_(name) {}
+    MessageId getTransferId() const { return transferId_; }
+    unsigned long long getSize() const { return size_; }
+    std::string getName() const { return name_; }
+    void process(MessageVisitor *handler) override;
+private:
+    MessageId transferId_;
+    unsigned long long size_;
+    std::string name_;
+};
+
+/**
+ * @brief Tells the sender of a file that everything before the offset is stored, so it may send further
+ * and, after a reconnect, continue from there. The first one accepts the offer.
+ */
+class FileAcknowledgementMessage : public Message {
+public:
+    FileAcknowledgementMessage(MessageId transferId, unsigned long long offset) : transferId_(transferId), offset_(offset) {}
+    MessageId getTransferId() const { return transferId_; }
+    unsigned long long getOffset() const { return offset_; }
+    void process(MessageVisitor *handler) override;
+private:
+    MessageId transferId_;
+    unsigned long long offset_;
+};
+
+/**
+ * @brief Ends a file transfer on the other side too: the receiver sends it when it declines the offer or cannot
+ * store the file, the sender when it cannot read it any more.
+ */
+class FileCancelMessage : public Message {
+public:
+    FileCancelMessage(MessageId transferId) : transferId_(transferId) {}
+    MessageId getTransferId() const { return transferId_; }
+    void process(MessageVisitor *handler) override;
+private:
+    MessageId transferId_;
+};
+
+/**
+ * @brief Represents a part of a file starting at the given offset.
+ */
+class FileChunkMessage : public Message {
+public:
+    FileChunkMessage(MessageId transferId, unsigned long long offset, const std::string &data) : transferId_(transferId), offset_(offset), data_(data) {}
+    MessageId getTransferId() const { return transferId_; }
+    unsigned long long getOffset() const { return offset_; }
+    const std::string& getData() const { return data_; }
+    void process(MessageVisitor *handler) override;
+private:
+    MessageId transferId_;
+    unsigned long long offset_;
+    std::string data_;
+};
+
+/**
+ * @brief A message compared during history synchronization, identified by its id and the version of its content.
+ */
+struct SyncItem {
+    MessageId id;
+    unsigned int version;
+};
+
+/**
+ * @brief The sender's messages with ids in [lower, upper) during history synchronization, an upper bound of 0
+ * standing for no bound. They are either summarized by their count and fingerprint, or listed.
+ */
+struct SyncRange {
+    MessageId lower = 0;
+    MessageId upper = 0;
+    bool listed = false;
+    unsigned long long count = 0;
+    unsigned long long fingerprint = 0;
+    std::vector<SyncItem> items; // sorted by id, only if listed
+};
+
+/**
+ * @brief Represents a step of history synchronization: ranges for the other side to compare with its own
+ * messages, and the ids of messages the sender wants to be sent.
+ */
+class HistorySyncMessage : public Message {
+public:
+    HistorySyncMessage(const std::vector<SyncRange> &ranges, const std::vector<MessageId> &requested) : ranges_(ranges), requested_(requested) {}
+    const std::vector<SyncRange>& getRanges() const { return ranges_; }
+    const std::vector<MessageId>& getRequested() const { return requested_; }
+    void process(MessageVisitor *handler) override;
+private:
+    std::vector<SyncRange> ranges_;
+    std::vector<MessageId> requested_;
+};
+
+/**
+ * @brief Represents a message of the conversation history in its current version, sent to a peer missing it.
+ */
+class HistoryRecordMessage : public Message {
+public:
+    HistoryRecordMessage(MessageId id, unsigned int version, bool authored, const std::string &content) : id_(id), version_(version), authored_(authored), content_(content) {}
+    MessageId getId() const { return id_; }
+    unsigned int getVersion() const { return version_; }
+
+    /**
+     * @brief Returns whether the sender of the record wrote the message.
+     */
+    bool isAuthored() const { return authored_; }
+    std::string getContent() const { return content_; }
+    void process(MessageVisitor *handler) override;
+private:
+    MessageId id_;
+    unsigned int version_;
+    bool authored_;
+    std::string content_;
 };
 
 /**
@@ -52,17 +280,29 @@ private:
  */
 class AbstractChatMessage : public Message {
 public:
-    virtual std::string getId() const { return id_; }
+    virtual MessageId getId() const { return id_; }
     virtual std::string getContent() const { return message_; }
 
+    /**
+     * @brief Sender's steady clock timestamps in microseconds, 0 if the message is not timestamped.
+     * Creation is stamped by the user interface, sending by the message converter.
+     */
+    long long getCreatedAt() const { return createdAt_; }
+    long long getSentAt() const { return sentAt_; }
+    void setCreatedAt(long long timestamp) { createdAt_ = timestamp; }
+    void setSentAt(long long timestamp) { sentAt_ = timestamp; }
+
+    static MessageId generateId();
+
 protected:
-    AbstractChatMessage(const std::string &id, const std::string &content) : id_(id), message_(content) {}
+    AbstractChatMessage(MessageId id, const std::string &content) : id_(id), message_(content) {}
     AbstractChatMessage(const std::string &content) : id_(generateId()), message_(content) {}
-    std::string generateId();
 
 protected:
-    std::string id_;
+    MessageId id_;
     std::string message_;
+    long long createdAt_ = 0;
+    long long sentAt_ = 0;
 };
 
 /**
@@ -70,18 +310,33 @@ protected:
  */
 class NewChatMessage : public AbstractChatMessage {
 public:
-    NewChatMessage(const std::string &id, const std::string &message) : AbstractChatMessage(id, message) {}
+    NewChatMessage(MessageId id, const std::string &message) : AbstractChatMessage(id, message) {}
     NewChatMessage(const std::string &message) : AbstractChatMessage(message) {}
     void process(MessageVisitor *handler) override;
 };
 
 /**
- * @brief Represents a message edit.
+ * @brief Represents a message edit producing the given version of the message, the original being version 0.
+ * The edit carries either the whole new content, or a delta against the previous version.
  */
 class EditChatMessage : public AbstractChatMessage {
 public:
-    EditChatMessage(const std::string &id, const std::string &message) : AbstractChatMessage(id, message) {}
+    EditChatMessage(MessageId id, unsigned int version, const std::string &message) : AbstractChatMessage(id, message), version_(version) {}
+    EditChatMessage(MessageId id, unsigned int version, const MessageDelta &delta, const std::string &message = "")
+        : AbstractChatMessage(id, message), version_(version), delta_(delta), hasDelta_(true) {}
+    unsigned int getVersion() const { return version_; }
+    bool hasDelta() const { return hasDelta_; }
+    const MessageDelta& getDelta() const { return delta_; }
+
+    /**
+     * @brief Sets the content rebuilt by the receiver from the delta.
+     */
+    void setContent(const std::string &content) { message_ = content; }
     void process(MessageVisitor *handler) override;
+private:
+    unsigned int version_;
+    MessageDelta delta_;
+    bool hasDelta_ = false;
 };
 
 /**
@@ -92,6 +347,16 @@ public:
     virtual void processMessage(KeyMessage *message) = 0;
     virtual void processMessage(SessionEndMessage *message) = 0;
     virtual void processMessage(UserInfoMessage *message) = 0;
+    virtual void processMessage(SessionTicketMessage *message) = 0;
+    virtual void processMessage(ResumeSessionMessage *message) = 0;
+    virtual void processMessage(GroupKeyMessage *message) = 0;
+    virtual void processMessage(GroupChatMessage *message) = 0;
+    virtual void processMessage(FileOfferMessage *message) = 0;
+    virtual void processMessage(FileAcknowledgementMessage *message) = 0;
+    virtual void processMessage(FileChunkMessage *message) = 0;
+    virtual void processMessage(FileCancelMessage *message) = 0;
+    virtual void processMessage(HistorySyncMessage *message) = 0;
+    virtual void processMessage(HistoryRecordMessage *message) = 0;
     virtual void processMessage(NewChatMessage *message) = 0;
     virtual void processMessage(EditChatMessage *message) = 0;
 };
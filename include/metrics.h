@@ -0,0 +1,164 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <QLocalServer>
+#include <QTimer>
+
+const unsigned int HISTOGRAM_BUCKETS = 40; // bucket i counts values up to 2^i, the last one everything above
+const unsigned int MAX_METRIC_SLOTS = 1024;
+
+/**
+ * @brief Handle of a registered counter. Gauges are counters which are also given negative deltas.
+ */
+class Counter {
+public:
+    void add(long long value = 1) const;
+
+private:
+    friend class MetricsRegistry;
+    Counter(unsigned int slot) : slot_(slot) {}
+
+    unsigned int slot_;
+};
+
+/**
+ * @brief Handle of a registered histogram with power of two buckets.
+ */
+class Histogram {
+public:
+    void record(unsigned long long value) const;
+
+private:
+    friend class MetricsRegistry;
+    Histogram(unsigned int slot) : slot_(slot) {}
+
+    unsigned int slot_;
+};
+
+/**
+ * @brief Records the time from its construction to its destruction into a histogram, in nanoseconds.
+ */
+class ScopedLatency {
+public:
+    ScopedLatency(const Histogram &histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency();
+
+private:
+    const Histogram &histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * @brief Traffic counters of a single connection. Written by the thread owning the connection, readable from any thread.
+ */
+struct ConnectionMetrics {
+    ConnectionMetrics(unsigned long long id) : id(id) {}
+    void setPeer(const std::string &peer);
+    std::string getPeer() const;
+
+    const unsigned long long id;
+    std::atomic<unsigned long long> bytesReceived{0};
+    std::atomic<unsigned long long> bytesSent{0};
+    std::atomic<unsigned long long> framesReceived{0};
+    std::atomic<unsigned long long> framesSent{0};
+    std::atomic<long long> receiveBufferBytes{0};
+    std::atomic<long long> sendBufferBytes{0};
+
+private:
+    mutable std::mutex mutex_;
+    std::string peer_;
+};
+
+/**
+ * @brief Process-wide registry of counters, gauges and histograms.
+ *
+ * Every thread updates its own shard of slots without locking; shards are only summed up when the metrics are read.
+ * Handles should be registered once (e. g. as file level constants) and kept, registration takes a lock.
+ */
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+
+    Counter counter(const std::string &name);
+    Counter gauge(const std::string &name);
+    Histogram histogram(const std::string &name);
+    std::shared_ptr<ConnectionMetrics> createConnectionMetrics();
+
+    /**
+     * @brief Aggregates all metrics in the Prometheus text exposition format.
+     */
+    std::string exportText();
+
+    std::atomic<unsigned long long>* getLocalSlots();
+
+private:
+    enum class MetricType { Counter, Gauge, Histogram };
+
+    struct Metric {
+        std::string name;
+        MetricType type;
+        unsigned int slot;
+    };
+
+    struct Shard {
+        std::atomic<unsigned long long> values[MAX_METRIC_SLOTS] = {};
+    };
+
+    class ShardHandle {
+    public:
+        ShardHandle();
+        ~ShardHandle();
+        Shard shard;
+    };
+
+    MetricsRegistry() {}
+    unsigned int registerMetric(const std::string &name, MetricType type, unsigned int slotCount);
+    void retireShard(Shard *shard);
+    std::vector<unsigned long long> aggregate();
+
+    std::mutex mutex_;
+    std::vector<Metric> metrics_;
+    unsigned int nextSlot_ = 0;
+    std::vector<Shard*> shards_;
+    std::vector<unsigned long long> retired_ = std::vector<unsigned long long>(MAX_METRIC_SLOTS);
+    std::vector<std::weak_ptr<ConnectionMetrics>> connections_;
+    unsigned long long nextConnectionId_ = 0;
+};
+
+namespace Metrics {
+    Counter counter(const std::string &name);
+    Counter gauge(const std::string &name);
+    Histogram histogram(const std::string &name);
+}
+
+/**
+ * @brief Makes the metrics available outside of the process: every client of the local socket receives a single dump
+ * and is disconnected, and the dump can be periodically written to a file.
+ */
+class MetricsExporter : public QObject {
+    Q_OBJECT
+
+public:
+    MetricsExporter(QObject *parent = nullptr);
+    bool listen(const std::string &socketName);
+    void startDump(const std::string &path, int interval);
+    void stop();
+
+private slots:
+    void handleNewConnection();
+    void dump();
+
+private:
+    QLocalServer *server_;
+    QTimer *dumpTimer_;
+    std::string dumpPath_;
+};
+
+#endif // METRICS_H
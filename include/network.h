@@ -1,8 +1,46 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
+#include "metrics.h"
+
+#include <array>
+#include <chrono>
+#include <deque>
+
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QTimer>
+
+const int DEFAULT_HEARTBEAT_INTERVAL = 2000;
+const int DEFAULT_HEARTBEAT_TIMEOUT = 6000;
+
+/**
+ * @brief Outgoing frames are queued by priority, the queues are drained strictly in this order.
+ */
+enum class FramePriority { Control, Interactive, Bulk };
+const size_t FRAME_PRIORITY_COUNT = 3;
+
+/**
+ * @brief Splits a received byte stream into frames. Every frame starts with its total length
+ * (including the 8 byte header) as 5 hex characters.
+ */
+class FrameParser {
+public:
+    void append(const std::string &data) { buffer_ += data; }
+
+    /**
+     * @brief Takes the next complete frame out of the buffer.
+     * @return false if no complete frame is buffered yet
+     */
+    bool next(std::string &frame);
+    void clear();
+    size_t getBufferedLength() const { return buffer_.length(); }
+
+private:
+    unsigned int getMessageSize(const std::string &message) const;
+
+    std::string buffer_;
+};
 
 /**
  * @brief An abstract class representing a single socket connection.
@@ -14,38 +52,125 @@ public:
     virtual bool isConnected() = 0;
     virtual void close() = 0;
 
+    /**
+     * @brief Configures keepalive heartbeats. The connection is closed if nothing is received from the peer for the timeout.
+     * @param interval Heartbeat interval in milliseconds, 0 disables heartbeats
+     * @param timeout Time without any received data after which the peer is considered dead, in milliseconds
+     */
+    virtual void setHeartbeat(int interval, int timeout) = 0;
+
+    /**
+     * @brief Returns the smoothed round trip time measured by heartbeats in milliseconds, or 0 if not measured yet.
+     */
+    virtual double getSmoothedRtt() const = 0;
+
+    /**
+     * @brief Returns the round trip time variation (jitter) measured by heartbeats in milliseconds.
+     */
+    virtual double getRttVariation() const = 0;
+
+    /**
+     * @brief Returns how far the peer's steady clock is ahead of ours in microseconds, estimated from the heartbeat
+     * with the lowest recent round trip time.
+     */
+    virtual long long getClockOffset() const = 0;
+    virtual bool isClockOffsetKnown() const = 0;
+
+    /**
+     * @brief Returns the number of sent bytes not yet handed to the operating system, including queued frames.
+     */
+    virtual long long getPendingBytes() const = 0;
+
 public slots:
-    virtual void send(const std::string &message) const = 0;
+    virtual void send(const std::string &message) = 0;
+
+    /**
+     * @brief Sends a frame without copying it, so one implicitly shared buffer can be written to many connections.
+     */
+    virtual void sendFrame(const QByteArray &frame) = 0;
 
 signals:
     void connected();
     void disconnected();
     void messageReceived(const std::string &content);
+    void bytesWritten();
 };
 
 /**
- * @brief Represents a TCP socket connection.
+ * @brief Represents a TCP socket connection. Heartbeat frames (type H) are exchanged and consumed here
+ * and never reach the connection's users.
+ *
+ * Outgoing frames wait in one queue per priority and are only handed to the socket while its buffer is nearly
+ * empty, so control frames overtake queued chat messages and file chunks. Frames larger than a slice are sent
+ * as slice frames (type L) which the receiving connection puts back together, so a control frame never waits
+ * for more than one slice.
  */
 class TcpConnection : public Connection {
     Q_OBJECT
 
 public:
     TcpConnection(QTcpSocket *socket);
+    ~TcpConnection();
     void close() override;
     bool isConnected() override;
+    void setHeartbeat(int interval, int timeout) override;
+    double getSmoothedRtt() const override { return smoothedRtt_; }
+    double getRttVariation() const override { return rttVariation_; }
+    long long getClockOffset() const override { return clockOffset_; }
+    bool isClockOffsetKnown() const override { return !clockSamples_.empty(); }
+    long long getPendingBytes() const override { return socket_->bytesToWrite() + queuedBytes_; }
+    std::shared_ptr<ConnectionMetrics> getMetrics() const { return metrics_; }
 
 public slots:
-    void send(const std::string &data) const override;
+    void send(const std::string &data) override;
+    void sendFrame(const QByteArray &frame) override;
 
 private slots:
+    void handleSocketConnected();
     void handleSocketReadyRead();
+    void handleSocketBytesWritten();
+    void handleHeartbeatTimeout();
+    void updateBufferedBytes() const;
 
 private:
     void tryParseCurrentMessage();
-    unsigned int getMessageSize(const std::string &message) const;
+    void processFrame(const std::string &frame);
+    void processSlice(const std::string &slice);
+
+    void writeQueuedFrames();
+    void writeNextSlice(size_t priority);
+    void clearQueues();
+
+    void sendHeartbeat(char kind, const std::string &timestamp);
+    void processHeartbeat(const std::string &message);
+    void updateRtt(double sample);
+    void updateClockOffset(long long roundTrip, long long offset);
+    void handleDeadPeer();
 
     QTcpSocket *socket_;
-    std::string messageBuffer_;
+    FrameParser frameParser_;
+    std::array<std::string, FRAME_PRIORITY_COUNT> receivedSlices_;
+
+    std::array<std::deque<QByteArray>, FRAME_PRIORITY_COUNT> sendQueues_;
+    std::array<long long, FRAME_PRIORITY_COUNT> sentSliceBytes_{}; // of the first frame in each queue
+    long long queuedBytes_ = 0;
+
+    QTimer *heartbeatTimer_;
+    int heartbeatInterval_ = DEFAULT_HEARTBEAT_INTERVAL;
+    int heartbeatTimeout_ = DEFAULT_HEARTBEAT_TIMEOUT;
+    std::chrono::steady_clock::time_point lastReceived_;
+
+    double smoothedRtt_ = 0;
+    double rttVariation_ = 0;
+
+    struct ClockSample {
+        long long roundTrip;
+        long long offset;
+    };
+    std::deque<ClockSample> clockSamples_;
+    long long clockOffset_ = 0;
+
+    std::shared_ptr<ConnectionMetrics> metrics_;
 };
 
 /**
@@ -55,12 +180,21 @@ class Server : public QObject {
     Q_OBJECT
 
 public:
-    virtual void listen(uint port) = 0;
+    virtual void listen(uint port, const QHostAddress &address = QHostAddress::Any) = 0;
     virtual void stopListening() = 0;
     virtual std::shared_ptr<Connection> connect(const std::string &host, uint port) = 0;
 
+    /**
+     * @brief Sets the heartbeat configuration applied to all connections created afterwards.
+     */
+    void setHeartbeat(int interval, int timeout);
+
 signals:
     void connectionReceived(std::shared_ptr<Connection> connection);
+
+protected:
+    int heartbeatInterval_ = DEFAULT_HEARTBEAT_INTERVAL;
+    int heartbeatTimeout_ = DEFAULT_HEARTBEAT_TIMEOUT;
 };
 
 /**
@@ -71,7 +205,7 @@ class TcpServer : public Server {
 
 public:
     TcpServer();
-    void listen(uint port) override;
+    void listen(uint port, const QHostAddress &address = QHostAddress::Any) override;
     void stopListening() override;
     std::shared_ptr<Connection> connect(const std::string &host, uint port) override;
     ~TcpServer();
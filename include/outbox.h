@@ -0,0 +1,105 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include "session.h"
+
+#include <deque>
+#include <fstream>
+
+#include <QTimer>
+
+const size_t OUTBOX_WRITE_BATCH = 0x10000; // bytes of appended frames written without waiting for flush()
+const size_t OUTBOX_SEND_BATCH = 64;
+const size_t OUTBOX_MAX_IN_FLIGHT = DEFAULT_RETRANSMIT_CAPACITY / 2; // leaves room in the send window for live messages
+const long long OUTBOX_SEND_WATERMARK = 0x40000;
+
+/**
+ * @brief Append-only queue of chat messages for one peer, kept on disk until the peer has acknowledged them.
+ *
+ * The file holds the frames of StandardMessageConverter back to back, a second file (.pos) the offset of the first
+ * frame which was not acknowledged yet. A torn last frame left by a crash is cut off when the outbox is opened.
+ * Frames sent but not acknowledged before the application quit are sent again, the receiver skips messages it
+ * already has. Both files are emptied once everything was delivered.
+ *
+ * Unlike conversation logs, the outbox is not encrypted: queued messages are readable on disk until delivered.
+ */
+class Outbox {
+public:
+    explicit Outbox(const std::string &path) : path_(path), cursorPath_(path + ".pos") {}
+
+    /**
+     * @brief Opens the outbox for appending and sending, throws if the files cannot be opened.
+     */
+    void open();
+
+    /**
+     * @brief Queues a message behind all others. Appends are collected and written together by flush().
+     */
+    void append(Message *message);
+    void flush();
+
+    /**
+     * @brief Returns whether messages remain which were not handed out by takeUnsent() yet.
+     */
+    bool hasUnsent() const { return sent_ < length_ || !buffer_.empty(); }
+    bool isEmpty() const { return delivered_ == length_ && buffer_.empty(); }
+
+    /**
+     * @brief Reads up to count messages which were not handed out yet, in order. Each one comes with the offset
+     * to pass to setDelivered() once it was acknowledged.
+     */
+    std::vector<std::pair<std::shared_ptr<Message>, unsigned long long>> takeUnsent(size_t count);
+
+    /**
+     * @brief Records that all messages up to the offset have been acknowledged.
+     */
+    void setDelivered(unsigned long long offset);
+
+    /**
+     * @brief Hands out the messages which were not acknowledged again, for a new session.
+     */
+    void rewind() { sent_ = delivered_; }
+
+private:
+    bool readFrame(std::string &frame);
+    void writeCursor();
+
+    std::string path_;
+    std::string cursorPath_;
+    std::ifstream reader_;
+    std::ofstream writer_;
+    std::fstream cursor_;
+    StandardMessageConverter converter_;
+    std::string buffer_; // appended frames not written yet
+    unsigned long long length_ = 0; // of the written frames
+    unsigned long long sent_ = 0;
+    unsigned long long delivered_ = 0;
+};
+
+/**
+ * @brief Sends the chat messages of a session through an outbox while it holds older messages or the session is
+ * not connected, so messages to an offline peer are kept and arrive in the order they were written.
+ *
+ * Queued messages are sent in batches once the session is established or resumed, while the connection's buffer
+ * has room and at most OUTBOX_MAX_IN_FLIGHT of them wait for an acknowledgement.
+ */
+class OutboxSender : public QObject {
+    Q_OBJECT
+
+public:
+    OutboxSender(std::shared_ptr<ChatSession> session, std::shared_ptr<Outbox> outbox, QObject *parent = nullptr);
+
+    void send(std::shared_ptr<Message> message);
+
+private slots:
+    void sendQueued();
+    void handleAcknowledgement();
+
+private:
+    std::shared_ptr<ChatSession> session_;
+    std::shared_ptr<Outbox> outbox_;
+    std::deque<std::pair<unsigned int, unsigned long long>> inFlight_; // sequence and outbox offset of sent messages
+    QTimer *flushTimer_;
+};
+
+#endif // OUTBOX_H
@@ -0,0 +1,29 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <string>
+
+#include <lib/cryptopp/cryptlib.h>
+
+/**
+ * @brief Process-wide source of randomness. Every thread gets its own generators, seeded from the operating system
+ * once on first use, so no locking is needed and nothing is reseeded per call.
+ */
+namespace Random {
+    /**
+     * @brief Returns the calling thread's cryptographically secure generator. It must not be handed to other threads.
+     */
+    CryptoPP::RandomNumberGenerator& secure();
+
+    /**
+     * @brief Returns cryptographically secure random bytes. Small requests are served from a per-thread buffer.
+     */
+    std::string generateBytes(size_t length);
+
+    /**
+     * @brief Returns a random number from a fast non-cryptographic generator (xoshiro256**), for identifiers only.
+     */
+    unsigned long long fast();
+}
+
+#endif // RANDOM_H
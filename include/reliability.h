@@ -0,0 +1,110 @@
+#ifndef RELIABILITY_H
+#define RELIABILITY_H
+
+#include "messaging.h"
+
+#include <deque>
+
+const unsigned int DEFAULT_RETRANSMIT_CAPACITY = 512;
+
+/**
+ * @brief Provides per-session sequence numbers, cumulative acknowledgements and a retransmit buffer
+ * for messages exchanged after the handshake. At most capacity messages are sent without being acknowledged,
+ * later ones wait in the buffer until earlier ones are acknowledged, so no message is ever dropped.
+ *
+ * Every frame sent through it carries a plaintext header right after the frame type:
+ * [5B length] QC [1B type] [8B hex sequence] [8B hex acknowledgement] [content]
+ * Sequence 0 marks frames which are not retransmitted (session end, standalone acknowledgements, group messages,
+ * history synchronization).
+ *
+ * After a session is resumed on a new connection, both sides start with a continuation frame. If the first
+ * frame received is anything else, the other side has started over and its sequence state is forgotten.
+ */
+class ReliableDelivery {
+public:
+    ReliableDelivery(size_t capacity = DEFAULT_RETRANSMIT_CAPACITY) : capacity_(capacity) {}
+
+    /**
+     * @brief Returns whether messages of the given frame type are sequenced and retransmitted.
+     */
+    static bool isSequenced(char type);
+
+    /**
+     * @brief Assigns the next sequence number to a message and keeps it until it is acknowledged.
+     */
+    unsigned int track(std::shared_ptr<Message> message);
+
+    /**
+     * @brief Returns whether the tracked message may be sent now, and counts it as sent if so. Messages are sent
+     * in order and only while fewer than capacity sent ones wait for an acknowledgement.
+     */
+    bool markSent(unsigned int sequence);
+
+    /**
+     * @brief Returns the tracked messages which were held back and may be sent now, and counts them as sent.
+     */
+    std::vector<std::pair<unsigned int, std::shared_ptr<Message>>> takeSendable();
+
+    /**
+     * @brief Counts all unacknowledged messages as not sent, for sending them again on a new connection.
+     */
+    void restartSending();
+
+    /**
+     * @brief Inserts the sequence header into an encoded frame, piggybacking the current acknowledgement.
+     */
+    std::string frame(const std::string &encodedMessage, unsigned int sequence);
+    std::string frameAcknowledgement();
+    std::string frameContinuation();
+
+    /**
+     * @brief Inserts a header without sequence number and acknowledgement, so the resulting frame is the same
+     * for every session it is sent to.
+     */
+    static std::string frameUnsequenced(const std::string &encodedMessage);
+
+    /**
+     * @brief Expects the next received frame to be a continuation frame.
+     */
+    void expectContinuation() { continuationExpected_ = true; }
+
+    /**
+     * @brief Strips the sequence header from a received frame and processes its acknowledgement.
+     * @return true if the contained message should be delivered, false for duplicates and standalone acknowledgements
+     */
+    bool receive(const std::string &frame, std::string &encodedMessage);
+
+    bool isAcknowledgementPending() const { return acknowledgementPending_; }
+
+    /**
+     * @brief Returns the sequence number assigned to the last tracked message, 0 if there was none.
+     */
+    unsigned int getLastSequence() const { return nextSequence_ - 1; }
+
+    /**
+     * @brief Returns the highest sequence number acknowledged by the other side.
+     */
+    unsigned int getAcknowledged() const { return acknowledged_; }
+    std::vector<std::pair<unsigned int, std::shared_ptr<Message>>> getUnacknowledged() const;
+
+private:
+    std::string frameControl(char type);
+    bool isInWindow(unsigned int sequence) const;
+
+    struct Entry {
+        unsigned int sequence;
+        std::shared_ptr<Message> message;
+    };
+
+    std::deque<Entry> unacknowledged_;
+    size_t capacity_;
+
+    unsigned int nextSequence_ = 1;
+    unsigned int lastSent_ = 0;
+    unsigned int lastReceived_ = 0;
+    unsigned int acknowledged_ = 0;
+    bool acknowledgementPending_ = false;
+    bool continuationExpected_ = false;
+};
+
+#endif // RELIABILITY_H
@@ -0,0 +1,64 @@
+#ifndef RESUMPTION_H
+#define RESUMPTION_H
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Represents the contents of a session resumption ticket after it has been opened by its issuer.
+ */
+struct SessionTicket {
+    std::string sessionId;
+    std::string secret;
+};
+
+/**
+ * @brief Issues and validates session resumption tickets. Tickets are sealed with a random AES-GCM key
+ * which lives only as long as the issuer, so they can only be opened by the client which issued them.
+ */
+class SessionTicketIssuer {
+public:
+    SessionTicketIssuer(unsigned int lifetime = 3600);
+    std::string issue(const std::string &sessionId, const std::string &secret) const;
+    bool tryOpen(const std::string &ticket, SessionTicket &result) const;
+    unsigned int getLifetime() const { return lifetime_; }
+
+private:
+    std::string key_;
+    unsigned int lifetime_;
+};
+
+/**
+ * @brief Stores resumption tickets received from peers. Every ticket can only be taken once.
+ */
+class SessionTicketStore {
+public:
+    struct Entry {
+        std::string ticket;
+        std::string secret;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    void store(const std::string &peer, const std::string &ticket, const std::string &secret, unsigned int lifetime);
+    bool tryTake(const std::string &peer, Entry &result);
+    void remove(const std::string &peer);
+
+private:
+    std::unordered_map<std::string, Entry> tickets_;
+};
+
+namespace Resumption {
+    const unsigned int NONCE_LENGTH = 16;
+    const unsigned int SESSION_ID_LENGTH = 16;
+
+    std::string generateNonce();
+    std::string generateSessionId();
+
+    /**
+     * @brief Derives a fresh AES session key from a resumption secret and both sides' nonces.
+     */
+    std::string deriveKey(const std::string &secret, const std::string &clientNonce, const std::string &serverNonce);
+}
+
+#endif // RESUMPTION_H
@@ -0,0 +1,146 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QFile>
+
+const size_t SEARCH_FLUSH_POSTINGS = 1 << 18;
+const size_t SEARCH_MERGE_SEGMENTS = 4;
+const size_t MIN_SEARCH_QUERY_LENGTH = 3;
+const size_t SEARCH_KEY_LENGTH = 16;
+
+/**
+ * @brief Immutable, memory-mapped part of a search index. Maps trigrams to the sorted positions of the messages
+ * containing them.
+ *
+ * The file starts with the magic "QCSI", the number of trigrams and the offset of the trigram table, followed by the
+ * posting lists and the table. Posting lists are stored as varint encoded differences between positions, the table
+ * holds the trigram, the number of postings and the offset of the list for every trigram in ascending order. Numbers
+ * are in host byte order, the files never leave the machine they were written on.
+ */
+class SearchSegment {
+public:
+    /**
+     * @brief Maps the segment, throws if it cannot be read.
+     */
+    explicit SearchSegment(const std::string &path);
+    ~SearchSegment();
+
+    SearchSegment(const SearchSegment&) = delete;
+    SearchSegment& operator=(const SearchSegment&) = delete;
+
+    const std::string& getPath() const { return path_; }
+    size_t getSize() const { return size_; }
+    size_t getTrigramCount() const { return trigramCount_; }
+    uint32_t getTrigram(size_t index) const;
+    size_t getPostingCount(size_t index) const;
+
+    /**
+     * @brief Appends the positions stored for the trigram at the given table index.
+     */
+    void readPostings(size_t index, std::vector<uint32_t> &positions) const;
+
+    /**
+     * @brief Returns the table index of the trigram, or getTrigramCount() if the segment does not contain it.
+     */
+    size_t find(uint32_t trigram) const;
+
+    /**
+     * @brief Removes the file once the last user of the segment lets go of it.
+     */
+    void setObsolete() { obsolete_ = true; }
+
+private:
+    const uchar* getEntry(size_t index) const;
+
+    std::string path_;
+    QFile file_;
+    const uchar *data_ = nullptr;
+    size_t size_ = 0;
+    size_t trigramCount_ = 0;
+    size_t tableOffset_ = 0;
+    bool obsolete_ = false;
+};
+
+/**
+ * @brief Trigram index for substring search over the messages of a conversation log, keyed by message positions.
+ *
+ * Added messages are collected in memory and written as a new segment once enough postings have accumulated.
+ * The newest segments are merged on a background thread once there are enough of about the same size, so a posting
+ * is only rewritten a logarithmic number of times. A manifest lists the live segments and how much of the log they
+ * cover. Edited messages are added again with their new content and postings of replaced content stay, so candidates
+ * have to be checked against the current content of the message. With a key, trigrams are stored as keyed hashes,
+ * so the segments do not give away the text of the messages.
+ * All methods may be called from different threads.
+ */
+class SearchIndex {
+public:
+    /**
+     * @param key Key of the trigram hashes, SEARCH_KEY_LENGTH bytes. Without a key trigrams are stored as they are.
+     */
+    SearchIndex(const std::string &path, const std::string &key = "") : path_(path), key_(key) {}
+    ~SearchIndex();
+
+    /**
+     * @brief Maps the segments listed in the manifest. A missing or damaged manifest leaves the index empty.
+     */
+    void open();
+
+    /**
+     * @brief Removes all segments and postings, for a log which no longer matches the index.
+     */
+    void clear();
+
+    void add(size_t position, const std::string &content);
+    size_t getPendingPostings() const;
+
+    /**
+     * @brief Writes the collected postings as a new segment.
+     * @param indexedLength Length of the log covered by the index after the flush
+     * @param indexedMessages Number of messages in that part of the log
+     */
+    void flush(unsigned long long indexedLength, size_t indexedMessages);
+
+    unsigned long long getIndexedLength() const;
+    size_t getIndexedMessages() const;
+
+    /**
+     * @brief Returns the positions of the messages that may contain the query, newest first. Queries shorter than
+     * MIN_SEARCH_QUERY_LENGTH have no trigrams and match nothing.
+     */
+    std::vector<size_t> find(const std::string &query) const;
+
+    /**
+     * @brief Lowercases ASCII letters, search is case insensitive for them.
+     */
+    static std::string normalize(const std::string &text);
+
+private:
+    std::string getSegmentPath(unsigned int number) const;
+    void writeManifest();
+    bool shouldMerge() const;
+    void startMerge();
+    void runMerges();
+
+    std::string path_;
+    std::string key_;
+    mutable std::mutex mutex_;
+    std::map<uint32_t, std::vector<uint32_t>> pending_;
+    size_t pendingPostings_ = 0;
+    std::vector<std::shared_ptr<SearchSegment>> segments_; // oldest first
+    unsigned int nextSegment_ = 0;
+    unsigned long long indexedLength_ = 0;
+    size_t indexedMessages_ = 0;
+    bool incomplete_ = false; // postings were lost, the covered length must not advance
+    std::thread merger_;
+    bool merging_ = false;
+};
+
+#endif // SEARCH_H
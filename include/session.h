@@ -1,10 +1,16 @@
 #ifndef SESSION_H
 #define SESSION_H
 
+#include "messageidmap.h"
 #include "messaging.h"
+#include "metrics.h"
+#include "reliability.h"
+#include "resumption.h"
 
 #include <QObject>
 
+#include <deque>
+
 /**
  * @brief An abstract class for converting std::string to Message and vice versa.
  */
@@ -27,10 +33,26 @@ protected:
     void processMessage(KeyMessage *message) override;
     void processMessage(SessionEndMessage *message) override;
     void processMessage(UserInfoMessage *message) override;
+    void processMessage(SessionTicketMessage *message) override;
+    void processMessage(ResumeSessionMessage *message) override;
+    void processMessage(GroupKeyMessage *message) override;
+    void processMessage(GroupChatMessage *message) override;
+    void processMessage(FileOfferMessage *message) override;
+    void processMessage(FileAcknowledgementMessage *message) override;
+    void processMessage(FileChunkMessage *message) override;
+    void processMessage(FileCancelMessage *message) override;
+    void processMessage(HistorySyncMessage *message) override;
+    void processMessage(HistoryRecordMessage *message) override;
     void processMessage(NewChatMessage *message) override;
     void processMessage(EditChatMessage *message) override;
 
 private:
+    /**
+     * @brief Turns the current chat message into its timestamped variant (lower case type) if it has a creation time:
+     * [8B id] [16B hex creation time] [16B hex send time] [content]
+     */
+    void addTimestamps(AbstractChatMessage *message);
+
     struct MessageData {
         MessageData() {}
         MessageData(const std::string &content);
@@ -44,6 +66,9 @@ private:
 /**
  * @brief Encrypted message converter which assumes format:
  * [5B length] QC [1B type] [encrypted content]
+ *
+ * Session resumption messages are passed through unencrypted, as they only carry nonces and sealed tickets.
+ * Group messages are passed through as well, their payload is already encrypted with the group key.
  */
 class EncryptedMessageConverter : public StandardMessageConverter {
 public:
@@ -52,6 +77,8 @@ public:
     std::string convertFromMessage(Message *message) override;
 
 private:
+    static bool isPlaintextType(char type);
+
     std::shared_ptr<EncryptingKey> encryptor_ = nullptr;
     std::shared_ptr<DecryptingKey> decryptor_ = nullptr;
 };
@@ -66,13 +93,26 @@ public:
     virtual void startHandshake() = 0;
     virtual void end() = 0;
 
+    /**
+     * @brief Returns whether this side opened the connection.
+     */
+    virtual bool isInitiator() const { return false; }
+
 public slots:
     virtual void processMessage(const std::string &message) = 0;
 
 signals:
     void messageReady(const std::string &message);
 
-    void handshakeFinished(std::shared_ptr<MessageConverter> messageProcessor, UserInfo otherUserInfo);
+    /**
+     * @brief Emitted before the handshake finishes if the session received a resumable identity.
+     * @param resumed Whether an earlier session with this identifier was resumed
+     */
+    void sessionIdentified(const std::string &sessionId, bool resumed);
+    /**
+     * @param otherKeyFingerprint SHA-256 fingerprint of the public key the other side proved to hold, empty if it proved none
+     */
+    void handshakeFinished(std::shared_ptr<MessageConverter> messageProcessor, UserInfo otherUserInfo, const std::string &otherKeyFingerprint);
     void handshakeError(const std::string &errorMessage = "");
 };
 
@@ -92,102 +132,330 @@ public slots:
 
 protected:
     void processMessage(SessionEndMessage *message) override;
+    void processMessage(GroupKeyMessage *message) override;
+    void processMessage(GroupChatMessage *message) override;
+    void processMessage(FileOfferMessage *message) override;
+    void processMessage(FileAcknowledgementMessage *message) override;
+    void processMessage(FileChunkMessage *message) override;
+    void processMessage(FileCancelMessage *message) override;
+    void processMessage(HistorySyncMessage *message) override;
+    void processMessage(HistoryRecordMessage *message) override;
     void processMessage(NewChatMessage *message) override;
     void processMessage(EditChatMessage *message) override;
 
+    /**
+     * @brief Records the time since the previous stage ended (or the handshake started) into the given histogram.
+     */
+    void recordStage(const Histogram &stage);
+    void recordFinish();
+
+    /**
+     * @brief Returns what the initiator signs to prove its identity: the session key and, unless the session was
+     * resumed, the receiver's public key, so the signature cannot be replayed to anyone else.
+     */
+    std::string getIdentityPayload(const std::string &receiverKey) const;
+
     KeyCombination keys_;
     UserInfo userInfo_;
 
     std::shared_ptr<MessageConverter> messageConverter_;
+    std::shared_ptr<AESKey> sessionKey_;
 
     std::shared_ptr<EncryptingKey> encryptor_;
     std::shared_ptr<DecryptingKey> decryptor_;
 
     bool publicKeyReceived_ = false;
     bool finished_ = false;
+
+    std::chrono::steady_clock::time_point handshakeStarted_;
+    std::chrono::steady_clock::time_point stageStarted_;
 };
 
 /**
  * @brief Handles encrypted RSA/AES handshake initialization from the connection initiator's perspective.
+ * Tickets issued by the peer are stored under the ticket key, which names the session they belong to. When resuming,
+ * the ticket stored under it is presented instead of a new RSA-wrapped AES key.
+ *
+ * When pipelined, the sender's user information is sent right behind the session key instead of waiting
+ * for the receiver's, so the receiver finishes its handshake one round trip earlier.
+ *
+ * The receiver proves its identity by unwrapping the session key, the sender by signing it with its private key.
  */
 class EncryptedSessionSenderHandshakeProcessor : public EncryptedSessionHandshakeProcessor {
 public:
-    EncryptedSessionSenderHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo) : EncryptedSessionHandshakeProcessor(keys, userInfo) {}
+    EncryptedSessionSenderHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo,
+                                             std::shared_ptr<SessionTicketStore> ticketStore = nullptr, const std::string &ticketKey = "",
+                                             bool resume = false, bool pipelined = true);
     void startHandshake() override;
+    bool isInitiator() const override { return true; }
 
 protected:
     void processMessage(KeyMessage *message) override;
     void processMessage(UserInfoMessage *message) override;
+    void processMessage(SessionTicketMessage *message) override;
+    void processMessage(ResumeSessionMessage *message) override;
+
+private:
+    void sendUserInfo();
+
+    std::shared_ptr<SessionTicketStore> ticketStore_;
+    std::string ticketKey_;
+    bool resume_;
+    bool pipelined_;
+
+    std::string receiverKey_; // the public key the session key was wrapped with, empty when resumed
+
+    std::string resumptionSecret_;
+    std::string clientNonce_;
+    bool resumptionAttempted_ = false;
+    bool resumed_ = false;
 };
 
 /**
  * @brief Handles encrypted RSA/AES handshake initialization from the connection receiver's perspective.
+ * Issues a resumption ticket once the session key is established.
  */
 class EncryptedSessionReceiverHandshakeProcessor : public EncryptedSessionHandshakeProcessor {
 public:
-    EncryptedSessionReceiverHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo);
+    EncryptedSessionReceiverHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo, std::shared_ptr<SessionTicketIssuer> ticketIssuer = nullptr);
     void startHandshake() override;
 
 protected:
     void processMessage(KeyMessage *message) override;
     void processMessage(UserInfoMessage *message) override;
+    void processMessage(SessionTicketMessage *message) override;
+    void processMessage(ResumeSessionMessage *message) override;
+
+private:
+    void establishSessionKey(std::shared_ptr<AESKey> aesKey, bool resumed);
+
+    std::shared_ptr<SessionTicketIssuer> ticketIssuer_;
+    std::string sessionId_;
+    bool resumed_ = false;
+};
+
+/**
+ * @brief Latency of a received timestamped chat message split into its stages, all in milliseconds.
+ */
+struct MessageLatency {
+    double sendQueue = 0; // from creation until the frame was written on the sender
+    double network = 0; // from the write until the frame was read here
+    double decode = 0; // decryption and decoding
+    double render = 0; // handling of the received message by the user interface
+    double total = 0;
+};
+
+/**
+ * @brief Connection quality and latency of received timestamped messages, all in milliseconds.
+ * Network and total latency are only meaningful once the clock offset to the peer is known.
+ */
+struct SessionDiagnostics {
+    double smoothedRtt = 0;
+    double rttVariation = 0;
+    double clockOffset = 0; // how far the peer's clock is ahead of ours
+    bool clockOffsetKnown = false;
+
+    long long latencySamples = 0;
+    MessageLatency lastLatency;
+    MessageLatency averageLatency; // exponentially weighted
 };
 
 /**
  * @brief Represents the complete context of single chat session between two clients.
+ *
+ * Chat messages are delivered reliably: they are kept until the other side acknowledges them and replayed
+ * if the connection drops and the session is resumed on a new connection.
  */
 class ChatSession : public QObject, public MessageVisitor {
     Q_OBJECT
 
 public:
     ChatSession(std::shared_ptr<Connection> connection, UserInfo userInfo, const KeyCombination &keyCombination);
+    ~ChatSession();
     UserInfo getOwnUserInfo() const { return ownUserInfo_; }
     UserInfo getOtherUserInfo() const { return otherUserInfo_; }
+
+    /**
+     * @brief Returns the SHA-256 fingerprint of the public key the other side proved to hold during the handshake,
+     * empty if it proved none. Unlike the user information, it cannot be chosen by the other side.
+     */
+    std::string getOtherKeyFingerprint() const { return otherKeyFingerprint_; }
+    std::string getSessionId() const { return sessionId_; }
+
+    /**
+     * @brief Returns the key the resumption tickets of this session are stored under, so only this session presents them.
+     */
+    std::string getTicketKey() const { return ticketKey_; }
+
+    /**
+     * @brief Returns whether this side opened the connection, and therefore also reconnects after it is lost.
+     */
+    bool isInitiator() const { return initiator_; }
     void initialize(std::unique_ptr<SessionHandshakeProcessor> &&handshakeProcessor);
 
+    /**
+     * @brief Continues a session whose connection was lost on a new connection. The handshake is started
+     * once the connection is established.
+     */
+    void resume(std::shared_ptr<Connection> connection, std::unique_ptr<SessionHandshakeProcessor> &&handshakeProcessor);
+
+    /**
+     * @brief Moves the connection of a freshly resumed session into this session, which is awaiting resumption.
+     * The other session is left ended.
+     */
+    void takeOver(ChatSession &other);
+    bool isAwaitingResumption() const;
+
+    /**
+     * @brief Enables sending chat messages with their creation and send times. Only peers which know the
+     * timestamped frame types can read them, so this is off by default.
+     */
+    void setTimestampingEnabled(bool enabled) { timestampingEnabled_ = enabled; }
+    bool isTimestampingEnabled() const { return timestampingEnabled_; }
+    SessionDiagnostics getDiagnostics() const;
+
+    /**
+     * @brief Completes the latency of received messages once the user interface has shown them. Ids of other
+     * messages are ignored.
+     */
+    void recordRendered(const std::vector<MessageId> &ids);
+
+    /**
+     * @brief Returns the number of sent bytes still waiting in the connection's buffer, or 0 while disconnected.
+     */
+    long long getPendingBytes() const;
+
+    /**
+     * @brief Returns whether sent messages are written to a connection right away, rather than kept until the session
+     * is resumed or dropped because it ended.
+     */
+    bool isConnected() const { return initialized_ && connected_ && !resuming_ && !ended_; }
+
+    /**
+     * @brief Returns the sequence number of the last chat message sent. It is delivered once getAcknowledgedSequence()
+     * reaches it.
+     */
+    unsigned int getLastSequence() const { return reliability_.getLastSequence(); }
+    unsigned int getAcknowledgedSequence() const { return reliability_.getAcknowledged(); }
+
 signals:
     void connectionEstablished();
     void sessionInitialized();
     void sessionInitializationError();
     void sessionEndedByOtherSide();
 
+    void sessionIdentified(const std::string &sessionId, bool resumed);
+    void sessionTransferred();
+    void connectionLost();
+    void connectionRestored();
+
     void invalidMessageReceived(const std::string &errorMessage);
 
     void newChatMessageReceived(NewChatMessage *message);
     void editedChatMessageReceived(EditChatMessage *message);
+    void groupKeyReceived(GroupKeyMessage *message);
+    void groupMessageReceived(GroupChatMessage *message);
+    void fileOfferReceived(FileOfferMessage *message);
+    void fileAcknowledgementReceived(FileAcknowledgementMessage *message);
+    void fileChunkReceived(FileChunkMessage *message);
+    void fileCancelReceived(FileCancelMessage *message);
+    void historySyncReceived(HistorySyncMessage *message);
+    void historyRecordReceived(HistoryRecordMessage *message);
+
+    /**
+     * @brief Emitted when buffered outgoing data was written to the connection, so bulk senders can queue more.
+     */
+    void bytesWritten();
+
+    /**
+     * @brief Emitted when the other side acknowledged more of the sent chat messages.
+     */
+    void messagesAcknowledged();
 
 public slots:
     void end();
     void sendMessage(std::shared_ptr<Message> message);
 
+    /**
+     * @brief Sends an already framed unsequenced message as is. Used to write the same group frame to many sessions.
+     */
+    void sendFrame(const QByteArray &frame);
+
 protected slots:
     void processMessage(KeyMessage *message) override;
     void processMessage(UserInfoMessage *message) override;
+    void processMessage(SessionTicketMessage *message) override;
+    void processMessage(ResumeSessionMessage *message) override;
     void processMessage(SessionEndMessage *message) override;
+    void processMessage(GroupKeyMessage *message) override;
+    void processMessage(GroupChatMessage *message) override;
+    void processMessage(FileOfferMessage *message) override;
+    void processMessage(FileAcknowledgementMessage *message) override;
+    void processMessage(FileChunkMessage *message) override;
+    void processMessage(FileCancelMessage *message) override;
+    void processMessage(HistorySyncMessage *message) override;
+    void processMessage(HistoryRecordMessage *message) override;
     void processMessage(NewChatMessage *message) override;
     void processMessage(EditChatMessage *message) override;
 
 private slots:
     void handleConnectionEstablished();
-    void handleHandshakeFinish(std::shared_ptr<MessageConverter> messageProcessor, UserInfo otherUserInfo);
+    void handleSessionIdentified(const std::string &sessionId, bool resumed);
+    void handleHandshakeFinish(std::shared_ptr<MessageConverter> messageProcessor, UserInfo otherUserInfo, const std::string &otherKeyFingerprint);
     void handleHandshakeError();
     void processReceivedMessage(const std::string &message);
     void handleDisconnect();
+    void sendAcknowledgement();
+    void handleResumptionTimeout();
 
 private:
+    void attachConnection();
+    void awaitResumption();
+    void replayUnacknowledged();
+    void sendHeld();
+    void recordSendQueueLatency(Message *message);
+    void recordLatency(AbstractChatMessage *message);
+
+    struct PendingRender {
+        MessageLatency latency;
+        long long decodedAt = 0;
+        long long createdAt = 0; // on our clock, 0 if the clock offset is not known
+    };
+
     std::shared_ptr<Connection> connection_;
     std::vector<std::shared_ptr<AbstractChatMessage>> chatMessageHistory_;
 
     std::unique_ptr<SessionHandshakeProcessor> handshakeProcessor_;
+    std::unique_ptr<SessionHandshakeProcessor> pendingHandshakeProcessor_;
     std::shared_ptr<MessageConverter> messageConverter_;
 
+    ReliableDelivery reliability_;
+    QTimer *acknowledgementTimer_;
+    QTimer *resumptionTimer_;
+
     KeyCombination keyCombination_;
     UserInfo ownUserInfo_;
     UserInfo otherUserInfo_;
+    std::string otherKeyFingerprint_;
+    std::string sessionId_;
+    std::string ticketKey_;
 
     bool connected_ = false;
     bool initialized_ = false;
     bool ended_ = false;
+    bool resuming_ = false;
+    bool resumedHandshake_ = false;
+    bool transferred_ = false;
+    bool initiator_ = false;
+
+    bool timestampingEnabled_ = false;
+    long long receivedAt_ = 0;
+    long long decodedAt_ = 0;
+    long long latencySamples_ = 0;
+    MessageIdMap<PendingRender> pendingRenders_;
+    std::deque<std::pair<MessageId, long long>> pendingRenderOrder_; // with the decode time, oldest first
+    MessageLatency lastLatency_;
+    MessageLatency averageLatency_;
 };
 
 /**
@@ -198,11 +466,14 @@ class ChatSessionCreator : public QObject {
 
 public:
     ChatSessionCreator(UserInfo userInfo, const KeyCombination &keyCombination);
-    void allowConnections(int port);
+    void allowConnections(int port, const QHostAddress &address = QHostAddress::Any);
     void disallowConnections();
     std::shared_ptr<ChatSession> tryConnect(std::string &host, int port);
     void setUserInfo(UserInfo userInfo);
     void setKeys(const KeyCombination &keyCombination);
+    void setHeartbeat(int interval, int timeout);
+    std::shared_ptr<SessionTicketIssuer> getTicketIssuer() const { return ticketIssuer_; }
+    std::shared_ptr<SessionTicketStore> getTicketStore() const { return ticketStore_; }
 
 signals:
     void chatRequestReceived(std::shared_ptr<ChatSession> session);
@@ -212,10 +483,16 @@ private slots:
 
 private:
     std::shared_ptr<ChatSession> createSession(std::shared_ptr<Connection> connection);
+    void handleSessionIdentified(std::weak_ptr<ChatSession> session, const std::string &sessionId, bool resumed);
+    void reconnect(std::weak_ptr<ChatSession> session, const std::string &host, int port);
 
     std::unique_ptr<Server> connectionManager_;
     UserInfo userInfo_;
     KeyCombination encryptionKeys_;
+
+    std::shared_ptr<SessionTicketIssuer> ticketIssuer_;
+    std::shared_ptr<SessionTicketStore> ticketStore_;
+    std::unordered_map<std::string, std::weak_ptr<ChatSession>> resumableSessions_;
 };
 
 #endif // SESSION_H
@@ -0,0 +1,63 @@
+#ifndef SESSIONREGISTRY_H
+#define SESSIONREGISTRY_H
+
+#include "session.h"
+
+#include <unordered_map>
+
+enum class SessionState { Connecting, Handshaking, Active, Ended };
+
+/**
+ * @brief Owns the chat sessions of the application and follows each one through its states.
+ *
+ * A session is added when its connection is opened or received and kept until it ends, either because it is ended
+ * here, its handshake fails, it is handed over to a session being resumed or the other side ends it. Ended sessions
+ * are released on the next pass of the event loop, so a session is never destroyed while emitting a signal. Other
+ * owners, like the window showing a conversation, should only keep a session as long as they show it.
+ * The registry ends all remaining sessions when it is destroyed.
+ */
+class SessionRegistry : public QObject {
+    Q_OBJECT
+
+public:
+    explicit SessionRegistry(QObject *parent = nullptr) : QObject(parent) {}
+    ~SessionRegistry();
+
+    /**
+     * @brief Takes a session into the registry, in the given state.
+     */
+    void add(std::shared_ptr<ChatSession> session, SessionState state);
+
+    /**
+     * @brief Ends a session and releases it. Does nothing for sessions not in the registry.
+     */
+    void end(ChatSession *session);
+
+    /**
+     * @brief Returns the session if it is in the registry and has not ended.
+     */
+    std::shared_ptr<ChatSession> find(ChatSession *session) const;
+
+    /**
+     * @brief Returns the state of the session, Ended for sessions not in the registry.
+     */
+    SessionState getState(ChatSession *session) const;
+
+    /**
+     * @brief Returns the number of sessions in the state. Ended sessions are counted until they are released.
+     */
+    size_t getCount(SessionState state) const;
+    size_t getLiveCount() const;
+
+signals:
+    void sessionStateChanged(ChatSession *session, SessionState state);
+
+private:
+    void setState(ChatSession *session, SessionState state);
+    void release();
+
+    std::unordered_map<ChatSession*, std::pair<std::shared_ptr<ChatSession>, SessionState>> sessions_;
+    std::vector<std::shared_ptr<ChatSession>> ended_; // released on the next pass of the event loop
+};
+
+#endif // SESSIONREGISTRY_H
@@ -0,0 +1,93 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Collects spans in the Chrome trace event format (readable by chrome://tracing and Perfetto).
+ *
+ * Spans are queued by the threads recording them and written to the file by a background thread.
+ * While tracing is stopped, a span costs a single relaxed atomic load.
+ */
+class Tracer {
+public:
+    static Tracer& instance();
+    static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Starts writing spans into the file at the given path. The file is overwritten.
+     */
+    void start(const std::string &path);
+
+    /**
+     * @brief Writes all queued spans, completes the file and stops tracing.
+     */
+    void stop();
+
+    /**
+     * @brief Queues a finished span. Name and category have to be string literals, only the pointers are kept.
+     */
+    void record(const char *name, const char *category, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+private:
+    struct TraceEvent {
+        const char *name;
+        const char *category;
+        double start; // microseconds since tracing started
+        double duration;
+        unsigned int threadId;
+    };
+
+    Tracer() {}
+    ~Tracer();
+    void writeEvents();
+    static unsigned int getThreadId();
+
+    static std::atomic<bool> enabled_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::thread writer_;
+    std::ofstream fileStream_;
+    std::vector<TraceEvent> pending_;
+    std::chrono::steady_clock::time_point origin_;
+    bool running_ = false;
+    bool firstEvent_ = true;
+    long long processId_ = 0;
+};
+
+/**
+ * @brief Records the time from its construction to its destruction as a span, if tracing was enabled at construction.
+ */
+class TraceSpan {
+public:
+    TraceSpan(const char *name, const char *category) : name_(name), category_(category), active_(Tracer::isEnabled()) {
+        if(active_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if(active_) {
+            Tracer::instance().record(name_, category_, start_, std::chrono::steady_clock::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char *name_;
+    const char *category_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif // TRACING_H
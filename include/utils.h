@@ -5,7 +5,8 @@
 #include <string>
 
 namespace Utils {
-    std::string convertToHex(int num, int digits);
+    std::string convertToHex(long long num, int digits);
+    long long getSteadyTimestamp(); // microseconds of the monotonic clock
     void createPath(const std::string &path);
     std::string loadFile(const std::string &path);
     void saveFile(const std::string &path, const std::string &content);
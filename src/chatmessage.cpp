@@ -2,7 +2,7 @@
 #include "chatmessageeditdialog.h"
 #include "ui_chatmessage.h"
 
-ChatMessage::ChatMessage(const std::string &username, NewChatMessage *message, bool isEditable, QWidget *parent) :
+ChatMessage::ChatMessage(const std::string &username, const HistoryEntry &entry, QWidget *parent) :
     QFrame(parent),
     ui(new Ui::ChatMessage)
 {
@@ -11,26 +11,28 @@ ChatMessage::ChatMessage(const std::string &username, NewChatMessage *message, b
     QObject::connect(ui->editButton, &QPushButton::clicked, this, &ChatMessage::onEditButtonClicked);
 
     ui->username->setText(QString::fromStdString(username));
-    ui->message->setText(QString::fromStdString(message->getContent()));
-    if(!isEditable) {
+    if(!entry.outgoing) {
         hideEdit();
     }
 
-    id_ = message->getId();
+    id_ = entry.id;
+    edit(entry);
 }
 
-ChatMessage::ChatMessage(NewChatMessage *message, bool isEditable, QWidget *parent) :
-    ChatMessage("", message, isEditable, parent)
+ChatMessage::ChatMessage(const HistoryEntry &entry, QWidget *parent) :
+    ChatMessage("", entry, parent)
 {
     hideUsername();
 }
 
-void ChatMessage::edit(const std::string &newContent) {
-    ui->message->setText(QString::fromStdString(newContent));
+void ChatMessage::edit(const HistoryEntry &entry) {
+    content_ = entry.content;
+    version_ = entry.version;
+    ui->message->setText(QString::fromStdString(content_));
 }
 
 void ChatMessage::handleEdit(std::shared_ptr<EditChatMessage> message) {
-    edit(message->getContent());
+    // the history applies the edit and updates this widget
     emit edited(message);
 }
 
@@ -50,7 +52,7 @@ ChatMessage::~ChatMessage()
 
 void ChatMessage::onEditButtonClicked()
 {
-    auto editDialog = new ChatMessageEditDialog(id_, ui->message->text().toStdString(), this);
+    auto editDialog = new ChatMessageEditDialog(id_, version_, content_, this);
     QObject::connect(editDialog, &ChatMessageEditDialog::edited, this, &ChatMessage::handleEdit);
     editDialog->setAttribute(Qt::WA_DeleteOnClose);
     editDialog->show();
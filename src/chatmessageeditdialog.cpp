@@ -1,12 +1,14 @@
 #include "chatmessageeditdialog.h"
 #include "ui_chatmessageeditdialog.h"
 
-ChatMessageEditDialog::ChatMessageEditDialog(const std::string &id, const std::string &content, QWidget *parent) :
+ChatMessageEditDialog::ChatMessageEditDialog(MessageId id, unsigned int version, const std::string &content, QWidget *parent) :
     QDialog(parent),
     ui(new Ui::ChatMessageEditDialog)
 {
     ui->setupUi(this);
     id_ = id;
+    version_ = version;
+    content_ = content;
     ui->messageEdit->setText(QString::fromStdString(content));
 
     QObject::connect(ui->saveButton, &QPushButton::clicked, this, &ChatMessageEditDialog::onSaveButtonClicked);
@@ -19,8 +21,11 @@ ChatMessageEditDialog::~ChatMessageEditDialog()
 
 void ChatMessageEditDialog::onSaveButtonClicked()
 {
-    auto message = std::make_shared<EditChatMessage>(id_, ui->messageEdit->text().toStdString());
-    emit edited(message);
+    auto content = ui->messageEdit->text().toStdString();
+    if(content != content_) {
+        auto message = std::make_shared<EditChatMessage>(id_, version_ + 1, MessageDelta::compute(content_, content), content);
+        emit edited(message);
+    }
     close();
 }
 
@@ -1,54 +1,299 @@
 #include "chatmessagehistory.h"
 #include "ui_chatmessagehistory.h"
+#include "tracing.h"
 
 #include <QScrollBar>
+#include <QVBoxLayout>
+
+const int UI_UPDATE_INTERVAL = 16; // one display refresh at 60 Hz
 
 ChatMessageHistory::ChatMessageHistory(QWidget *parent) :
     QFrame(parent),
-    ui(new Ui::ChatMessageHistory)
+    ui(new Ui::ChatMessageHistory),
+    updateTimer_(new QTimer(this))
 {
     ui->setupUi(this);
     auto verticalScroll = ui->scrollArea->verticalScrollBar();
     QObject::connect(verticalScroll, &QScrollBar::rangeChanged, this, &ChatMessageHistory::scrollToBottom);
+    QObject::connect(verticalScroll, &QScrollBar::valueChanged, this, &ChatMessageHistory::updateAnchor);
+
+    updateTimer_->setSingleShot(true);
+    updateTimer_->setInterval(UI_UPDATE_INTERVAL);
+    QObject::connect(updateTimer_, &QTimer::timeout, this, &ChatMessageHistory::applyPendingUpdates);
 }
 
-void ChatMessageHistory::addMessage(const std::string &sender, NewChatMessage *message, bool isEditable) {
-    ChatMessage *messageWidget;
+bool ChatMessageHistory::addMessage(const std::string &sender, NewChatMessage *message, bool isEditable) {
+    return addEntry(sender, {message->getId(), isEditable, message->getContent(), 0});
+}
+
+bool ChatMessageHistory::addEntry(const std::string &sender, const HistoryEntry &entry) {
+    if(!history_.addEntry(entry)) {
+        return false;
+    }
+
     if(sender == lastMessageSender_) {
-        messageWidget = new ChatMessage(message, isEditable, this);
+        pendingMessages_.push_back({entry.id, ""});
     }
     else {
-        messageWidget = new ChatMessage(sender, message, isEditable, this);
+        pendingMessages_.push_back({entry.id, sender});
         lastMessageSender_ = sender;
     }
 
-    if(isEditable) {
-        QObject::connect(messageWidget, &ChatMessage::edited, this, &ChatMessageHistory::messageEdited);
+    scheduleUpdate();
+    return true;
+}
+
+void ChatMessageHistory::showHistory(std::shared_ptr<ConversationLog> log, const std::string &ownUsername, const std::string &otherUsername) {
+    pager_ = new HistoryPager(log, this);
+    ownUsername_ = ownUsername;
+    otherUsername_ = otherUsername;
+    QObject::connect(pager_, &HistoryPager::pageLoaded, this, &ChatMessageHistory::handlePageLoaded);
+
+    auto pageCount = pager_->getPageCount();
+    if(pageCount == 0) {
+        return;
+    }
+
+    // the newest page is read right away, so the window opens with the end of the conversation
+    firstPage_ = pageCount - 1;
+    createPage(firstPage_);
+    showPage(firstPage_, pager_->readPage(firstPage_));
+}
+
+bool ChatMessageHistory::handleMessageEdit(EditChatMessage *message) {
+    if(history_.find(message->getId()) == nullptr && pager_ != nullptr) {
+        // the message is on a page which is not loaded, the edit is checked against its logged state
+        HistoryEntry entry;
+        ConversationHistory logged;
+        if(!pager_->getLog()->readEntry(message->getId(), entry) || !logged.addEntry(entry) || !logged.applyEdit(message)) {
+            return false;
+        }
+
+        // the page may be read in the background right now, from before the edit is logged
+        unloadedEdits_.insert(message->getId(), *logged.find(message->getId()));
+        return true;
+    }
+
+    if(!history_.applyEdit(message)) {
+        return false;
+    }
+
+    // messages still waiting for their widget are shown with the edited content anyway
+    auto id = message->getId();
+    if(messages_.find(id) != nullptr && pendingEditIds_.find(id) == nullptr) {
+        pendingEditIds_.insert(id, true);
+        pendingEdits_.push_back(id);
+        scheduleUpdate();
+    }
+    return true;
+}
+
+void ChatMessageHistory::handleOwnMessageEdit(std::shared_ptr<EditChatMessage> message) {
+    if(handleMessageEdit(message.get())) {
+        emit messageEdited(message);
+    }
+}
+
+void ChatMessageHistory::scheduleUpdate() {
+    if(!updateTimer_->isActive()) {
+        updateTimer_->start();
+    }
+}
+
+void ChatMessageHistory::applyPendingUpdates() {
+    TraceSpan span("ui_insert", "ui");
+
+    // the layout is recalculated once for the whole batch when updates are enabled again
+    auto contents = ui->scrollArea->widget();
+    contents->setUpdatesEnabled(false);
+
+    std::vector<MessageId> applied;
+    applied.reserve(pendingEdits_.size() + pendingMessages_.size());
+    for(auto id : pendingEdits_) {
+        // the page of the message may have been unloaded in the meantime
+        auto messageWidget = messages_.find(id);
+        if(messageWidget != nullptr) {
+            (*messageWidget)->edit(*history_.find(id));
+            applied.push_back(id);
+        }
+        pendingEditIds_.erase(id);
+    }
+    pendingEdits_.clear();
+
+    for(auto &pending : pendingMessages_) {
+        auto messageWidget = createMessageWidget(pending.sender, *history_.find(pending.id));
+
+        // widget gets inserted second to last so it stays above the spacer
+        auto count = ui->messagesLayout->count();
+        ui->messagesLayout->insertWidget(count - 1, messageWidget, 0, Qt::AlignTop);
+        applied.push_back(pending.id);
+    }
+    pendingMessages_.clear();
+
+    contents->setUpdatesEnabled(true);
+    emit updatesApplied(applied);
+}
+
+ChatMessage* ChatMessageHistory::createMessageWidget(const std::string &sender, const HistoryEntry &entry) {
+    auto messageWidget = sender.empty() ? new ChatMessage(entry, this) : new ChatMessage(sender, entry, this);
+    if(entry.outgoing) {
+        QObject::connect(messageWidget, &ChatMessage::edited, this, &ChatMessageHistory::handleOwnMessageEdit);
     }
+    messages_.insert(entry.id, messageWidget);
+    return messageWidget;
+}
+
+void ChatMessageHistory::createPage(size_t page) {
+    // pages are created from the newest to the oldest, each above the previous one
+    auto container = new QWidget(ui->scrollArea->widget());
+    auto layout = new QVBoxLayout(container);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->setSpacing(ui->messagesLayout->spacing());
+    ui->messagesLayout->insertWidget(0, container);
 
-    addChatMessageWidget(messageWidget);
+    HistoryPage historyPage;
+    historyPage.container = container;
+    pages_[page] = historyPage;
 }
 
-void ChatMessageHistory::handleMessageEdit(EditChatMessage *message) {
-    try {
-        auto messageWidget = messages_.at(message->getId());
-        messageWidget->edit(message->getContent());
+void ChatMessageHistory::requestPage(size_t page) {
+    auto &historyPage = pages_[page];
+    if(historyPage.loading) {
+        return;
     }
-    catch (const std::out_of_range&) {
+
+    historyPage.loading = true;
+    pager_->requestPage(page);
+}
+
+void ChatMessageHistory::handlePageLoaded(size_t page, const std::vector<HistoryEntry> &entries) {
+    auto historyPage = pages_.find(page);
+    if(historyPage == pages_.end() || historyPage->second.loaded) {
         return;
     }
+
+    // a page above the visible part must not push the visible messages down
+    auto container = historyPage->second.container;
+    if(container->geometry().bottom() < ui->scrollArea->verticalScrollBar()->value()) {
+        keepBottomDistance_ = true;
+    }
+
+    showPage(page, entries);
 }
 
-void ChatMessageHistory::addChatMessageWidget(ChatMessage *messageWidget) {
-    messages_.insert(std::make_pair(messageWidget->getId(), messageWidget));
+void ChatMessageHistory::showPage(size_t page, const std::vector<HistoryEntry> &entries) {
+    TraceSpan span("ui_page", "ui");
+
+    auto &historyPage = pages_[page];
+    auto container = historyPage.container;
+    container->setUpdatesEnabled(false);
 
-    // widget gets inserted second to last so it stays above the spacer
-    auto count = ui->messagesLayout->count();
-    ui->messagesLayout->insertWidget(count - 1, messageWidget, 0, Qt::AlignTop);
+    std::string previousSender;
+    for(auto entry : entries) {
+        auto edited = unloadedEdits_.find(entry.id);
+        if(edited != nullptr) {
+            if(edited->version > entry.version) {
+                entry = *edited;
+            }
+            unloadedEdits_.erase(entry.id);
+        }
+
+        if(!history_.addEntry(entry)) {
+            continue;
+        }
+
+        auto sender = entry.outgoing ? ownUsername_ : otherUsername_;
+        container->layout()->addWidget(createMessageWidget(sender == previousSender ? "" : sender, entry));
+        historyPage.ids.push_back(entry.id);
+        previousSender = sender;
+    }
+
+    // an unloaded page kept its height until now
+    container->setMinimumHeight(0);
+    container->setMaximumHeight(QWIDGETSIZE_MAX);
+    container->setUpdatesEnabled(true);
+
+    historyPage.loaded = true;
+    historyPage.loading = false;
+    touchPage(page);
+    evictPages();
+
+    // checked again once the page is laid out, it may not fill the view yet
+    QMetaObject::invokeMethod(this, &ChatMessageHistory::updateVisiblePages, Qt::QueuedConnection);
+}
+
+void ChatMessageHistory::touchPage(size_t page) {
+    recentPages_.remove(page);
+    recentPages_.push_front(page);
+}
+
+void ChatMessageHistory::evictPages() {
+    while(recentPages_.size() > MAX_LOADED_HISTORY_PAGES) {
+        auto &historyPage = pages_[recentPages_.back()];
+        recentPages_.pop_back();
+
+        historyPage.container->setFixedHeight(historyPage.container->height());
+        for(auto id : historyPage.ids) {
+            auto messageWidget = messages_.find(id);
+            if(messageWidget != nullptr) {
+                delete *messageWidget;
+                messages_.erase(id);
+            }
+            history_.removeEntry(id);
+        }
+        historyPage.ids.clear();
+        historyPage.loaded = false;
+    }
+}
+
+void ChatMessageHistory::updateVisiblePages() {
+    if(pager_ == nullptr || pages_.empty()) {
+        return;
+    }
+
+    auto scrollBar = ui->scrollArea->verticalScrollBar();
+    auto top = scrollBar->value();
+    auto bottom = top + ui->scrollArea->viewport()->height();
+    for(auto &page : pages_) {
+        auto geometry = page.second.container->geometry();
+        if(geometry.bottom() < top || geometry.top() > bottom) {
+            continue;
+        }
+
+        if(page.second.loaded) {
+            touchPage(page.first);
+        }
+        else {
+            requestPage(page.first);
+        }
+    }
+
+    // the page above is read while the user is still a screen away from the top
+    if(firstPage_ > 0 && pages_[firstPage_].loaded && top - scrollBar->minimum() <= scrollBar->pageStep()) {
+        createPage(--firstPage_);
+        requestPage(firstPage_);
+    }
+}
+
+void ChatMessageHistory::updateAnchor(int value) {
+    anchoredAtBottom_ = value == ui->scrollArea->verticalScrollBar()->maximum();
+    updateVisiblePages();
 }
 
 void ChatMessageHistory::scrollToBottom(int min, int max) {
-    ui->scrollArea->verticalScrollBar()->setValue(max);
+    auto scrollBar = ui->scrollArea->verticalScrollBar();
+
+    // a user reading older messages is not pulled down by new ones, nor pushed down by pages loaded above
+    if(anchoredAtBottom_) {
+        scrollBar->setValue(max);
+    }
+    else if(keepBottomDistance_) {
+        scrollBar->setValue(scrollBar->value() + max - lastMaximum_);
+    }
+    keepBottomDistance_ = false;
+    lastMaximum_ = max;
+
+    updateVisiblePages();
 }
 
 ChatMessageHistory::~ChatMessageHistory()
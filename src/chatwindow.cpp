@@ -1,42 +1,144 @@
 #include "chatwindow.h"
 #include "ui_chatwindow.h"
+#include "utils.h"
+
+#include <QFileDialog>
+
+const int DIAGNOSTICS_UPDATE_INTERVAL = 1000;
+const size_t SEARCH_RESULT_LIMIT = 100;
+
+namespace {
+    QString formatLatency(const MessageLatency &latency, bool clockOffsetKnown) {
+        auto network = clockOffsetKnown ? QString::number(latency.network, 'f', 1) : QString("?");
+        auto total = clockOffsetKnown ? QString::number(latency.total, 'f', 1) : QString("?");
+        return QString("queue %1, network %2, decode %3, render %4, total %5 ms")
+                .arg(QString::number(latency.sendQueue, 'f', 1), network, QString::number(latency.decode, 'f', 1),
+                     QString::number(latency.render, 'f', 1), total);
+    }
+}
 
 ChatWindow::ChatWindow(std::shared_ptr<ChatSession> chatSession, QWidget *parent) :
     QDialog(parent),
     ui(new Ui::ChatWindow),
-    chatSession_(chatSession)
+    chatSession_(chatSession),
+    diagnosticsTimer_(new QTimer(this)),
+    fileTransfers_(new FileTransferManager(chatSession, this))
 {
     ui->setupUi(this);
+    title_ = windowTitle();
 
     QObject::connect(ui->sendMessageButton, &QPushButton::clicked, this, &ChatWindow::onSendMessageButtonClicked);
+    QObject::connect(ui->diagnosticsButton, &QToolButton::toggled, this, &ChatWindow::onDiagnosticsButtonToggled);
+    QObject::connect(diagnosticsTimer_, &QTimer::timeout, this, &ChatWindow::updateDiagnostics);
+    QObject::connect(ui->fileButton, &QToolButton::clicked, this, &ChatWindow::onFileButtonClicked);
+    QObject::connect(ui->groupButton, &QToolButton::clicked, this, &ChatWindow::groupInvitationRequested);
+    QObject::connect(ui->searchEdit, &QLineEdit::returnPressed, this, &ChatWindow::onSearchRequested);
+    QObject::connect(ui->searchEdit, &QLineEdit::textChanged, this, [this](const QString &text) {
+        if(text.isEmpty()) {
+            ui->searchResults->setVisible(false);
+        }
+    });
+
+    QObject::connect(fileTransfers_, &FileTransferManager::fileOffered, this, &ChatWindow::handleFileOffered);
+    QObject::connect(fileTransfers_, &FileTransferManager::progressed, this, &ChatWindow::handleFileProgress);
+    QObject::connect(fileTransfers_, &FileTransferManager::finished, this, &ChatWindow::handleFileFinished);
+    QObject::connect(fileTransfers_, &FileTransferManager::failed, this, &ChatWindow::handleFileFailed);
 
     QObject::connect(chatSession.get(), &ChatSession::newChatMessageReceived, this, &ChatWindow::onNewMessageReceived);
     QObject::connect(chatSession.get(), &ChatSession::editedChatMessageReceived, this, &ChatWindow::onMessageEditReceived);
     QObject::connect(chatSession.get(), &ChatSession::sessionEndedByOtherSide, this, &ChatWindow::handleSessionEnded);
+    QObject::connect(chatSession.get(), &ChatSession::connectionLost, this, &ChatWindow::handleConnectionLost);
+    QObject::connect(chatSession.get(), &ChatSession::connectionRestored, this, &ChatWindow::handleConnectionRestored);
     QObject::connect(ui->chatMessageHistory, &ChatMessageHistory::messageEdited, this, &ChatWindow::handleMessageEdited);
+    QObject::connect(ui->chatMessageHistory, &ChatMessageHistory::updatesApplied, this, [this](const std::vector<MessageId> &ids) {
+        chatSession_->recordRendered(ids);
+    });
+}
+
+void ChatWindow::openHistory(const std::string &path, const std::string &key) {
+    log_ = std::make_shared<ConversationLog>(path, key);
+    try {
+        log_->open();
+    }
+    catch (const std::exception &ex) {
+        qWarning("Conversation history disabled: %s", ex.what());
+        log_.reset();
+        return;
+    }
+
+    ui->chatMessageHistory->showHistory(log_, chatSession_->getOwnUserInfo().getUsername(), chatSession_->getOtherUserInfo().getUsername());
+    ui->searchEdit->setEnabled(true);
+
+    historySync_ = new HistorySync(chatSession_, log_, this);
+    QObject::connect(historySync_, &HistorySync::entrySynced, this, &ChatWindow::handleEntrySynced);
+}
+
+void ChatWindow::openOutbox(std::shared_ptr<Outbox> outbox) {
+    outbox_ = new OutboxSender(chatSession_, outbox, this);
 }
 
 void ChatWindow::onNewMessageReceived(NewChatMessage *message) {
-    ui->chatMessageHistory->addMessage(chatSession_->getOtherUserInfo().getUsername(), message);
+    if(ui->chatMessageHistory->addMessage(chatSession_->getOtherUserInfo().getUsername(), message) && log_ != nullptr) {
+        log_->append(message, false);
+    }
 }
 
 void ChatWindow::onMessageEditReceived(EditChatMessage *message) {
-    ui->chatMessageHistory->handleMessageEdit(message);
+    if(ui->chatMessageHistory->handleMessageEdit(message) && log_ != nullptr) {
+        log_->append(message, false);
+    }
+}
+
+void ChatWindow::handleEntrySynced(const HistoryEntry &entry, bool added) {
+    if(added) {
+        auto sender = entry.outgoing ? chatSession_->getOwnUserInfo().getUsername() : chatSession_->getOtherUserInfo().getUsername();
+        NewChatMessage message(entry.id, entry.content);
+        ui->chatMessageHistory->addMessage(sender, &message, entry.outgoing);
+    }
+    if(entry.version > 0) {
+        EditChatMessage edit(entry.id, entry.version, entry.content);
+        ui->chatMessageHistory->handleMessageEdit(&edit);
+    }
 }
 
 void ChatWindow::handleMessageEdited(std::shared_ptr<EditChatMessage> message) {
-    chatSession_->sendMessage(message);
+    if(chatSession_->isTimestampingEnabled()) {
+        message->setCreatedAt(Utils::getSteadyTimestamp());
+    }
+    if(log_ != nullptr) {
+        log_->append(message.get(), true);
+    }
+
+    sendChatMessage(message);
 }
 
 void ChatWindow::handleSessionEnded() {
     QObject::disconnect(chatSession_.get(), nullptr, this, nullptr);
+
+    // messages written from now on are sent once the next session with the peer is established
+    ui->groupButton->setDisabled(true);
+    if(outbox_ != nullptr) {
+        ui->fileButton->setDisabled(true);
+        setWindowTitle(title_ + " - Offline");
+        return;
+    }
+
     QObject::disconnect(ui->chatMessageHistory, nullptr, this, nullptr);
 
     ui->chatMessageTextEdit->setDisabled(true);
     ui->chatMessageHistory->setDisabled(true);
     ui->sendMessageButton->setDisabled(true);
 
-    setWindowTitle(this->windowTitle() + " - Disconnected");
+    setWindowTitle(title_ + " - Disconnected");
+}
+
+void ChatWindow::handleConnectionLost() {
+    // messages sent in the meantime are delivered once the session is resumed
+    setWindowTitle(title_ + " - Reconnecting...");
+}
+
+void ChatWindow::handleConnectionRestored() {
+    setWindowTitle(title_);
 }
 
 ChatWindow::~ChatWindow()
@@ -49,10 +151,121 @@ void ChatWindow::onSendMessageButtonClicked()
 {
     auto content = ui->chatMessageTextEdit->text();
     auto message = std::make_shared<NewChatMessage>(content.toStdString());
+    if(chatSession_->isTimestampingEnabled()) {
+        message->setCreatedAt(Utils::getSteadyTimestamp());
+    }
 
     ui->chatMessageHistory->addMessage(chatSession_->getOwnUserInfo().getUsername(), message.get(), true);
     ui->chatMessageTextEdit->setText("");
+    if(log_ != nullptr) {
+        log_->append(message.get(), true);
+    }
 
-    chatSession_->sendMessage(message);
+    sendChatMessage(message);
 }
 
+void ChatWindow::sendChatMessage(std::shared_ptr<Message> message) {
+    if(outbox_ != nullptr) {
+        outbox_->send(message);
+    }
+    else {
+        chatSession_->sendMessage(message);
+    }
+}
+
+void ChatWindow::onDiagnosticsButtonToggled(bool checked) {
+    ui->diagnosticsLabel->setVisible(checked);
+    if(checked) {
+        updateDiagnostics();
+        diagnosticsTimer_->start(DIAGNOSTICS_UPDATE_INTERVAL);
+    }
+    else {
+        diagnosticsTimer_->stop();
+    }
+}
+
+void ChatWindow::updateDiagnostics() {
+    auto diagnostics = chatSession_->getDiagnostics();
+
+    auto text = QString("RTT %1 ms (jitter %2 ms)").arg(QString::number(diagnostics.smoothedRtt, 'f', 1), QString::number(diagnostics.rttVariation, 'f', 1));
+    text += diagnostics.clockOffsetKnown ? QString(", clock offset %1 ms").arg(QString::number(diagnostics.clockOffset, 'f', 1)) : QString(", clock offset unknown");
+
+    if(!chatSession_->isTimestampingEnabled()) {
+        text += "\nOwn messages are sent without timestamps.";
+    }
+    if(diagnostics.latencySamples > 0) {
+        text += "\nLast message: " + formatLatency(diagnostics.lastLatency, diagnostics.clockOffsetKnown);
+        text += QString("\nAverage of %1: ").arg(diagnostics.latencySamples) + formatLatency(diagnostics.averageLatency, diagnostics.clockOffsetKnown);
+    }
+    else {
+        text += "\nNo timestamped messages received yet.";
+    }
+
+    ui->diagnosticsLabel->setText(text);
+}
+
+void ChatWindow::onFileButtonClicked() {
+    auto fileDialog = new QFileDialog(this);
+    fileDialog->setFileMode(QFileDialog::FileMode::ExistingFile);
+    fileDialog->setAttribute(Qt::WA_DeleteOnClose);
+    QObject::connect(fileDialog, &QFileDialog::fileSelected, this, [this](const QString &path) {
+        try {
+            fileTransfers_->sendFile(path.toStdString());
+            ui->transferLabel->setText("Waiting for " + QString::fromStdString(chatSession_->getOtherUserInfo().getUsername()) + " to accept the file...");
+        }
+        catch (const std::runtime_error &error) {
+            ui->transferLabel->setText(QString::fromStdString(error.what()));
+        }
+        ui->transferLabel->setVisible(true);
+    });
+    fileDialog->show();
+}
+
+void ChatWindow::handleFileOffered(MessageId transferId, const std::string &name, unsigned long long size) {
+    // the offer is declined by closing the dialog, which lets the sender know
+    auto fileDialog = new QFileDialog(this);
+    fileDialog->setWindowTitle(QString("Save %1 (%2 KiB)").arg(QString::fromStdString(name), QString::number(size / 1024)));
+    fileDialog->setFileMode(QFileDialog::FileMode::AnyFile);
+    fileDialog->setAcceptMode(QFileDialog::AcceptMode::AcceptSave);
+    fileDialog->selectFile(QString::fromStdString(name));
+    fileDialog->setAttribute(Qt::WA_DeleteOnClose);
+    QObject::connect(fileDialog, &QFileDialog::fileSelected, this, [this, transferId](const QString &path) {
+        fileTransfers_->acceptFile(transferId, path.toStdString());
+    });
+    QObject::connect(fileDialog, &QFileDialog::rejected, this, [this, transferId] { fileTransfers_->declineFile(transferId); });
+    fileDialog->show();
+}
+
+void ChatWindow::handleFileProgress(MessageId transferId, unsigned long long transferred, unsigned long long size) {
+    ui->transferLabel->setText(QString("File transfer: %1 of %2 KiB").arg(QString::number(transferred / 1024), QString::number(size / 1024)));
+    ui->transferLabel->setVisible(true);
+}
+
+void ChatWindow::handleFileFinished(MessageId transferId) {
+    ui->transferLabel->setText("File transfer finished.");
+}
+
+void ChatWindow::handleFileFailed(MessageId transferId, const std::string &error) {
+    ui->transferLabel->setText("File transfer failed: " + QString::fromStdString(error));
+    ui->transferLabel->setVisible(true);
+}
+
+void ChatWindow::onSearchRequested() {
+    auto query = ui->searchEdit->text().toStdString();
+    ui->searchResults->clear();
+    if(log_ == nullptr || query.empty()) {
+        ui->searchResults->setVisible(false);
+        return;
+    }
+
+    auto entries = log_->search(query, SEARCH_RESULT_LIMIT);
+    for(auto &entry : entries) {
+        auto sender = entry.outgoing ? chatSession_->getOwnUserInfo().getUsername() : chatSession_->getOtherUserInfo().getUsername();
+        ui->searchResults->addItem(QString::fromStdString(sender + ": " + entry.content));
+    }
+    if(entries.empty()) {
+        ui->searchResults->addItem(query.length() < MIN_SEARCH_QUERY_LENGTH ? QString("Enter at least %1 characters.").arg(MIN_SEARCH_QUERY_LENGTH)
+                                                                           : QString("No messages found."));
+    }
+    ui->searchResults->setVisible(true);
+}
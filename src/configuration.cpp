@@ -30,6 +30,23 @@ void Configuration::saveToFile(const std::string &path) const {
     fileStream << "username: " << userInfo.getUsername() << std::endl;
     fileStream << "port: " << port << std::endl;
 
+    if(!metricsSocket.empty()) {
+        fileStream << "metrics_socket: " << metricsSocket << std::endl;
+    }
+    if(!metricsDumpPath.empty()) {
+        fileStream << "metrics_dump_path: " << metricsDumpPath << std::endl;
+        fileStream << "metrics_dump_interval: " << metricsDumpInterval << std::endl;
+    }
+    if(latencyTimestamps) {
+        fileStream << "latency_timestamps: true" << std::endl;
+    }
+    if(!historyPath.empty()) {
+        fileStream << "history_path: " << historyPath << std::endl;
+    }
+    if(!outboxPath.empty()) {
+        fileStream << "outbox_path: " << outboxPath << std::endl;
+    }
+
     fileStream.close();
 }
 
@@ -56,7 +73,17 @@ Configuration Configuration::loadFromFile(const std::string &path) {
     auto port = std::stoi(parameters["port"]);
     auto keys = getKeys(publicKeyFile, privateKeyFile);
 
-    return Configuration(publicKeyFile, privateKeyFile, userInfo, port, keys);
+    auto configuration = Configuration(publicKeyFile, privateKeyFile, userInfo, port, keys);
+    configuration.metricsSocket = parameters["metrics_socket"];
+    configuration.metricsDumpPath = parameters["metrics_dump_path"];
+    if(parameters.count("metrics_dump_interval") > 0) {
+        configuration.metricsDumpInterval = std::stoi(parameters["metrics_dump_interval"]);
+    }
+    configuration.latencyTimestamps = parameters["latency_timestamps"] == "true";
+    configuration.historyPath = parameters["history_path"];
+    configuration.outboxPath = parameters["outbox_path"];
+
+    return configuration;
 }
 
 std::string Configuration::getDefaultConfigDirectory() {
@@ -0,0 +1,402 @@
+#include "encryptedfile.h"
+#include "encryption.h"
+#include "random.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+const std::string ENCRYPTED_FILE_OPEN_ERROR = "Could not open the encrypted file.";
+const std::string ENCRYPTED_FILE_FORMAT_ERROR = "The file is not encrypted.";
+const std::string ENCRYPTED_FILE_KEY_ERROR = "The file was encrypted with a different key.";
+const std::string ENCRYPTED_FILE_CONVERSION_ERROR = "Could not encrypt the file.";
+const char ENCRYPTED_FILE_MAGIC[] = "QCEF";
+const size_t ENCRYPTED_FILE_MAGIC_LENGTH = 4;
+const size_t ENCRYPTED_FILE_SALT_LENGTH = 16;
+const size_t ENCRYPTED_FILE_CHECK_LENGTH = 16;
+const size_t ENCRYPTED_FILE_HEADER_LENGTH = ENCRYPTED_FILE_MAGIC_LENGTH + ENCRYPTED_FILE_SALT_LENGTH + ENCRYPTED_FILE_CHECK_LENGTH;
+const size_t PAGE_NONCE_LENGTH = 12;
+const size_t PAGE_TAG_LENGTH = 16;
+const size_t PAGE_OVERHEAD = PAGE_NONCE_LENGTH + PAGE_TAG_LENGTH;
+const size_t PAGE_SLOT_LENGTH = ENCRYPTED_PAGE_SIZE + PAGE_OVERHEAD;
+const size_t CONVERSION_BLOCK = 16 * ENCRYPTED_PAGE_SIZE;
+const char JOURNAL_MAGIC[] = "QCEJ";
+const size_t JOURNAL_MAGIC_LENGTH = 4;
+const unsigned int JOURNAL_FIELD_LENGTH = 16;
+const size_t JOURNAL_HEADER_LENGTH = 2 * JOURNAL_FIELD_LENGTH;
+
+using CryptoPP::byte;
+
+EncryptedPageFile::EncryptedPageFile(const std::string &path, const std::string &key) :
+    path_(path),
+    key_(key)
+{
+    // every page brings its own nonce, this one is never used
+    const byte nonce[PAGE_NONCE_LENGTH] = {};
+    encryptor_.SetKeyWithIV(reinterpret_cast<const byte*>(key_.data()), key_.length(), nonce, PAGE_NONCE_LENGTH);
+    decryptor_.SetKeyWithIV(reinterpret_cast<const byte*>(key_.data()), key_.length(), nonce, PAGE_NONCE_LENGTH);
+}
+
+EncryptedPageFile::~EncryptedPageFile() {
+    if(file_.is_open()) {
+        flush();
+    }
+}
+
+void EncryptedPageFile::open() {
+    Utils::createPath(path_);
+    std::ofstream(path_, std::ios::binary | std::ios::app);
+
+    std::error_code error;
+    auto fileSize = std::filesystem::file_size(path_, error);
+    if(error) {
+        throw std::runtime_error(ENCRYPTED_FILE_OPEN_ERROR);
+    }
+
+    file_.open(path_, std::ios::binary | std::ios::in | std::ios::out);
+    if(!file_.is_open()) {
+        throw std::runtime_error(ENCRYPTED_FILE_OPEN_ERROR);
+    }
+
+    if(fileSize == 0) {
+        salt_ = Random::generateBytes(ENCRYPTED_FILE_SALT_LENGTH);
+        file_ << ENCRYPTED_FILE_MAGIC << salt_ << getKeyCheck();
+        file_.flush();
+        fileSize = ENCRYPTED_FILE_HEADER_LENGTH;
+    }
+    else {
+        std::string header(ENCRYPTED_FILE_HEADER_LENGTH, '\0');
+        if(!file_.read(&header[0], ENCRYPTED_FILE_HEADER_LENGTH) || header.compare(0, ENCRYPTED_FILE_MAGIC_LENGTH, ENCRYPTED_FILE_MAGIC) != 0) {
+            file_.close();
+            throw std::runtime_error(ENCRYPTED_FILE_FORMAT_ERROR);
+        }
+        salt_ = header.substr(ENCRYPTED_FILE_MAGIC_LENGTH, ENCRYPTED_FILE_SALT_LENGTH);
+        if(header.compare(ENCRYPTED_FILE_MAGIC_LENGTH + ENCRYPTED_FILE_SALT_LENGTH, ENCRYPTED_FILE_CHECK_LENGTH, getKeyCheck()) != 0) {
+            file_.close();
+            throw std::runtime_error(ENCRYPTED_FILE_KEY_ERROR);
+        }
+        fileSize = replayJournal(fileSize);
+    }
+
+    // a last page too short to hold anything was torn while being created, it is overwritten by the next write
+    auto stored = fileSize - ENCRYPTED_FILE_HEADER_LENGTH;
+    auto rest = stored % PAGE_SLOT_LENGTH;
+    size_ = stored / PAGE_SLOT_LENGTH * ENCRYPTED_PAGE_SIZE + (rest > PAGE_OVERHEAD ? rest - PAGE_OVERHEAD : 0);
+    storedLength_ = fileSize;
+    pages_.clear();
+    recent_.clear();
+}
+
+bool EncryptedPageFile::isPlaintext(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    std::string magic(ENCRYPTED_FILE_MAGIC_LENGTH, '\0');
+    if(!input.read(&magic[0], ENCRYPTED_FILE_MAGIC_LENGTH)) {
+        return input.gcount() > 0;
+    }
+    return magic != ENCRYPTED_FILE_MAGIC;
+}
+
+void EncryptedPageFile::encryptPlaintext() {
+    if(!isPlaintext(path_)) {
+        return;
+    }
+
+    // the plaintext is only replaced once its encryption is complete
+    auto temporaryPath = path_ + ".tmp";
+    std::error_code error;
+    std::filesystem::remove(temporaryPath, error);
+    {
+        EncryptedPageFile encrypted(temporaryPath, key_);
+        encrypted.open();
+
+        std::ifstream input(path_, std::ios::binary);
+        std::string block(CONVERSION_BLOCK, '\0');
+        unsigned long long offset = 0;
+        while(input.read(&block[0], block.length()) || input.gcount() > 0) {
+            encrypted.write(offset, block.substr(0, input.gcount()));
+            offset += input.gcount();
+        }
+        encrypted.flush();
+    }
+
+    file_.close();
+    std::filesystem::rename(temporaryPath, path_, error);
+    if(error) {
+        throw std::runtime_error(ENCRYPTED_FILE_CONVERSION_ERROR);
+    }
+}
+
+size_t EncryptedPageFile::read(unsigned long long offset, char *data, size_t length) {
+    size_t done = 0;
+    while(done < length && offset + done < size_) {
+        auto position = offset + done;
+        auto &page = loadPage(position / ENCRYPTED_PAGE_SIZE);
+        auto within = position % ENCRYPTED_PAGE_SIZE;
+        if(!page.valid || within >= page.data.length()) {
+            break;
+        }
+
+        auto count = std::min<size_t>(length - done, page.data.length() - within);
+        std::memcpy(data + done, &page.data[within], count);
+        done += count;
+    }
+
+    return done;
+}
+
+void EncryptedPageFile::write(unsigned long long offset, const std::string &data) {
+    if(offset > size_) {
+        write(size_, std::string(offset - size_, '\0'));
+    }
+
+    size_t done = 0;
+    while(done < data.length()) {
+        auto position = offset + done;
+        auto number = position / ENCRYPTED_PAGE_SIZE;
+        auto &page = loadPage(number);
+        if(!page.valid) {
+            // what could not be read is overwritten with zeros
+            page.data.assign(std::min<unsigned long long>(ENCRYPTED_PAGE_SIZE, size_ - number * ENCRYPTED_PAGE_SIZE), '\0');
+            page.valid = true;
+        }
+
+        auto within = position % ENCRYPTED_PAGE_SIZE;
+        auto count = std::min<size_t>(data.length() - done, ENCRYPTED_PAGE_SIZE - within);
+        if(page.data.length() < within + count) {
+            page.data.resize(within + count);
+        }
+        page.data.replace(within, count, data, done, count);
+        page.dirty = true;
+
+        done += count;
+        size_ = std::max(size_, number * ENCRYPTED_PAGE_SIZE + page.data.length());
+    }
+}
+
+void EncryptedPageFile::resize(unsigned long long size) {
+    if(size > size_) {
+        return;
+    }
+
+    for(auto page = pages_.begin(); page != pages_.end();) {
+        if(page->first * ENCRYPTED_PAGE_SIZE >= size) {
+            recent_.erase(page->second.recent);
+            page = pages_.erase(page);
+        }
+        else {
+            ++page;
+        }
+    }
+
+    auto fullPages = size / ENCRYPTED_PAGE_SIZE;
+    auto rest = size % ENCRYPTED_PAGE_SIZE;
+    if(rest > 0) {
+        auto &page = loadPage(fullPages);
+        if(page.valid) {
+            page.data.resize(rest);
+            page.dirty = true;
+        }
+        else {
+            recent_.erase(page.recent);
+            pages_.erase(fullPages);
+            rest = 0;
+        }
+    }
+
+    size_ = fullPages * ENCRYPTED_PAGE_SIZE + rest;
+    commit(getStoredLength(size_), true);
+}
+
+void EncryptedPageFile::flush() {
+    commit(std::max(storedLength_, getStoredLength(size_)), false);
+}
+
+void EncryptedPageFile::commit(unsigned long long length, bool truncate) {
+    std::vector<std::pair<size_t, std::string>> sealed;
+    size_t journaled = 0;
+    for(auto &page : pages_) {
+        if(page.second.dirty) {
+            sealed.emplace_back(page.first, sealPage(page.first, page.second));
+            page.second.dirty = false;
+        }
+    }
+    if(sealed.empty() && !truncate) {
+        return;
+    }
+
+    // pages already on disk go first, they are the ones journaled
+    std::sort(sealed.begin(), sealed.end());
+    while(journaled < sealed.size() && getPageOffset(sealed[journaled].first) < storedLength_) {
+        ++journaled;
+    }
+
+    if(journaled > 0) {
+        if(!journal_.is_open()) {
+            std::ofstream(path_ + ENCRYPTED_FILE_JOURNAL_SUFFIX, std::ios::binary | std::ios::app);
+            journal_.open(path_ + ENCRYPTED_FILE_JOURNAL_SUFFIX, std::ios::binary | std::ios::in | std::ios::out);
+        }
+        journal_.clear();
+        journal_.seekp(0);
+        journal_ << Utils::convertToHex(journaled, JOURNAL_FIELD_LENGTH) << Utils::convertToHex(length, JOURNAL_FIELD_LENGTH);
+        for(size_t i = 0; i < journaled; ++i) {
+            journal_ << Utils::convertToHex(sealed[i].first, JOURNAL_FIELD_LENGTH) << Utils::convertToHex(sealed[i].second.length(), JOURNAL_FIELD_LENGTH);
+            journal_.write(sealed[i].second.data(), sealed[i].second.length());
+        }
+        journal_.write(JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH);
+        journal_.flush();
+    }
+
+    for(auto &page : sealed) {
+        file_.clear();
+        file_.seekp(getPageOffset(page.first));
+        file_.write(page.second.data(), page.second.length());
+    }
+    file_.flush();
+
+    std::error_code error;
+    if(truncate) {
+        std::filesystem::resize_file(path_, length, error);
+    }
+
+    // an empty journal is never replayed
+    if(journaled > 0) {
+        journal_.clear();
+        journal_.seekp(0);
+        journal_ << Utils::convertToHex(0, JOURNAL_FIELD_LENGTH);
+        journal_.flush();
+    }
+    storedLength_ = length;
+}
+
+unsigned long long EncryptedPageFile::replayJournal(unsigned long long fileSize) {
+    std::ifstream journal(path_ + ENCRYPTED_FILE_JOURNAL_SUFFIX, std::ios::binary);
+    std::string header(JOURNAL_HEADER_LENGTH, '\0');
+    if(!journal.read(&header[0], JOURNAL_HEADER_LENGTH)) {
+        return fileSize;
+    }
+
+    // every page is checked before any is written, a journal torn while it was written is ignored
+    std::vector<std::pair<size_t, std::string>> pages;
+    unsigned long long length = 0;
+    try {
+        auto count = std::stoull(header.substr(0, JOURNAL_FIELD_LENGTH), 0, 16);
+        length = std::stoull(header.substr(JOURNAL_FIELD_LENGTH), 0, 16);
+        for(unsigned long long i = 0; i < count; ++i) {
+            if(!journal.read(&header[0], JOURNAL_HEADER_LENGTH)) {
+                return fileSize;
+            }
+            auto number = std::stoull(header.substr(0, JOURNAL_FIELD_LENGTH), 0, 16);
+            auto slotLength = std::stoull(header.substr(JOURNAL_FIELD_LENGTH), 0, 16);
+            std::string stored(std::min<unsigned long long>(slotLength, PAGE_SLOT_LENGTH), '\0');
+            std::string data;
+            if(slotLength != stored.length() || !journal.read(&stored[0], stored.length()) || !openPage(number, stored, data)) {
+                return fileSize;
+            }
+            pages.emplace_back(number, std::move(stored));
+        }
+    }
+    catch (const std::logic_error&) {
+        return fileSize;
+    }
+
+    std::string magic(JOURNAL_MAGIC_LENGTH, '\0');
+    if(pages.empty() || !journal.read(&magic[0], JOURNAL_MAGIC_LENGTH) || magic.compare(0, JOURNAL_MAGIC_LENGTH, JOURNAL_MAGIC) != 0) {
+        return fileSize;
+    }
+
+    for(auto &page : pages) {
+        file_.clear();
+        file_.seekp(getPageOffset(page.first));
+        file_.write(page.second.data(), page.second.length());
+    }
+    file_.flush();
+
+    std::error_code error;
+    if(fileSize > length) {
+        std::filesystem::resize_file(path_, length, error);
+    }
+    journal.close();
+    std::ofstream(path_ + ENCRYPTED_FILE_JOURNAL_SUFFIX, std::ios::binary | std::ios::trunc);
+    return std::filesystem::file_size(path_, error);
+}
+
+EncryptedPageFile::Page& EncryptedPageFile::loadPage(size_t number) {
+    auto cached = pages_.find(number);
+    if(cached != pages_.end()) {
+        recent_.splice(recent_.begin(), recent_, cached->second.recent);
+        return cached->second;
+    }
+
+    while(pages_.size() >= ENCRYPTED_PAGE_CACHE_CAPACITY) {
+        // written pages are only stored together, through the journal
+        auto evicted = pages_.find(recent_.back());
+        if(evicted->second.dirty) {
+            flush();
+        }
+        pages_.erase(evicted);
+        recent_.pop_back();
+    }
+
+    Page page;
+    auto begin = number * ENCRYPTED_PAGE_SIZE;
+    if(begin < size_) {
+        auto length = std::min<unsigned long long>(ENCRYPTED_PAGE_SIZE, size_ - begin);
+        std::string stored(length + PAGE_OVERHEAD, '\0');
+        file_.clear();
+        file_.seekg(getPageOffset(number));
+        page.valid = file_.read(&stored[0], stored.length()) && openPage(number, stored, page.data);
+    }
+
+    recent_.push_front(number);
+    page.recent = recent_.begin();
+    return pages_.emplace(number, std::move(page)).first->second;
+}
+
+std::string EncryptedPageFile::sealPage(size_t number, const Page &page) {
+    auto length = page.data.length();
+    auto stored = Random::generateBytes(PAGE_NONCE_LENGTH);
+    stored.resize(length + PAGE_OVERHEAD);
+    auto associatedData = getAssociatedData(number);
+    encryptor_.EncryptAndAuthenticate(reinterpret_cast<byte*>(&stored[PAGE_NONCE_LENGTH]), reinterpret_cast<byte*>(&stored[PAGE_NONCE_LENGTH + length]), PAGE_TAG_LENGTH,
+                                      reinterpret_cast<const byte*>(stored.data()), PAGE_NONCE_LENGTH,
+                                      reinterpret_cast<const byte*>(associatedData.data()), associatedData.length(),
+                                      reinterpret_cast<const byte*>(page.data.data()), length);
+    return stored;
+}
+
+bool EncryptedPageFile::openPage(size_t number, const std::string &stored, std::string &data) {
+    if(stored.length() < PAGE_OVERHEAD) {
+        return false;
+    }
+
+    auto length = stored.length() - PAGE_OVERHEAD;
+    auto associatedData = getAssociatedData(number);
+    data.resize(length);
+    auto valid = decryptor_.DecryptAndVerify(reinterpret_cast<byte*>(&data[0]), reinterpret_cast<const byte*>(&stored[PAGE_NONCE_LENGTH + length]), PAGE_TAG_LENGTH,
+                                             reinterpret_cast<const byte*>(stored.data()), PAGE_NONCE_LENGTH,
+                                             reinterpret_cast<const byte*>(associatedData.data()), associatedData.length(),
+                                             reinterpret_cast<const byte*>(&stored[PAGE_NONCE_LENGTH]), length);
+    if(!valid) {
+        data.clear();
+    }
+    return valid;
+}
+
+std::string EncryptedPageFile::getAssociatedData(size_t number) const {
+    return salt_ + Utils::convertToHex(number, 16);
+}
+
+unsigned long long EncryptedPageFile::getStoredLength(unsigned long long size) const {
+    auto rest = size % ENCRYPTED_PAGE_SIZE;
+    return ENCRYPTED_FILE_HEADER_LENGTH + size / ENCRYPTED_PAGE_SIZE * PAGE_SLOT_LENGTH + (rest > 0 ? rest + PAGE_OVERHEAD : 0);
+}
+
+unsigned long long EncryptedPageFile::getPageOffset(size_t number) const {
+    return ENCRYPTED_FILE_HEADER_LENGTH + static_cast<unsigned long long>(number) * PAGE_SLOT_LENGTH;
+}
+
+std::string EncryptedPageFile::getKeyCheck() const {
+    return KeyDerivation::derive(key_, "qtchat page file check " + salt_, ENCRYPTED_FILE_CHECK_LENGTH);
+}
@@ -1,31 +1,55 @@
 #include "encryption.h"
+#include "random.h"
+#include "utils.h"
 
-#include <lib/cryptopp/osrng.h>
+#include <lib/cryptopp/hkdf.h>
+#include <lib/cryptopp/pssr.h>
+#include <lib/cryptopp/sha.h>
+
+#include <filesystem>
+#include <fstream>
 
 using namespace CryptoPP;
 
+const std::string WRAPPED_KEY_READ_ERROR = "Could not read the data key, it was stored for other keys.";
+const std::string WRAPPED_KEY_WRITE_ERROR = "Could not store the data key.";
+const char WRAPPED_KEY_MAGIC[] = "QCWK";
+const size_t WRAPPED_KEY_MAGIC_LENGTH = 4;
+
+namespace {
+    std::string encodePublicKey(const RSA::PublicKey &key) {
+        std::string result;
+        StringSink ss(result);
+        PEM_Save(ss, key);
+
+        return result;
+    }
+}
+
 RSAPublicKey::RSAPublicKey(long e, long n) {
     publicKey_.Initialize(n, e);
+    encryptor_ = RSAES_OAEP_SHA_Encryptor(publicKey_);
+    encoded_ = encodePublicKey(publicKey_);
 }
 
+RSAPublicKey::RSAPublicKey(RSA::PublicKey &key)
+    : publicKey_(key),
+      encryptor_(key),
+      encoded_(encodePublicKey(key)) {}
+
 std::string RSAPublicKey::encrypt(const std::string &message) {
-    RSAES_OAEP_SHA_Encryptor e(publicKey_);
     std::string cipher;
-    AutoSeededRandomPool rng;
-
     StringSource ss(message, true,
-        new PK_EncryptorFilter(rng, e, new StringSink(cipher))
+        new PK_EncryptorFilter(Random::secure(), encryptor_, new StringSink(cipher))
     );
 
     return cipher;
 }
 
-std::string RSAPublicKey::encode() const {
-    std::string result;
-    StringSink ss(result);
-    PEM_Save(ss, publicKey_);
-
-    return result;
+bool RSAPublicKey::verify(const std::string &message, const std::string &signature) const {
+    RSASS<PSS, SHA256>::Verifier verifier(publicKey_);
+    return verifier.VerifyMessage(reinterpret_cast<const CryptoPP::byte*>(message.data()), message.length(),
+                                  reinterpret_cast<const CryptoPP::byte*>(signature.data()), signature.length());
 }
 
 RSAPublicKey* RSAPublicKey::decodeFromPEM(const std::string &key) {
@@ -40,15 +64,13 @@ RSAPublicKey* RSAPublicKey::decodeFromPEM(const std::string &key) {
 
 RSAPrivateKey::RSAPrivateKey(long e, long n, long d) {
     privateKey_.Initialize(n, e, d);
+    decryptor_ = RSAES_OAEP_SHA_Decryptor(privateKey_);
 }
 
 std::string RSAPrivateKey::decrypt(const std::string &message) {
-    RSAES_OAEP_SHA_Decryptor d(privateKey_);
     std::string recovered;
-    AutoSeededRandomPool rng;
-
     StringSource ss(message, true,
-        new PK_DecryptorFilter(rng, d, new StringSink(recovered))
+        new PK_DecryptorFilter(Random::secure(), decryptor_, new StringSink(recovered))
     );
 
     return recovered;
@@ -62,6 +84,17 @@ std::string RSAPrivateKey::encode() const {
     return result;
 }
 
+std::string RSAPrivateKey::sign(const std::string &message) const {
+    RSASS<PSS, SHA256>::Signer signer(privateKey_);
+
+    std::string signature;
+    StringSource ss(message, true,
+        new SignerFilter(Random::secure(), signer, new StringSink(signature))
+    );
+
+    return signature;
+}
+
 RSAPrivateKey* RSAPrivateKey::decodeFromPEM(const std::string &key) {
     RSA::PrivateKey privateKey;
     StringSource ss(key, true);
@@ -72,29 +105,69 @@ RSAPrivateKey* RSAPrivateKey::decodeFromPEM(const std::string &key) {
     return result;
 }
 
-AESKey::AESKey() {
-    AutoSeededRandomPool rng;
-    CryptoPP::byte key[AES::DEFAULT_KEYLENGTH];
-    rng.GenerateBlock(key, sizeof(key));
-    for(int i = 0; i < sizeof(key); ++i) {
-        key_ += key[i];
+PublicKeyCache& PublicKeyCache::shared() {
+    static PublicKeyCache cache;
+    return cache;
+}
+
+std::shared_ptr<RSAPublicKey> PublicKeyCache::get(const std::string &pem) {
+    auto fingerprint = getFingerprint(pem);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(fingerprint);
+        if(it != index_.end()) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return it->second->second;
+        }
     }
+
+    // decoded outside of the lock, parsing a key takes much longer than a lookup
+    std::shared_ptr<RSAPublicKey> key(RSAPublicKey::decodeFromPEM(pem));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(index_.count(fingerprint) == 0) {
+        entries_.emplace_front(fingerprint, key);
+        index_[fingerprint] = entries_.begin();
+
+        if(entries_.size() > capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+    return key;
+}
+
+std::string PublicKeyCache::getFingerprint(const std::string &pem) {
+    std::string digest;
+    SHA256 hash;
+    StringSource ss(pem, true, new HashFilter(hash, new StringSink(digest)));
+
+    return digest;
+}
+
+AESKey::AESKey() {
+    key_ = Random::generateBytes(AES::DEFAULT_KEYLENGTH);
+    initializeCiphers();
 }
 
 AESKey::AESKey(const std::string &key) {
     key_ = key;
+    initializeCiphers();
 }
 
-std::string AESKey::encrypt(const std::string &message) {
-    ECB_Mode<AES>::Encryption encryptor;
-    CryptoPP::byte keyBytes[key_.length()];
-    std::copy(key_.begin(), key_.end(), keyBytes);
-
-    encryptor.SetKey(keyBytes, key_.length());
+void AESKey::initializeCiphers() {
+    auto keyBytes = reinterpret_cast<const CryptoPP::byte*>(key_.data());
+    encryptor_.SetKey(keyBytes, key_.length());
+    decryptor_.SetKey(keyBytes, key_.length());
+}
 
+std::string AESKey::encrypt(const std::string &message) {
     std::string encrypted;
+    encrypted.reserve(message.length() + AES::BLOCKSIZE);
     StringSource s(message, true,
-        new StreamTransformationFilter(encryptor,
+        new StreamTransformationFilter(encryptor_,
             new StringSink(encrypted)
         )
     );
@@ -103,15 +176,10 @@ std::string AESKey::encrypt(const std::string &message) {
 }
 
 std::string AESKey::decrypt(const std::string &message) {
-    ECB_Mode<AES>::Decryption decryptor;
-    CryptoPP::byte keyBytes[key_.length()];
-    std::copy(key_.begin(), key_.end(), keyBytes);
-
-    decryptor.SetKey(keyBytes, key_.length());
-
     std::string decrypted;
+    decrypted.reserve(message.length());
     StringSource s(message, true,
-        new StreamTransformationFilter(decryptor,
+        new StreamTransformationFilter(decryptor_,
             new StringSink(decrypted)
         )
     );
@@ -123,10 +191,70 @@ std::string AESKey::encode() const {
     return key_;
 }
 
+std::string KeyDerivation::derive(const std::string &secret, const std::string &purpose, size_t length) {
+    std::string key(length, '\0');
+    HKDF<SHA256> hkdf;
+    hkdf.DeriveKey(reinterpret_cast<CryptoPP::byte*>(&key[0]), key.length(), reinterpret_cast<const CryptoPP::byte*>(secret.data()), secret.length(),
+                   nullptr, 0, reinterpret_cast<const CryptoPP::byte*>(purpose.data()), purpose.length());
+
+    return key;
+}
+
+std::string KeyDerivation::deriveFromKeys(const KeyCombination &keys, const std::string &purpose, size_t length) {
+    return derive(keys.getPrivateKey()->encode(), purpose, length);
+}
+
+std::string WrappedKey::load(const std::string &path, const KeyCombination &keys, const std::string &initialKey) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open()) {
+        store(path, keys, initialKey);
+        return initialKey;
+    }
+
+    std::string stored((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(stored.compare(0, WRAPPED_KEY_MAGIC_LENGTH, WRAPPED_KEY_MAGIC) != 0) {
+        throw std::runtime_error(WRAPPED_KEY_READ_ERROR);
+    }
+
+    try {
+        return keys.getPrivateKey()->decrypt(stored.substr(WRAPPED_KEY_MAGIC_LENGTH));
+    }
+    catch (const CryptoPP::Exception&) {
+        throw std::runtime_error(WRAPPED_KEY_READ_ERROR);
+    }
+}
+
+void WrappedKey::rewrap(const std::string &path, const KeyCombination &previous, const KeyCombination &keys) {
+    if(!std::filesystem::exists(path)) {
+        return;
+    }
+
+    store(path, keys, load(path, previous, ""));
+}
+
+void WrappedKey::store(const std::string &path, const KeyCombination &keys, const std::string &key) {
+    // replaced only once the new file is complete, losing the key would lose everything it protects
+    auto temporaryPath = path + ".tmp";
+    Utils::createPath(path);
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file << WRAPPED_KEY_MAGIC << keys.getPublicKey()->encrypt(key);
+        file.flush();
+        if(!file) {
+            throw std::runtime_error(WRAPPED_KEY_WRITE_ERROR);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if(error) {
+        throw std::runtime_error(WRAPPED_KEY_WRITE_ERROR);
+    }
+}
+
 KeyCombination RSAKeyGenerator::generateKey(unsigned int bitsize) {
-    AutoSeededRandomPool rng;
     InvertibleRSAFunction params;
-    params.GenerateRandomWithKeySize(rng, bitsize);
+    params.GenerateRandomWithKeySize(Random::secure(), bitsize);
 
     auto publicRsaKey = RSA::PublicKey(params);
     auto privateRsaKey = RSA::PrivateKey(params);
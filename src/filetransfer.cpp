@@ -0,0 +1,291 @@
+#include "filetransfer.h"
+#include "utils.h"
+
+#include <filesystem>
+
+const std::string FILE_OPEN_ERROR = "Could not open the file.";
+const std::string FILE_READ_ERROR = "Could not read the file.";
+const std::string FILE_WRITE_ERROR = "Could not write the file.";
+const std::string INVALID_FILE_DATA_ERROR = "Received file data does not match the offer.";
+const std::string FILE_CANCELLED_ERROR = "The other side declined or cancelled the transfer.";
+const unsigned int FILE_MARKER_FIELD_LENGTH = 16;
+
+FileTransferManager::FileTransferManager(std::shared_ptr<ChatSession> session, QObject *parent)
+    : QObject(parent),
+      session_(session)
+{
+    QObject::connect(session.get(), &ChatSession::fileOfferReceived, this, &FileTransferManager::handleOffer);
+    QObject::connect(session.get(), &ChatSession::fileAcknowledgementReceived, this, &FileTransferManager::handleAcknowledgement);
+    QObject::connect(session.get(), &ChatSession::fileChunkReceived, this, &FileTransferManager::handleChunk);
+    QObject::connect(session.get(), &ChatSession::fileCancelReceived, this, &FileTransferManager::handleCancel);
+    QObject::connect(session.get(), &ChatSession::bytesWritten, this, &FileTransferManager::sendChunks);
+    QObject::connect(session.get(), &ChatSession::connectionLost, this, &FileTransferManager::handleConnectionLost);
+    QObject::connect(session.get(), &ChatSession::connectionRestored, this, &FileTransferManager::handleConnectionRestored);
+}
+
+MessageId FileTransferManager::sendFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    if(!file.is_open() || error) {
+        throw std::runtime_error(FILE_OPEN_ERROR);
+    }
+
+    auto transferId = AbstractChatMessage::generateId();
+    auto &transfer = outgoing_[transferId];
+    transfer.file = std::move(file);
+    transfer.size = size;
+
+    session_->sendMessage(std::make_shared<FileOfferMessage>(transferId, size, std::filesystem::path(path).filename().string()));
+    return transferId;
+}
+
+void FileTransferManager::acceptFile(MessageId transferId, const std::string &path) {
+    auto it = incoming_.find(transferId);
+    if(it == incoming_.end() || it->second.accepted) {
+        return;
+    }
+
+    auto &transfer = it->second;
+    transfer.markerPath = path + FILE_MARKER_SUFFIX;
+    auto offset = readMarker(transferId, path, transfer);
+
+    // whatever the path holds beyond what was recorded for this transfer is not known to be part of the file
+    std::error_code error;
+    if(offset > 0) {
+        std::filesystem::resize_file(path, offset, error);
+        offset = error ? 0 : offset;
+    }
+
+    transfer.file.open(path, std::ios::binary | (offset > 0 ? std::ios::app : std::ios::trunc));
+    if(!transfer.file.is_open()) {
+        incoming_.erase(it);
+        cancel(transferId);
+        emit failed(transferId, FILE_OPEN_ERROR);
+        return;
+    }
+
+    transfer.received = offset;
+    transfer.accepted = true;
+    acknowledge(transferId, transfer);
+
+    if(transfer.received == transfer.size) {
+        transfer.file.close();
+        std::filesystem::remove(transfer.markerPath, error);
+        incoming_.erase(it);
+        emit finished(transferId);
+    }
+}
+
+void FileTransferManager::declineFile(MessageId transferId) {
+    auto it = incoming_.find(transferId);
+    if(it == incoming_.end() || it->second.accepted) {
+        return;
+    }
+
+    incoming_.erase(it);
+    cancel(transferId);
+}
+
+unsigned long long FileTransferManager::readMarker(MessageId transferId, const std::string &path, const IncomingTransfer &transfer) {
+    std::ifstream marker(transfer.markerPath, std::ios::binary);
+    std::string header(3 * FILE_MARKER_FIELD_LENGTH, '\0');
+    if(!marker.read(&header[0], header.length())) {
+        return 0;
+    }
+
+    try {
+        auto id = std::stoull(header.substr(0, FILE_MARKER_FIELD_LENGTH), 0, 16);
+        auto size = std::stoull(header.substr(FILE_MARKER_FIELD_LENGTH, FILE_MARKER_FIELD_LENGTH), 0, 16);
+        auto offset = std::stoull(header.substr(2 * FILE_MARKER_FIELD_LENGTH, FILE_MARKER_FIELD_LENGTH), 0, 16);
+
+        std::error_code error;
+        auto existing = std::filesystem::file_size(path, error);
+        if(id != transferId || size != transfer.size || offset > size || error || existing < offset) {
+            return 0;
+        }
+        return offset;
+    }
+    catch (const std::logic_error&) {
+        return 0;
+    }
+}
+
+void FileTransferManager::sendChunks() {
+    // one chunk of every transfer in turn, so concurrent transfers share the link
+    auto progress = true;
+    while(progress && session_->getPendingBytes() < FILE_SEND_WATERMARK) {
+        progress = false;
+        for(auto it = outgoing_.begin(); it != outgoing_.end() && session_->getPendingBytes() < FILE_SEND_WATERMARK;) {
+            try {
+                progress = sendChunk(it->first, it->second) || progress;
+                ++it;
+            }
+            catch (const std::runtime_error &error) {
+                auto transferId = it->first;
+                it = outgoing_.erase(it);
+                cancel(transferId);
+                emit failed(transferId, error.what());
+            }
+        }
+    }
+}
+
+bool FileTransferManager::sendChunk(MessageId transferId, OutgoingTransfer &transfer) {
+    if(transfer.paused || transfer.sent >= transfer.size || transfer.sent >= transfer.acknowledged + FILE_TRANSFER_WINDOW) {
+        return false;
+    }
+
+    auto length = std::min<unsigned long long>(FILE_CHUNK_SIZE, transfer.size - transfer.sent);
+    buffer_.resize(length);
+    transfer.file.seekg(transfer.sent);
+    if(!transfer.file.read(&buffer_[0], length)) {
+        throw std::runtime_error(FILE_READ_ERROR);
+    }
+
+    session_->sendMessage(std::make_shared<FileChunkMessage>(transferId, transfer.sent, buffer_));
+    transfer.sent += length;
+    return true;
+}
+
+void FileTransferManager::handleOffer(FileOfferMessage *message) {
+    // offers are sequenced, but one may still arrive again after the other side resumed the session
+    if(incoming_.count(message->getTransferId()) > 0) {
+        return;
+    }
+
+    auto &transfer = incoming_[message->getTransferId()];
+    transfer.name = message->getName();
+    transfer.size = message->getSize();
+    emit fileOffered(message->getTransferId(), transfer.name, transfer.size);
+}
+
+void FileTransferManager::handleAcknowledgement(FileAcknowledgementMessage *message) {
+    auto it = outgoing_.find(message->getTransferId());
+    if(it == outgoing_.end()) {
+        return;
+    }
+
+    auto &transfer = it->second;
+    if(message->getOffset() > transfer.size) {
+        outgoing_.erase(it);
+        cancel(message->getTransferId());
+        emit failed(message->getTransferId(), INVALID_FILE_DATA_ERROR);
+        return;
+    }
+
+    // a paused transfer continues from wherever the receiver says, anything sent beyond that was lost
+    if(transfer.paused) {
+        transfer.paused = false;
+        transfer.sent = message->getOffset();
+        transfer.acknowledged = message->getOffset();
+    }
+    transfer.acknowledged = std::max(transfer.acknowledged, message->getOffset());
+    emit progressed(message->getTransferId(), transfer.acknowledged, transfer.size);
+
+    if(transfer.acknowledged == transfer.size) {
+        outgoing_.erase(it);
+        emit finished(message->getTransferId());
+        return;
+    }
+
+    sendChunks();
+}
+
+void FileTransferManager::handleChunk(FileChunkMessage *message) {
+    auto it = incoming_.find(message->getTransferId());
+    if(it == incoming_.end() || !it->second.accepted) {
+        return;
+    }
+
+    // chunks sent before a reconnect may arrive again, only the next expected one is written
+    auto &transfer = it->second;
+    if(message->getOffset() != transfer.received) {
+        return;
+    }
+
+    auto &data = message->getData();
+    if(data.length() > transfer.size - transfer.received) {
+        std::error_code error;
+        std::filesystem::remove(transfer.markerPath, error);
+        incoming_.erase(it);
+        cancel(message->getTransferId());
+        emit failed(message->getTransferId(), INVALID_FILE_DATA_ERROR);
+        return;
+    }
+
+    transfer.file.write(data.data(), data.length());
+    if(!transfer.file) {
+        incoming_.erase(it);
+        cancel(message->getTransferId());
+        emit failed(message->getTransferId(), FILE_WRITE_ERROR);
+        return;
+    }
+    transfer.received += data.length();
+
+    if(transfer.received == transfer.size) {
+        transfer.file.close();
+        acknowledge(message->getTransferId(), transfer);
+        std::error_code error;
+        std::filesystem::remove(transfer.markerPath, error);
+        incoming_.erase(it);
+        emit finished(message->getTransferId());
+    }
+    else if(transfer.received - transfer.acknowledged >= FILE_ACKNOWLEDGEMENT_INTERVAL) {
+        acknowledge(message->getTransferId(), transfer);
+    }
+}
+
+void FileTransferManager::handleCancel(FileCancelMessage *message) {
+    auto transferId = message->getTransferId();
+    if(outgoing_.erase(transferId) > 0) {
+        emit failed(transferId, FILE_CANCELLED_ERROR);
+        return;
+    }
+
+    // the partial download can never be continued, so its marker goes as well
+    auto it = incoming_.find(transferId);
+    if(it == incoming_.end()) {
+        return;
+    }
+
+    if(it->second.accepted) {
+        std::error_code error;
+        std::filesystem::remove(it->second.markerPath, error);
+    }
+    incoming_.erase(it);
+    emit failed(transferId, FILE_CANCELLED_ERROR);
+}
+
+void FileTransferManager::cancel(MessageId transferId) {
+    session_->sendMessage(std::make_shared<FileCancelMessage>(transferId));
+}
+
+void FileTransferManager::acknowledge(MessageId transferId, IncomingTransfer &transfer) {
+    // the marker only records data already flushed, so a later accept never continues after a gap
+    if(transfer.file.is_open()) {
+        transfer.file.flush();
+        std::ofstream marker(transfer.markerPath, std::ios::binary | std::ios::trunc);
+        marker << Utils::convertToHex(transferId, FILE_MARKER_FIELD_LENGTH) << Utils::convertToHex(transfer.size, FILE_MARKER_FIELD_LENGTH)
+               << Utils::convertToHex(transfer.received, FILE_MARKER_FIELD_LENGTH);
+    }
+
+    transfer.acknowledged = transfer.received;
+    session_->sendMessage(std::make_shared<FileAcknowledgementMessage>(transferId, transfer.received));
+    emit progressed(transferId, transfer.received, transfer.size);
+}
+
+void FileTransferManager::handleConnectionLost() {
+    for(auto &entry : outgoing_) {
+        entry.second.paused = true;
+        entry.second.sent = entry.second.acknowledged;
+    }
+}
+
+void FileTransferManager::handleConnectionRestored() {
+    for(auto &entry : incoming_) {
+        if(entry.second.accepted) {
+            acknowledge(entry.first, entry.second);
+        }
+    }
+}
@@ -0,0 +1,165 @@
+#include "groupsession.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <sstream>
+
+const std::string NOT_GROUP_HOST_ERROR = "Only the group host can add members.";
+const std::string INVALID_GROUP_MESSAGE_ERROR = "Invalid group message received.";
+const unsigned int SENDER_LENGTH_DIGITS = 4;
+
+GroupChatSession::GroupChatSession(UserInfo userInfo) :
+    userInfo_(userInfo),
+    groupId_(Resumption::generateSessionId()),
+    groupKey_(std::make_shared<AESKey>()),
+    host_(true) {}
+
+GroupChatSession::GroupChatSession(UserInfo userInfo, std::shared_ptr<ChatSession> host, GroupKeyMessage *invitation) :
+    userInfo_(userInfo),
+    groupId_(invitation->getGroupId()),
+    groupKey_(std::make_shared<AESKey>(invitation->getKey())),
+    host_(false)
+{
+    attachMember(host);
+}
+
+void GroupChatSession::addMember(std::shared_ptr<ChatSession> member) {
+    if(!host_) {
+        throw std::runtime_error(NOT_GROUP_HOST_ERROR);
+    }
+
+    attachMember(member);
+
+    // the invitation is protected by the member's own session key
+    auto invitation = std::make_shared<GroupKeyMessage>(groupId_, groupKey_->encode());
+    member->sendMessage(invitation);
+}
+
+void GroupChatSession::removeMember(ChatSession *member) {
+    QObject::disconnect(member, nullptr, this, nullptr);
+    members_.erase(std::remove_if(members_.begin(), members_.end(), [member](const std::shared_ptr<ChatSession> &m) { return m.get() == member; }),
+                   members_.end());
+}
+
+void GroupChatSession::sendMessage(std::shared_ptr<AbstractChatMessage> message) {
+    auto username = userInfo_.getUsername();
+
+    std::stringstream ss;
+    ss << Utils::convertToHex(username.length(), SENDER_LENGTH_DIGITS) << username << messageConverter_.convertFromMessage(message.get());
+
+    // encoded and encrypted once, no matter how many members there are
+    fanOut(buildFrame(groupKey_->encrypt(ss.str())));
+}
+
+void GroupChatSession::attachMember(std::shared_ptr<ChatSession> member) {
+    members_.push_back(member);
+
+    auto session = member.get();
+    QObject::connect(session, &ChatSession::groupMessageReceived, this, [this, session](GroupChatMessage *message) { handleGroupMessage(session, message); });
+    QObject::connect(session, &ChatSession::sessionEndedByOtherSide, this, [this, session] { removeMember(session); });
+}
+
+void GroupChatSession::handleGroupMessage(ChatSession *from, GroupChatMessage *message) {
+    if(message->getGroupId() != groupId_) {
+        return;
+    }
+
+    // the host relays the still encrypted payload to everybody else
+    if(host_) {
+        fanOut(buildFrame(message->getPayload()), from);
+    }
+
+    try {
+        auto payload = groupKey_->decrypt(message->getPayload());
+        if(payload.length() < SENDER_LENGTH_DIGITS) {
+            throw std::runtime_error(INVALID_GROUP_MESSAGE_ERROR);
+        }
+
+        auto senderLength = std::stoul(payload.substr(0, SENDER_LENGTH_DIGITS), 0, 16);
+        if(payload.length() < SENDER_LENGTH_DIGITS + senderLength) {
+            throw std::runtime_error(INVALID_GROUP_MESSAGE_ERROR);
+        }
+
+        currentSender_ = payload.substr(SENDER_LENGTH_DIGITS, senderLength);
+        auto chatMessage = messageConverter_.convertToMessage(payload.substr(SENDER_LENGTH_DIGITS + senderLength));
+        chatMessage->process(this);
+    }
+    catch (const std::exception &error) {
+        emit invalidMessageReceived(error.what());
+    }
+}
+
+void GroupChatSession::fanOut(const QByteArray &frame, ChatSession *except) {
+    // every connection gets a reference to the same buffer
+    for(auto &member : members_) {
+        if(member.get() != except) {
+            member->sendFrame(frame);
+        }
+    }
+}
+
+QByteArray GroupChatSession::buildFrame(const std::string &payload) {
+    auto message = std::make_shared<GroupChatMessage>(groupId_, payload);
+    auto frame = ReliableDelivery::frameUnsequenced(messageConverter_.convertFromMessage(message.get()));
+    return QByteArray(frame.data(), frame.length());
+}
+
+void GroupChatSession::processMessage(KeyMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(SessionEndMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(UserInfoMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(SessionTicketMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(ResumeSessionMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(GroupKeyMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(GroupChatMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(FileOfferMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(FileAcknowledgementMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(FileChunkMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(FileCancelMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(HistorySyncMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(HistoryRecordMessage *) {
+    emit invalidMessageReceived(INVALID_GROUP_MESSAGE_ERROR);
+}
+
+void GroupChatSession::processMessage(NewChatMessage *message) {
+    emit newChatMessageReceived(currentSender_, message);
+}
+
+void GroupChatSession::processMessage(EditChatMessage *message) {
+    emit editedChatMessageReceived(currentSender_, message);
+}
@@ -0,0 +1,54 @@
+#include "groupwindow.h"
+#include "ui_groupwindow.h"
+
+GroupWindow::GroupWindow(std::shared_ptr<GroupChatSession> group, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::GroupWindow),
+    group_(group)
+{
+    ui->setupUi(this);
+
+    QObject::connect(ui->sendButton, &QPushButton::clicked, this, &GroupWindow::onSendButtonClicked);
+    QObject::connect(ui->messageEdit, &QLineEdit::returnPressed, this, &GroupWindow::onSendButtonClicked);
+    QObject::connect(group.get(), &GroupChatSession::newChatMessageReceived, this, &GroupWindow::handleNewMessage);
+    QObject::connect(group.get(), &GroupChatSession::invalidMessageReceived, this, [](const std::string &error) {
+        qWarning("Group message dropped: %s", error.c_str());
+    });
+
+    updateMembers();
+}
+
+GroupWindow::~GroupWindow()
+{
+    delete ui;
+}
+
+void GroupWindow::updateMembers() {
+    if(group_->isHost()) {
+        ui->membersLabel->setText(QString("Hosting, %1 invited").arg(group_->getMemberCount()));
+    }
+    else {
+        ui->membersLabel->setText(group_->getMemberCount() > 0 ? "Member" : "The host left the group.");
+    }
+}
+
+void GroupWindow::onSendButtonClicked() {
+    auto text = ui->messageEdit->text();
+    if(text.isEmpty()) {
+        return;
+    }
+
+    auto message = std::make_shared<NewChatMessage>(text.toStdString());
+    group_->sendMessage(message);
+    addMessage(group_->getUserInfo().getUsername(), message->getContent());
+    ui->messageEdit->clear();
+}
+
+void GroupWindow::handleNewMessage(const std::string &sender, NewChatMessage *message) {
+    addMessage(sender, message->getContent());
+}
+
+void GroupWindow::addMessage(const std::string &sender, const std::string &content) {
+    ui->messageList->addItem(QString::fromStdString(sender + ": " + content));
+    ui->messageList->scrollToBottom();
+}
@@ -0,0 +1,540 @@
+#include "history.h"
+#include "encryption.h"
+#include "utils.h"
+
+#include <QThreadPool>
+
+const unsigned int RECORD_ID_LENGTH = 16;
+const unsigned int RECORD_VERSION_LENGTH = 8;
+const unsigned int RECORD_OFFSET_LENGTH = 16;
+const unsigned int RECORD_LENGTH_LENGTH = 8;
+const unsigned int RECORD_HEADER_LENGTH = 2 + RECORD_ID_LENGTH + RECORD_VERSION_LENGTH + RECORD_OFFSET_LENGTH + RECORD_LENGTH_LENGTH;
+const unsigned int INDEX_HEADER_LENGTH = 16;
+const unsigned int SLOT_LENGTH = RECORD_ID_LENGTH + 2 * RECORD_OFFSET_LENGTH;
+const size_t SLOT_SCAN_BLOCK = 256;
+const unsigned int LOG_SNAPSHOT_INTERVAL = 16; // every n-th version is stored whole, so reading a message applies few deltas
+const char OUTGOING_RECORD = '>';
+const char INCOMING_RECORD = '<';
+
+bool ConversationHistory::addEntry(const HistoryEntry &entry) {
+    if(entries_.find(entry.id) != nullptr) {
+        return false;
+    }
+
+    entries_.insert(entry.id, entry);
+    return true;
+}
+
+bool ConversationHistory::addMessage(NewChatMessage *message, bool outgoing) {
+    return addEntry({message->getId(), outgoing, message->getContent(), 0});
+}
+
+void ConversationHistory::removeEntry(MessageId id) {
+    entries_.erase(id);
+}
+
+bool ConversationHistory::applyEdit(EditChatMessage *message) {
+    auto stored = entries_.find(message->getId());
+    if(stored == nullptr) {
+        return false;
+    }
+
+    auto &entry = *stored;
+    if(message->hasDelta()) {
+        // a delta only makes sense against the exact version it was computed from
+        if(message->getVersion() != entry.version + 1) {
+            return false;
+        }
+        try {
+            entry.content = message->getDelta().apply(entry.content);
+        }
+        catch (const std::runtime_error&) {
+            return false;
+        }
+        message->setContent(entry.content);
+    }
+    else {
+        if(message->getVersion() <= entry.version) {
+            return false;
+        }
+        entry.content = message->getContent();
+    }
+
+    entry.version = message->getVersion();
+    return true;
+}
+
+const HistoryEntry* ConversationHistory::find(MessageId id) const {
+    return entries_.find(id);
+}
+
+ConversationLog::ConversationLog(const std::string &path, const std::string &key) :
+    path_(path),
+    indexPath_(path + ".idx"),
+    file_(path, key),
+    index_(indexPath_, key),
+    search_(path + ".search", KeyDerivation::derive(key, "qtchat search index", SEARCH_KEY_LENGTH))
+{
+}
+
+ConversationLog::~ConversationLog() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // saves adding the pending messages to the search index again when the log is opened next
+    if(file_.isOpen() && search_.getPendingPostings() > 0) {
+        search_.flush(length_, slotCount_);
+    }
+}
+
+void ConversationLog::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // records keep their offsets when a plaintext log is encrypted, only the search index has to be built again
+    // because its trigrams were not hashed
+    if(EncryptedPageFile::isPlaintext(path_)) {
+        search_.open();
+        search_.clear();
+        file_.encryptPlaintext();
+    }
+    index_.encryptPlaintext();
+    file_.open();
+    index_.open();
+    auto logSize = file_.getSize();
+    auto indexSize = index_.getSize();
+
+    // the index header holds the length of the log covered by the index
+    std::string header(INDEX_HEADER_LENGTH, '\0');
+    unsigned long long indexed = 0;
+    if(index_.read(0, &header[0], INDEX_HEADER_LENGTH) == INDEX_HEADER_LENGTH) {
+        try {
+            indexed = std::stoull(header, 0, 16);
+        }
+        catch (const std::logic_error&) {
+            indexed = 0;
+        }
+    }
+    if(indexed > logSize) {
+        indexed = 0;
+    }
+
+    // messages added to the index after its header was last written are indexed again from their records
+    slotCount_ = indexSize < INDEX_HEADER_LENGTH ? 0 : (indexSize - INDEX_HEADER_LENGTH) / SLOT_LENGTH;
+    Slot slot;
+    while(slotCount_ > 0 && (!readSlot(slotCount_ - 1, slot) || slot.first >= indexed)) {
+        --slotCount_;
+    }
+
+    for(auto from : {indexed, 0ULL}) {
+        length_ = from;
+        Record record;
+        while(readRecord(length_, record)) {
+            indexRecord(record, length_);
+            length_ += RECORD_HEADER_LENGTH + record.payload.length();
+        }
+
+        // no record where the index ends means it may not end at a record boundary, it is rebuilt from the whole log
+        if(length_ > from || length_ == logSize || from == 0) {
+            break;
+        }
+        slotCount_ = 0;
+        positions_ = MessageIdMap<size_t>();
+        allPositionsKnown_ = false;
+    }
+
+    // later appends would be unreadable behind a torn record
+    if(logSize > length_) {
+        file_.resize(length_);
+    }
+    writeIndexedLength();
+    index_.resize(INDEX_HEADER_LENGTH + slotCount_ * SLOT_LENGTH);
+    updateSearchIndex();
+}
+
+void ConversationLog::append(NewChatMessage *message, bool outgoing) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(appendRecord({'N', outgoing, message->getId(), 0, 0, message->getContent()})) {
+        addToSearchIndex(slotCount_ - 1, message->getContent(), length_, slotCount_);
+    }
+}
+
+void ConversationLog::append(EditChatMessage *message, bool outgoing) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t position;
+    Slot slot;
+    if(!findSlot(message->getId(), position, slot)) {
+        return;
+    }
+
+    auto delta = message->hasDelta() ? message->getDelta().encode() : "";
+    bool appended;
+    if(message->hasDelta() && delta.length() < message->getContent().length() && message->getVersion() % LOG_SNAPSHOT_INTERVAL != 0) {
+        appended = appendRecord({'D', outgoing, message->getId(), message->getVersion(), slot.latest, delta});
+    }
+    else {
+        appended = appendRecord({'E', outgoing, message->getId(), message->getVersion(), 0, message->getContent()});
+    }
+    if(appended) {
+        addToSearchIndex(position, message->getContent(), length_, slotCount_);
+    }
+}
+
+size_t ConversationLog::getMessageCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slotCount_;
+}
+
+std::vector<HistoryEntry> ConversationLog::readEntries(size_t first, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<HistoryEntry> entries;
+    for(auto position = first; position < first + count && position < slotCount_; ++position) {
+        Slot slot;
+        HistoryEntry entry;
+        if(readSlot(position, slot) && readEntry(slot, entry)) {
+            positions_.insert(slot.id, position);
+            entries.push_back(entry);
+        }
+    }
+    return entries;
+}
+
+bool ConversationLog::readEntry(MessageId id, HistoryEntry &entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t position;
+    Slot slot;
+    return findSlot(id, position, slot) && readEntry(slot, entry);
+}
+
+std::vector<HistoryEntry> ConversationLog::search(const std::string &query, size_t limit) {
+    auto normalized = SearchIndex::normalize(query);
+    auto candidates = search_.find(normalized);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<HistoryEntry> entries;
+    for(auto position : candidates) {
+        if(entries.size() >= limit) {
+            break;
+        }
+
+        // candidates only contain all trigrams of the query, or contained the query before an edit
+        Slot slot;
+        HistoryEntry entry;
+        if(readSlot(position, slot) && readEntry(slot, entry) && SearchIndex::normalize(entry.content).find(normalized) != std::string::npos) {
+            entries.push_back(entry);
+        }
+    }
+    return entries;
+}
+
+std::vector<SyncItem> ConversationLog::getVersions() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<SyncItem> items;
+    items.reserve(slotCount_);
+    std::string block;
+    for(size_t begin = 0; begin < slotCount_; begin += SLOT_SCAN_BLOCK) {
+        auto end = std::min(begin + SLOT_SCAN_BLOCK, slotCount_);
+        block.resize((end - begin) * SLOT_LENGTH);
+        if(index_.read(INDEX_HEADER_LENGTH + begin * SLOT_LENGTH, &block[0], block.length()) != block.length()) {
+            break;
+        }
+
+        for(auto position = begin; position < end; ++position) {
+            Slot slot;
+            try {
+                auto data = block.substr((position - begin) * SLOT_LENGTH, SLOT_LENGTH);
+                slot.id = std::stoull(data.substr(0, RECORD_ID_LENGTH), 0, 16);
+                slot.first = std::stoull(data.substr(RECORD_ID_LENGTH, RECORD_OFFSET_LENGTH), 0, 16);
+                slot.latest = std::stoull(data.substr(RECORD_ID_LENGTH + RECORD_OFFSET_LENGTH, RECORD_OFFSET_LENGTH), 0, 16);
+            }
+            catch (const std::logic_error&) {
+                continue;
+            }
+
+            // only edited messages have a version other than 0, which is read from their latest record
+            Record record;
+            if(slot.latest == slot.first) {
+                items.push_back({slot.id, 0});
+            }
+            else {
+                if(readRecord(slot.latest, record) && record.id == slot.id) {
+                    items.push_back({slot.id, record.version});
+                }
+            }
+        }
+    }
+    return items;
+}
+
+bool ConversationLog::readRecord(unsigned long long offset, Record &record) {
+    std::string header(RECORD_HEADER_LENGTH, '\0');
+    if(file_.read(offset, &header[0], RECORD_HEADER_LENGTH) != RECORD_HEADER_LENGTH) {
+        return false;
+    }
+
+    record.type = header[0];
+    record.outgoing = header[1] == OUTGOING_RECORD;
+    size_t length;
+    try {
+        size_t position = 2;
+        record.id = std::stoull(header.substr(position, RECORD_ID_LENGTH), 0, 16);
+        position += RECORD_ID_LENGTH;
+        record.version = std::stoul(header.substr(position, RECORD_VERSION_LENGTH), 0, 16);
+        position += RECORD_VERSION_LENGTH;
+        record.previous = std::stoull(header.substr(position, RECORD_OFFSET_LENGTH), 0, 16);
+        position += RECORD_OFFSET_LENGTH;
+        length = std::stoul(header.substr(position, RECORD_LENGTH_LENGTH), 0, 16);
+    }
+    catch (const std::logic_error&) {
+        return false;
+    }
+
+    if(record.type != 'N' && record.type != 'E' && record.type != 'D') {
+        return false;
+    }
+
+    // a damaged length must not make room for more than the log holds
+    offset += RECORD_HEADER_LENGTH;
+    if(length > file_.getSize() - offset) {
+        return false;
+    }
+    record.payload.assign(length, '\0');
+    return length == 0 || file_.read(offset, &record.payload[0], length) == length;
+}
+
+bool ConversationLog::readSlot(size_t position, Slot &slot) {
+    std::string data(SLOT_LENGTH, '\0');
+    if(index_.read(INDEX_HEADER_LENGTH + position * SLOT_LENGTH, &data[0], SLOT_LENGTH) != SLOT_LENGTH) {
+        return false;
+    }
+
+    try {
+        slot.id = std::stoull(data.substr(0, RECORD_ID_LENGTH), 0, 16);
+        slot.first = std::stoull(data.substr(RECORD_ID_LENGTH, RECORD_OFFSET_LENGTH), 0, 16);
+        slot.latest = std::stoull(data.substr(RECORD_ID_LENGTH + RECORD_OFFSET_LENGTH, RECORD_OFFSET_LENGTH), 0, 16);
+    }
+    catch (const std::logic_error&) {
+        return false;
+    }
+    return true;
+}
+
+void ConversationLog::writeSlot(size_t position, const Slot &slot) {
+    index_.write(INDEX_HEADER_LENGTH + position * SLOT_LENGTH, Utils::convertToHex(slot.id, RECORD_ID_LENGTH)
+                 + Utils::convertToHex(slot.first, RECORD_OFFSET_LENGTH) + Utils::convertToHex(slot.latest, RECORD_OFFSET_LENGTH));
+}
+
+void ConversationLog::writeIndexedLength() {
+    index_.write(0, Utils::convertToHex(length_, INDEX_HEADER_LENGTH));
+    index_.flush();
+}
+
+bool ConversationLog::findSlot(MessageId id, size_t &position, Slot &slot) {
+    auto known = positions_.find(id);
+    if(known != nullptr) {
+        position = *known;
+        return readSlot(position, slot);
+    }
+    if(allPositionsKnown_) {
+        return false;
+    }
+
+    // edits mostly concern recent messages, so the index is searched from its end
+    std::string block;
+    auto hexId = Utils::convertToHex(id, RECORD_ID_LENGTH);
+    for(size_t end = slotCount_; end > 0;) {
+        auto begin = end > SLOT_SCAN_BLOCK ? end - SLOT_SCAN_BLOCK : 0;
+        block.resize((end - begin) * SLOT_LENGTH);
+        if(index_.read(INDEX_HEADER_LENGTH + begin * SLOT_LENGTH, &block[0], block.length()) != block.length()) {
+            return false;
+        }
+
+        for(auto candidate = end; candidate > begin; --candidate) {
+            if(block.compare((candidate - 1 - begin) * SLOT_LENGTH, RECORD_ID_LENGTH, hexId) == 0) {
+                position = candidate - 1;
+                positions_.insert(id, position);
+                return readSlot(position, slot);
+            }
+        }
+
+        // a miss is remembered for the whole index, so looking up messages which are not logged (as synchronization does) stays cheap
+        for(auto candidate = begin; candidate < end; ++candidate) {
+            MessageId scanned = 0;
+            try {
+                scanned = std::stoull(block.substr((candidate - begin) * SLOT_LENGTH, RECORD_ID_LENGTH), 0, 16);
+            }
+            catch (const std::logic_error&) {
+            }
+            if(scanned != 0) {
+                positions_.insert(scanned, candidate);
+            }
+        }
+        end = begin;
+    }
+    allPositionsKnown_ = true;
+    return false;
+}
+
+bool ConversationLog::readEntry(const Slot &slot, HistoryEntry &entry) {
+    // follow the deltas back to the last record with the whole content
+    std::vector<Record> chain;
+    auto offset = slot.latest;
+    while(true) {
+        Record record;
+        if(!readRecord(offset, record) || record.id != slot.id) {
+            return false;
+        }
+        chain.push_back(std::move(record));
+        if(chain.back().type != 'D') {
+            break;
+        }
+        if(chain.back().previous >= offset) {
+            return false;
+        }
+        offset = chain.back().previous;
+    }
+
+    entry.id = slot.id;
+    entry.outgoing = chain.back().outgoing;
+    entry.version = chain.front().version;
+    entry.content = chain.back().payload;
+    try {
+        for(auto record = chain.rbegin() + 1; record != chain.rend(); ++record) {
+            entry.content = MessageDelta::decode(record->payload).apply(entry.content);
+        }
+    }
+    catch (const std::runtime_error&) {
+        return false;
+    }
+    return true;
+}
+
+void ConversationLog::indexRecord(const Record &record, unsigned long long offset) {
+    size_t position;
+    Slot slot;
+    if(record.type == 'N') {
+        positions_.insert(record.id, slotCount_);
+        writeSlot(slotCount_++, {record.id, offset, offset});
+    }
+    else if(findSlot(record.id, position, slot)) {
+        slot.latest = offset;
+        writeSlot(position, slot);
+    }
+}
+
+bool ConversationLog::appendRecord(const Record &record) {
+    if(!file_.isOpen()) {
+        return false;
+    }
+
+    std::string data;
+    data.reserve(RECORD_HEADER_LENGTH + record.payload.length());
+    data += record.type;
+    data += record.outgoing ? OUTGOING_RECORD : INCOMING_RECORD;
+    data += Utils::convertToHex(record.id, RECORD_ID_LENGTH) + Utils::convertToHex(record.version, RECORD_VERSION_LENGTH)
+            + Utils::convertToHex(record.previous, RECORD_OFFSET_LENGTH) + Utils::convertToHex(record.payload.length(), RECORD_LENGTH_LENGTH);
+    data += record.payload;
+    file_.write(length_, data);
+    file_.flush();
+
+    // the record is complete before the index refers to it
+    auto offset = length_;
+    length_ += RECORD_HEADER_LENGTH + record.payload.length();
+    indexRecord(record, offset);
+    writeIndexedLength();
+    return true;
+}
+
+void ConversationLog::updateSearchIndex() {
+    search_.open();
+
+    // an index covering more than the log was built for a log which has since been cut off or replaced
+    if(search_.getIndexedLength() > length_ || search_.getIndexedMessages() > slotCount_) {
+        search_.clear();
+    }
+
+    auto offset = search_.getIndexedLength();
+    auto messages = search_.getIndexedMessages();
+    while(offset < length_) {
+        Record record;
+        if(!readRecord(offset, record)) {
+            // the index does not end at a record boundary of this log, it is built again
+            if(offset > 0 && offset == search_.getIndexedLength()) {
+                search_.clear();
+                offset = 0;
+                messages = 0;
+                continue;
+            }
+            break;
+        }
+
+        // edits are added with the current content, which is what a search is checked against
+        auto next = offset + RECORD_HEADER_LENGTH + record.payload.length();
+        size_t position;
+        Slot slot;
+        HistoryEntry entry;
+        if(record.type == 'N') {
+            positions_.insert(record.id, messages);
+            addToSearchIndex(messages, record.payload, next, messages + 1);
+            ++messages;
+        }
+        else if(findSlot(record.id, position, slot) && readEntry(slot, entry)) {
+            addToSearchIndex(position, entry.content, next, messages);
+        }
+        offset = next;
+    }
+}
+
+void ConversationLog::addToSearchIndex(size_t position, const std::string &content, unsigned long long indexedLength, size_t indexedMessages) {
+    search_.add(position, content);
+    if(search_.getPendingPostings() >= SEARCH_FLUSH_POSTINGS) {
+        search_.flush(indexedLength, indexedMessages);
+    }
+}
+
+HistoryPager::HistoryPager(std::shared_ptr<ConversationLog> log, QObject *parent) :
+    QObject(parent),
+    log_(log),
+    messageCount_(log->getMessageCount()),
+    receiver_(std::make_shared<Receiver>())
+{
+    receiver_->pager = this;
+}
+
+HistoryPager::~HistoryPager() {
+    std::lock_guard<std::mutex> lock(receiver_->mutex);
+    receiver_->pager = nullptr;
+}
+
+size_t HistoryPager::getPageCount() const {
+    return (messageCount_ + HISTORY_PAGE_SIZE - 1) / HISTORY_PAGE_SIZE;
+}
+
+std::vector<HistoryEntry> HistoryPager::readPage(size_t page) {
+    return readPage(log_, page, messageCount_);
+}
+
+void HistoryPager::requestPage(size_t page) {
+    auto log = log_;
+    auto receiver = receiver_;
+    auto messageCount = messageCount_;
+    QThreadPool::globalInstance()->start([log, receiver, page, messageCount] {
+        auto entries = readPage(log, page, messageCount);
+
+        std::lock_guard<std::mutex> lock(receiver->mutex);
+        auto pager = receiver->pager;
+        if(pager != nullptr) {
+            QMetaObject::invokeMethod(pager, [pager, page, entries] { emit pager->pageLoaded(page, entries); }, Qt::QueuedConnection);
+        }
+    });
+}
+
+std::vector<HistoryEntry> HistoryPager::readPage(std::shared_ptr<ConversationLog> log, size_t page, size_t messageCount) {
+    auto first = page * HISTORY_PAGE_SIZE;
+    if(first >= messageCount) {
+        return {};
+    }
+    return log->readEntries(first, std::min(HISTORY_PAGE_SIZE, messageCount - first));
+}
@@ -0,0 +1,254 @@
+#include "historysync.h"
+#include "tracing.h"
+
+#include <algorithm>
+
+const Counter SYNC_MESSAGES = Metrics::counter("qtchat_history_sync_messages_total");
+const Counter SYNC_RECORDS_SENT = Metrics::counter("qtchat_history_sync_records_sent_total");
+const Counter SYNC_RECORDS_RECEIVED = Metrics::counter("qtchat_history_sync_records_received_total");
+const Counter SYNC_RECORDS_REJECTED = Metrics::counter("qtchat_history_sync_records_rejected_total");
+
+namespace {
+    // splitmix64 finalizer, fixed so that both sides compute the same fingerprints
+    unsigned long long mix(unsigned long long value) {
+        value += 0x9E3779B97F4A7C15ULL;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        return value ^ (value >> 31);
+    }
+}
+
+SetReconciler::SetReconciler(std::vector<SyncItem> items) :
+    items_(std::move(items))
+{
+    // of a message listed twice, only the newest version counts
+    std::sort(items_.begin(), items_.end(), [](const SyncItem &first, const SyncItem &second) {
+        return first.id < second.id || (first.id == second.id && first.version > second.version);
+    });
+    items_.erase(std::unique(items_.begin(), items_.end(), [](const SyncItem &first, const SyncItem &second) {
+        return first.id == second.id;
+    }), items_.end());
+
+    prefixSums_.assign(items_.size() + 1, 0);
+    for(size_t i = 0; i < items_.size(); ++i) {
+        prefixSums_[i + 1] = prefixSums_[i] + hash(items_[i]);
+    }
+}
+
+std::vector<SyncRange> SetReconciler::initiate() const {
+    return {describe(0, 0)};
+}
+
+void SetReconciler::reconcile(const SyncRange &range, std::vector<SyncRange> &replies, std::vector<MessageId> &offered, std::vector<MessageId> &requested) const {
+    auto bounds = find(range.lower, range.upper);
+    auto count = bounds.second - bounds.first;
+
+    if(range.listed) {
+        auto theirs = range.items;
+        std::sort(theirs.begin(), theirs.end(), [](const SyncItem &first, const SyncItem &second) { return first.id < second.id; });
+
+        auto ours = bounds.first;
+        auto other = theirs.begin();
+        while(ours < bounds.second || other != theirs.end()) {
+            if(other == theirs.end() || (ours < bounds.second && items_[ours].id < other->id)) {
+                offered.push_back(items_[ours++].id);
+            }
+            else if(ours == bounds.second || other->id < items_[ours].id) {
+                requested.push_back((other++)->id);
+            }
+            else {
+                if(items_[ours].version > other->version) {
+                    offered.push_back(items_[ours].id);
+                }
+                else if(items_[ours].version < other->version) {
+                    requested.push_back(other->id);
+                }
+                ++ours;
+                ++other;
+            }
+        }
+        return;
+    }
+
+    if(count == range.count && prefixSums_[bounds.second] - prefixSums_[bounds.first] == range.fingerprint) {
+        return;
+    }
+
+    if(count <= SYNC_LIST_THRESHOLD) {
+        replies.push_back(describe(range.lower, range.upper));
+        return;
+    }
+
+    // split at our own messages, so every part holds fewer of them than the whole range
+    for(size_t part = 0; part < SYNC_BRANCHING; ++part) {
+        auto lower = part == 0 ? range.lower : items_[bounds.first + count * part / SYNC_BRANCHING].id;
+        auto upper = part + 1 == SYNC_BRANCHING ? range.upper : items_[bounds.first + count * (part + 1) / SYNC_BRANCHING].id;
+        replies.push_back(describe(lower, upper));
+    }
+}
+
+unsigned long long SetReconciler::hash(const SyncItem &item) {
+    return mix(item.id ^ mix(item.version));
+}
+
+SyncRange SetReconciler::describe(MessageId lower, MessageId upper) const {
+    auto bounds = find(lower, upper);
+
+    SyncRange range;
+    range.lower = lower;
+    range.upper = upper;
+    range.count = bounds.second - bounds.first;
+    range.fingerprint = prefixSums_[bounds.second] - prefixSums_[bounds.first];
+    if(range.count <= SYNC_LIST_THRESHOLD) {
+        range.listed = true;
+        range.items.assign(items_.begin() + bounds.first, items_.begin() + bounds.second);
+    }
+    return range;
+}
+
+std::pair<size_t, size_t> SetReconciler::find(MessageId lower, MessageId upper) const {
+    auto compare = [](const SyncItem &item, MessageId id) { return item.id < id; };
+    auto first = std::lower_bound(items_.begin(), items_.end(), lower, compare);
+    auto last = upper == 0 ? items_.end() : std::lower_bound(first, items_.end(), upper, compare);
+    if(last < first) {
+        last = first;
+    }
+    return {first - items_.begin(), last - items_.begin()};
+}
+
+HistorySync::HistorySync(std::shared_ptr<ChatSession> session, std::shared_ptr<ConversationLog> log, QObject *parent)
+    : QObject(parent),
+      session_(session),
+      log_(log)
+{
+    QObject::connect(session.get(), &ChatSession::historySyncReceived, this, &HistorySync::handleSyncMessage);
+    QObject::connect(session.get(), &ChatSession::historyRecordReceived, this, &HistorySync::handleRecord);
+    QObject::connect(session.get(), &ChatSession::bytesWritten, this, &HistorySync::sendRecords);
+    QObject::connect(session.get(), &ChatSession::connectionLost, this, &HistorySync::handleConnectionLost);
+    QObject::connect(session.get(), &ChatSession::connectionRestored, this, &HistorySync::handleConnectionRestored);
+
+    if(session->isInitiator()) {
+        start();
+    }
+}
+
+void HistorySync::start() {
+    loadSnapshot();
+    send(reconciler_->initiate(), {});
+}
+
+void HistorySync::handleSyncMessage(HistorySyncMessage *message) {
+    TraceSpan span("history_sync", "history");
+    SYNC_MESSAGES.add();
+
+    // the other side started a synchronization
+    if(reconciler_ == nullptr) {
+        loadSnapshot();
+    }
+
+    std::vector<SyncRange> replies;
+    std::vector<MessageId> offered = message->getRequested();
+    std::vector<MessageId> requested;
+    for(auto &range : message->getRanges()) {
+        reconciler_->reconcile(range, replies, offered, requested);
+    }
+
+    if(!replies.empty() || !requested.empty()) {
+        send(replies, requested);
+    }
+    offered_.insert(offered_.end(), offered.begin(), offered.end());
+    sendRecords();
+}
+
+void HistorySync::handleRecord(HistoryRecordMessage *message) {
+    SYNC_RECORDS_RECEIVED.add();
+
+    // the peer only speaks for its own messages, it may neither add messages in our name nor rewrite ours
+    HistoryEntry entry;
+    auto known = log_->readEntry(message->getId(), entry);
+    if(!message->isAuthored() || (known && entry.outgoing)) {
+        SYNC_RECORDS_REJECTED.add();
+        return;
+    }
+
+    // records may cross messages delivered the usual way, those are already logged
+    if(known && entry.version >= message->getVersion()) {
+        return;
+    }
+
+    HistoryEntry synced = {message->getId(), false, message->getContent(), message->getVersion()};
+    if(!known) {
+        NewChatMessage newMessage(synced.id, synced.content);
+        log_->append(&newMessage, synced.outgoing);
+    }
+    if(synced.version > 0) {
+        EditChatMessage edit(synced.id, synced.version, synced.content);
+        log_->append(&edit, synced.outgoing);
+    }
+
+    emit entrySynced(synced, !known);
+}
+
+void HistorySync::sendRecords() {
+    while(!offered_.empty() && session_->getPendingBytes() < SYNC_SEND_WATERMARK) {
+        auto id = offered_.front();
+        offered_.pop_front();
+
+        HistoryEntry entry;
+        if(log_->readEntry(id, entry)) {
+            session_->sendMessage(std::make_shared<HistoryRecordMessage>(entry.id, entry.version, entry.outgoing, entry.content));
+            SYNC_RECORDS_SENT.add();
+        }
+    }
+}
+
+void HistorySync::handleConnectionLost() {
+    // unsynchronized frames are not replayed, the next synchronization starts over with a new snapshot
+    reconciler_.reset();
+    offered_.clear();
+}
+
+void HistorySync::handleConnectionRestored() {
+    if(session_->isInitiator()) {
+        start();
+    }
+}
+
+void HistorySync::loadSnapshot() {
+    TraceSpan span("history_sync_snapshot", "history");
+
+    // messages logged later may be offered again, the other side skips what it already has
+    reconciler_ = std::make_unique<SetReconciler>(log_->getVersions());
+}
+
+void HistorySync::send(const std::vector<SyncRange> &ranges, const std::vector<MessageId> &requested) {
+    // split into several messages, so a large difference does not make one huge frame
+    std::vector<SyncRange> batchRanges;
+    std::vector<MessageId> batchRequested;
+    size_t batchItems = 0;
+    auto sendBatch = [&] {
+        session_->sendMessage(std::make_shared<HistorySyncMessage>(batchRanges, batchRequested));
+        batchRanges.clear();
+        batchRequested.clear();
+        batchItems = 0;
+    };
+
+    for(auto &range : ranges) {
+        auto items = 1 + range.items.size();
+        if(batchItems > 0 && batchItems + items > SYNC_MESSAGE_ITEMS) {
+            sendBatch();
+        }
+        batchRanges.push_back(range);
+        batchItems += items;
+    }
+    for(auto id : requested) {
+        if(batchItems >= SYNC_MESSAGE_ITEMS) {
+            sendBatch();
+        }
+        batchRequested.push_back(id);
+        ++batchItems;
+    }
+    if(batchItems > 0) {
+        sendBatch();
+    }
+}
@@ -1,4 +1,5 @@
 #include "mainwindow.h"
+#include "tracing.h"
 
 #include <QApplication>
 #include <chatwindow.h>
@@ -6,7 +7,22 @@
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    // opt-in tracing, e.g. QTCHAT_TRACE=/tmp/qtchat.json
+    auto tracePath = qEnvironmentVariable("QTCHAT_TRACE");
+    if(!tracePath.isEmpty()) {
+        try {
+            Tracer::instance().start(tracePath.toStdString());
+        }
+        catch (const std::runtime_error &error) {
+            qWarning("%s", error.what());
+        }
+    }
+
     MainWindow w;
     w.show();
-    return a.exec();
+    auto result = a.exec();
+
+    Tracer::instance().stop();
+    return result;
 }
@@ -1,14 +1,23 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 #include "chatwindow.h"
+#include "groupwindow.h"
+#include "random.h"
 #include "utils.h"
 
+#include <filesystem>
+
 #include <settingswindow.h>
 
+const std::string HISTORY_KEY_FILE = "history.key";
+const size_t HISTORY_KEY_LENGTH = 32;
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui_(new Ui::MainWindow)
-    , configuration_(loadConfiguration())
+    , metricsExporter_(new MetricsExporter(this))
+    , sessions_(new SessionRegistry(this))
+    , configuration_(std::make_shared<const Configuration>(loadConfiguration()))
 {
     ui_->setupUi(this);
 
@@ -17,52 +26,151 @@ MainWindow::MainWindow(QWidget *parent)
     QObject::connect(ui_->listenCheckbox, &QCheckBox::stateChanged, this, &MainWindow::onListenCheckboxStateChanged);
 
     initializeSessionCreator();
+    initializeMetricsExporter();
+
+    // a session leaves every group when it ends, whoever ended it
+    QObject::connect(sessions_, &SessionRegistry::sessionStateChanged, this, [this](ChatSession *session, SessionState state) {
+        if(state != SessionState::Ended) {
+            return;
+        }
+        for(auto &group : groupWindows_) {
+            group.second->getGroup()->removeMember(session);
+            group.second->updateMembers();
+        }
+    });
 }
 
 MainWindow::~MainWindow()
 {
+    // the children outlive the members, so they may not call back into this window
+    QObject::disconnect(sessions_, nullptr, this, nullptr);
+    for(auto &group : groupWindows_) {
+        QObject::disconnect(group.second, nullptr, this, nullptr);
+    }
     delete ui_;
 }
 
 void MainWindow::onChatRequestReceived(std::shared_ptr<ChatSession> session) {
     auto connectionDialog = createConnectionDialog();
-    auto handshakeProcessor = std::make_unique<EncryptedSessionReceiverHandshakeProcessor>(configuration_.keys, configuration_.userInfo);
-    onConnectionEstablished(session, connectionDialog);
+    auto configuration = configuration_;
+    auto handshakeProcessor = std::make_unique<EncryptedSessionReceiverHandshakeProcessor>(configuration->keys, configuration->userInfo, sessionCreator_->getTicketIssuer());
+    sessions_->add(session, SessionState::Handshaking);
+    onConnectionEstablished(session.get(), configuration, connectionDialog);
     session->initialize(std::move(handshakeProcessor));
 }
 
-void MainWindow::onConnectionEstablished(std::shared_ptr<ChatSession> session, ConnectionDialog *connectionDialog) {
+// the connections only refer to the session, owning it is left to the registry
+void MainWindow::onConnectionEstablished(ChatSession *session, std::shared_ptr<const Configuration> configuration, ConnectionDialog *connectionDialog) {
     if(connectionDialog != nullptr) {
         connectionDialog->setStatus(ConnectionProgress::EstablishingSession);
         QObject::connect(connectionDialog, &ConnectionDialog::cancelled, this, [this, session, connectionDialog] { onDisconnect(session, connectionDialog); });
     }
 
-    QObject::connect(session.get(), &ChatSession::sessionInitialized, this, [this, session, connectionDialog] { onSessionEstablished(session, connectionDialog); });
-    QObject::connect(session.get(), &ChatSession::sessionInitializationError, this, [this, session, connectionDialog] { onDisconnect(session, connectionDialog); });
-    QObject::connect(this, &MainWindow::configurationChanged, session.get(), [this, session, connectionDialog] { onDisconnect(session, connectionDialog); });
+    QObject::connect(session, &ChatSession::sessionInitialized, this, [this, session, configuration, connectionDialog] {
+        onSessionEstablished(session, configuration, connectionDialog);
+    });
+    QObject::connect(session, &ChatSession::sessionInitializationError, this, [this, session, connectionDialog] { onDisconnect(session, connectionDialog); });
+    QObject::connect(session, &ChatSession::sessionTransferred, this, [this, session, connectionDialog] { onDisconnect(session, connectionDialog); });
 }
 
-void MainWindow::onSessionEstablished(std::shared_ptr<ChatSession> session, ConnectionDialog *connectionDialog) {
+void MainWindow::onSessionEstablished(ChatSession *rawSession, std::shared_ptr<const Configuration> configuration, ConnectionDialog *connectionDialog) {
     if(connectionDialog != nullptr) {
         QObject::disconnect(connectionDialog, &ConnectionDialog::cancelled, this, nullptr); // need to disconnect this first to not trigger onDisconnect
         connectionDialog->close();
     }
 
-    QObject::disconnect(session.get(), &ChatSession::sessionInitialized, this, nullptr);
-    QObject::disconnect(session.get(), &ChatSession::sessionInitializationError, this, nullptr);
-    QObject::disconnect(this, &MainWindow::configurationChanged, session.get(), nullptr);
+    QObject::disconnect(rawSession, &ChatSession::sessionInitialized, this, nullptr);
+    QObject::disconnect(rawSession, &ChatSession::sessionInitializationError, this, nullptr);
+    QObject::disconnect(rawSession, &ChatSession::sessionTransferred, this, nullptr);
 
+    auto session = sessions_->find(rawSession);
+    if(session == nullptr) {
+        return;
+    }
+
+    session->setTimestampingEnabled(configuration->latencyTimestamps);
     ChatWindow *chatWindow = new ChatWindow(session, this);
     chatWindow->setAttribute(Qt::WA_DeleteOnClose);
+    std::weak_ptr<ChatSession> weakSession = session;
+    auto sessions = sessions_;
+    QObject::connect(chatWindow, &QObject::destroyed, sessions, [sessions, weakSession] {
+        auto session = weakSession.lock();
+        if(session != nullptr) {
+            sessions->end(session.get());
+        }
+    });
+    // the history and outbox are named by the other side's key, anyone can claim a username and read or forge a conversation
+    auto fingerprint = session->getOtherKeyFingerprint();
+    if(!configuration->historyPath.empty() && !fingerprint.empty()) {
+        // the data key is wrapped again whenever the keys change, so only the current ones can unwrap it
+        auto keyConfiguration = configuration->historyPath == configuration_->historyPath ? configuration_ : configuration;
+        auto name = QByteArray::fromStdString(fingerprint).toHex().toStdString();
+        try {
+            chatWindow->openHistory(configuration->historyPath + "/" + name + ".log", getHistoryKey(*keyConfiguration));
+        }
+        catch (const std::runtime_error &ex) {
+            qWarning("Conversation history disabled: %s", ex.what());
+        }
+    }
+    auto outbox = fingerprint.empty() ? nullptr : getOutbox(*configuration, fingerprint);
+    if(outbox != nullptr) {
+        chatWindow->openOutbox(outbox);
+    }
+
+    QObject::connect(chatWindow, &ChatWindow::groupInvitationRequested, this, [this, rawSession] { inviteToGroup(rawSession); });
+    QObject::connect(rawSession, &ChatSession::groupKeyReceived, this, [this, rawSession](GroupKeyMessage *invitation) { joinGroup(rawSession, invitation); });
     chatWindow->show();
 }
 
-void MainWindow::onDisconnect(std::shared_ptr<ChatSession> session, ConnectionDialog *connectionDialog) {
-    QObject::disconnect(session.get(), &ChatSession::connectionEstablished, this, nullptr);
-    QObject::disconnect(session.get(), &ChatSession::sessionInitialized, this, nullptr);
-    QObject::disconnect(session.get(), &ChatSession::sessionInitializationError, this, nullptr);
-    QObject::disconnect(this, &MainWindow::configurationChanged, session.get(), nullptr);
-    session->end();
+void MainWindow::inviteToGroup(ChatSession *rawSession) {
+    auto session = sessions_->find(rawSession);
+    if(session == nullptr) {
+        return;
+    }
+
+    // one group is hosted at a time, the first invitation creates it
+    auto hosted = groupWindows_.find(hostedGroupId_);
+    if(hosted == groupWindows_.end()) {
+        auto window = openGroupWindow(std::make_shared<GroupChatSession>(configuration_->userInfo));
+        hostedGroupId_ = window->getGroup()->getGroupId();
+        hosted = groupWindows_.find(hostedGroupId_);
+    }
+
+    hosted->second->getGroup()->addMember(session);
+    hosted->second->updateMembers();
+    hosted->second->raise();
+}
+
+void MainWindow::joinGroup(ChatSession *rawSession, GroupKeyMessage *invitation) {
+    // invitations are sequenced, but one may arrive again after the session was resumed
+    auto session = sessions_->find(rawSession);
+    if(session == nullptr || groupWindows_.count(invitation->getGroupId()) > 0) {
+        return;
+    }
+
+    auto window = openGroupWindow(std::make_shared<GroupChatSession>(configuration_->userInfo, session, invitation));
+    window->setWindowTitle("Group with " + QString::fromStdString(session->getOtherUserInfo().getUsername()));
+}
+
+GroupWindow* MainWindow::openGroupWindow(std::shared_ptr<GroupChatSession> group) {
+    auto groupId = group->getGroupId();
+    auto window = new GroupWindow(group, this);
+    window->setAttribute(Qt::WA_DeleteOnClose);
+    groupWindows_[groupId] = window;
+    QObject::connect(window, &QObject::destroyed, this, [this, groupId] { groupWindows_.erase(groupId); });
+    window->show();
+    return window;
+}
+
+void MainWindow::onDisconnect(ChatSession *session, ConnectionDialog *connectionDialog) {
+    // a session whose handshake failed or which was handed over has already been ended by the registry
+    if(sessions_->find(session) != nullptr) {
+        QObject::disconnect(session, &ChatSession::connectionEstablished, this, nullptr);
+        QObject::disconnect(session, &ChatSession::sessionInitialized, this, nullptr);
+        QObject::disconnect(session, &ChatSession::sessionInitializationError, this, nullptr);
+        QObject::disconnect(session, &ChatSession::sessionTransferred, this, nullptr);
+        sessions_->end(session);
+    }
 
     if(connectionDialog != nullptr) {
         connectionDialog->close();
@@ -70,16 +178,33 @@ void MainWindow::onDisconnect(std::shared_ptr<ChatSession> session, ConnectionDi
 }
 
 void MainWindow::handleConfigurationChange(Configuration &configuration) {
-    configuration_ = configuration;
-    configuration.saveToFile(Configuration::getDefaultConfigPath());
-    emit configurationChanged();
+    // sessions and handshakes already started continue with the configuration they were started with
+    auto previous = configuration_;
+    configuration_ = std::make_shared<const Configuration>(configuration);
+    configuration_->saveToFile(Configuration::getDefaultConfigPath());
 
-    sessionCreator_->disallowConnections();
-    sessionCreator_->setUserInfo(configuration.userInfo);
-    sessionCreator_->setKeys(configuration.keys);
+    sessionCreator_->setUserInfo(configuration_->userInfo);
+    sessionCreator_->setKeys(configuration_->keys);
 
-    if(ui_->listenCheckbox->checkState() == Qt::CheckState::Checked) {
-        sessionCreator_->allowConnections(configuration.port);
+    // the logs stay encrypted with their data key, only its wrapping follows the user's keys
+    if(!configuration_->historyPath.empty() && configuration_->keys.getPublicKey()->encode() != previous->keys.getPublicKey()->encode()) {
+        try {
+            WrappedKey::rewrap(configuration_->historyPath + "/" + HISTORY_KEY_FILE, previous->keys, configuration_->keys);
+        }
+        catch (const std::runtime_error &ex) {
+            qWarning("Could not protect the history with the new keys: %s", ex.what());
+        }
+    }
+
+    // rebinding would drop connections still waiting to be accepted
+    if(configuration_->port != previous->port && ui_->listenCheckbox->checkState() == Qt::CheckState::Checked) {
+        sessionCreator_->disallowConnections();
+        sessionCreator_->allowConnections(configuration_->port);
+    }
+
+    if(configuration_->metricsSocket != previous->metricsSocket || configuration_->metricsDumpPath != previous->metricsDumpPath
+            || configuration_->metricsDumpInterval != previous->metricsDumpInterval) {
+        initializeMetricsExporter();
     }
 }
 
@@ -95,21 +220,26 @@ void MainWindow::onConnectButtonClicked()
         return;
     }
 
-    auto session = sessionCreator_->tryConnect(host, port);
+    auto owned = sessionCreator_->tryConnect(host, port);
+    sessions_->add(owned, SessionState::Connecting);
+    auto session = owned.get();
 
     auto connectionDialog = createConnectionDialog();
     QObject::connect(connectionDialog, &ConnectionDialog::cancelled, this, [this, session, connectionDialog] { onDisconnect(session, connectionDialog); });
 
-    QObject::connect(session.get(), &ChatSession::connectionEstablished, this, [this, session, connectionDialog] {
-        auto handshakeProcessor = std::make_unique<EncryptedSessionSenderHandshakeProcessor>(configuration_.keys, configuration_.userInfo);
-        onConnectionEstablished(session, connectionDialog);
+    // a new conversation never resumes an earlier one, the ticket it is issued is only presented by its own reconnects
+    auto configuration = configuration_;
+    QObject::connect(session, &ChatSession::connectionEstablished, this, [this, session, connectionDialog, configuration] {
+        auto handshakeProcessor = std::make_unique<EncryptedSessionSenderHandshakeProcessor>(configuration->keys, configuration->userInfo,
+                                                                                             sessionCreator_->getTicketStore(), session->getTicketKey());
+        onConnectionEstablished(session, configuration, connectionDialog);
         session->initialize(std::move(handshakeProcessor));
     });
 }
 
 void MainWindow::onSettingsButtonClicked()
 {
-    auto settingsDialog = new SettingsWindow(configuration_, this);
+    auto settingsDialog = new SettingsWindow(*configuration_, this);
     QObject::connect(settingsDialog, &SettingsWindow::configurationChanged, this, &MainWindow::handleConfigurationChange);
     settingsDialog->setAttribute(Qt::WA_DeleteOnClose);
     settingsDialog->show();
@@ -117,7 +247,7 @@ void MainWindow::onSettingsButtonClicked()
 
 void MainWindow::onListenCheckboxStateChanged(int newState) {
     if(newState == Qt::CheckState::Checked) {
-        sessionCreator_->allowConnections(configuration_.port);
+        sessionCreator_->allowConnections(configuration_->port);
     }
     else {
         sessionCreator_->disallowConnections();
@@ -133,14 +263,63 @@ ConnectionDialog* MainWindow::createConnectionDialog() {
 }
 
 void MainWindow::initializeSessionCreator() {
-    sessionCreator_ = std::make_unique<ChatSessionCreator>(configuration_.userInfo, configuration_.keys);
+    sessionCreator_ = std::make_unique<ChatSessionCreator>(configuration_->userInfo, configuration_->keys);
 
     if(ui_->listenCheckbox->checkState() == Qt::CheckState::Checked) {
-        sessionCreator_->allowConnections(configuration_.port);
+        sessionCreator_->allowConnections(configuration_->port);
     }
     QObject::connect(sessionCreator_.get(), &ChatSessionCreator::chatRequestReceived, this, &MainWindow::onChatRequestReceived);
 }
 
+void MainWindow::initializeMetricsExporter() {
+    metricsExporter_->stop();
+
+    if(!configuration_->metricsSocket.empty()) {
+        metricsExporter_->listen(configuration_->metricsSocket);
+    }
+    if(!configuration_->metricsDumpPath.empty()) {
+        metricsExporter_->startDump(configuration_->metricsDumpPath, configuration_->metricsDumpInterval);
+    }
+}
+
+std::string MainWindow::getHistoryKey(const Configuration &configuration) {
+    auto path = configuration.historyPath + "/" + HISTORY_KEY_FILE;
+    if(std::filesystem::exists(path)) {
+        return WrappedKey::load(path, configuration.keys, "");
+    }
+
+    // logs written before the data key existed were encrypted with a key derived from the private key, it is kept for them
+    auto legacy = false;
+    std::error_code error;
+    for(auto &entry : std::filesystem::directory_iterator(configuration.historyPath, error)) {
+        legacy = legacy || entry.path().extension() == ".log";
+    }
+    return WrappedKey::load(path, configuration.keys, legacy ? KeyDerivation::deriveFromKeys(configuration.keys, "qtchat history")
+                                                             : Random::generateBytes(HISTORY_KEY_LENGTH));
+}
+
+std::shared_ptr<Outbox> MainWindow::getOutbox(const Configuration &configuration, const std::string &keyFingerprint) {
+    if(configuration.outboxPath.empty()) {
+        return nullptr;
+    }
+
+    auto path = configuration.outboxPath + "/" + QByteArray::fromStdString(keyFingerprint).toHex().toStdString() + ".outbox";
+    auto &outbox = outboxes_[path];
+    if(outbox == nullptr) {
+        outbox = std::make_shared<Outbox>(path);
+        try {
+            outbox->open();
+        }
+        catch (const std::exception &ex) {
+            qWarning("Outbox disabled: %s", ex.what());
+            outboxes_.erase(path);
+            return nullptr;
+        }
+    }
+
+    return outbox;
+}
+
 Configuration MainWindow::loadConfiguration() {
     try {
         return Configuration::loadFromFile(Configuration::getDefaultConfigPath());
@@ -1,12 +1,93 @@
 #include "messaging.h"
+#include "random.h"
+#include "utils.h"
 
-std::string AbstractChatMessage::generateId() {
-    std::string result;
+#include <algorithm>
+#include <atomic>
+
+const std::string INVALID_DELTA_ERROR = "Invalid message delta.";
+const std::string DELTA_MISMATCH_ERROR = "Message delta does not match the content.";
+const unsigned int DELTA_FIELD_LENGTH = 5; // enough for any content, frames are at most 0xFFFFF bytes long
+
+MessageId AbstractChatMessage::generateId() {
+    static const MessageId prefix = [] {
+        MessageId value;
+        do {
+            value = Random::fast() & 0xFFFFFFFFULL;
+        } while(value == 0);
+        return value << 32;
+    }();
+    static std::atomic<unsigned int> counter(0);
+
+    // the prefix is never 0, so neither is the id, even after the counter wraps
+    auto sequence = counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    return prefix | static_cast<MessageId>(sequence);
+}
+
+MessageDelta MessageDelta::compute(const std::string &original, const std::string &edited) {
+    MessageDelta delta;
+
+    auto shorter = std::min(original.length(), edited.length());
+    size_t prefix = 0;
+    while(prefix < shorter && original[prefix] == edited[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while(suffix < shorter - prefix && original[original.length() - suffix - 1] == edited[edited.length() - suffix - 1]) {
+        ++suffix;
+    }
 
-    for(auto i = 0; i < 8; ++i) {
-        result += ('a' + std::rand()%26);
+    if(prefix + suffix < original.length() || prefix + suffix < edited.length()) {
+        delta.operations_.push_back({prefix, original.length() - prefix - suffix, edited.substr(prefix, edited.length() - prefix - suffix)});
     }
+    return delta;
+}
+
+MessageDelta MessageDelta::decode(const std::string &encoded) {
+    MessageDelta delta;
 
+    try {
+        size_t position = 0;
+        while(position < encoded.length()) {
+            if(encoded.length() - position < 3 * DELTA_FIELD_LENGTH) {
+                throw std::runtime_error(INVALID_DELTA_ERROR);
+            }
+            auto offset = std::stoul(encoded.substr(position, DELTA_FIELD_LENGTH), 0, 16);
+            auto length = std::stoul(encoded.substr(position + DELTA_FIELD_LENGTH, DELTA_FIELD_LENGTH), 0, 16);
+            auto replacementLength = std::stoul(encoded.substr(position + 2 * DELTA_FIELD_LENGTH, DELTA_FIELD_LENGTH), 0, 16);
+            position += 3 * DELTA_FIELD_LENGTH;
+
+            if(encoded.length() - position < replacementLength) {
+                throw std::runtime_error(INVALID_DELTA_ERROR);
+            }
+            delta.operations_.push_back({offset, length, encoded.substr(position, replacementLength)});
+            position += replacementLength;
+        }
+    }
+    catch (const std::logic_error&) {
+        throw std::runtime_error(INVALID_DELTA_ERROR);
+    }
+
+    return delta;
+}
+
+std::string MessageDelta::apply(const std::string &content) const {
+    auto result = content;
+    for(auto &operation : operations_) {
+        if(operation.offset > result.length() || operation.length > result.length() - operation.offset) {
+            throw std::runtime_error(DELTA_MISMATCH_ERROR);
+        }
+        result.replace(operation.offset, operation.length, operation.replacement);
+    }
+    return result;
+}
+
+std::string MessageDelta::encode() const {
+    std::string result;
+    for(auto &operation : operations_) {
+        result += Utils::convertToHex(operation.offset, DELTA_FIELD_LENGTH) + Utils::convertToHex(operation.length, DELTA_FIELD_LENGTH);
+        result += Utils::convertToHex(operation.replacement.length(), DELTA_FIELD_LENGTH) + operation.replacement;
+    }
     return result;
 }
 
@@ -22,10 +103,50 @@ void UserInfoMessage::process(MessageVisitor *handler) {
     handler->processMessage(this);
 }
 
+void SessionTicketMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void ResumeSessionMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void GroupKeyMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void GroupChatMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
 void NewChatMessage::process(MessageVisitor *handler) {
     handler->processMessage(this);
 }
 
+void FileOfferMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void FileAcknowledgementMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void FileChunkMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void FileCancelMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void HistorySyncMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
+void HistoryRecordMessage::process(MessageVisitor *handler) {
+    handler->processMessage(this);
+}
+
 void EditChatMessage::process(MessageVisitor *handler) {
     handler->processMessage(this);
 }
@@ -0,0 +1,258 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include <QLocalSocket>
+#include <QtAlgorithms>
+
+const unsigned int HISTOGRAM_SLOTS = HISTOGRAM_BUCKETS + 2; // buckets, sum, count
+const std::string METRIC_SLOTS_EXHAUSTED_ERROR = "Too many metrics registered.";
+
+namespace {
+    unsigned int getBucket(unsigned long long value) {
+        if(value <= 1) {
+            return 0;
+        }
+
+        // smallest i with value <= 2^i
+        unsigned int bucket = 64 - qCountLeadingZeroBits(static_cast<quint64>(value - 1));
+        return std::min(bucket, HISTOGRAM_BUCKETS - 1);
+    }
+
+    void increment(std::atomic<unsigned long long> &slot, unsigned long long value) {
+        // only the owning thread writes to its shard, so no read-modify-write instruction is needed
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+}
+
+void Counter::add(long long value) const {
+    increment(MetricsRegistry::instance().getLocalSlots()[slot_], static_cast<unsigned long long>(value));
+}
+
+void Histogram::record(unsigned long long value) const {
+    auto values = MetricsRegistry::instance().getLocalSlots();
+    increment(values[slot_ + getBucket(value)], 1);
+    increment(values[slot_ + HISTOGRAM_BUCKETS], value);
+    increment(values[slot_ + HISTOGRAM_BUCKETS + 1], 1);
+}
+
+ScopedLatency::~ScopedLatency() {
+    histogram_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+}
+
+void ConnectionMetrics::setPeer(const std::string &peer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peer_ = peer;
+}
+
+std::string ConnectionMetrics::getPeer() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peer_;
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::ShardHandle::ShardHandle() {
+    auto &registry = MetricsRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    registry.shards_.push_back(&shard);
+}
+
+MetricsRegistry::ShardHandle::~ShardHandle() {
+    MetricsRegistry::instance().retireShard(&shard);
+}
+
+std::atomic<unsigned long long>* MetricsRegistry::getLocalSlots() {
+    thread_local ShardHandle handle;
+    return handle.shard.values;
+}
+
+Counter MetricsRegistry::counter(const std::string &name) {
+    return Counter(registerMetric(name, MetricType::Counter, 1));
+}
+
+Counter MetricsRegistry::gauge(const std::string &name) {
+    return Counter(registerMetric(name, MetricType::Gauge, 1));
+}
+
+Histogram MetricsRegistry::histogram(const std::string &name) {
+    return Histogram(registerMetric(name, MetricType::Histogram, HISTOGRAM_SLOTS));
+}
+
+std::shared_ptr<ConnectionMetrics> MetricsRegistry::createConnectionMetrics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    connections_.erase(std::remove_if(connections_.begin(), connections_.end(), [](const std::weak_ptr<ConnectionMetrics> &c) { return c.expired(); }),
+                       connections_.end());
+
+    auto metrics = std::make_shared<ConnectionMetrics>(nextConnectionId_++);
+    connections_.push_back(metrics);
+    return metrics;
+}
+
+unsigned int MetricsRegistry::registerMetric(const std::string &name, MetricType type, unsigned int slotCount) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for(auto &metric : metrics_) {
+        if(metric.name == name) {
+            return metric.slot;
+        }
+    }
+
+    if(nextSlot_ + slotCount > MAX_METRIC_SLOTS) {
+        throw std::runtime_error(METRIC_SLOTS_EXHAUSTED_ERROR);
+    }
+
+    Metric metric;
+    metric.name = name;
+    metric.type = type;
+    metric.slot = nextSlot_;
+    metrics_.push_back(metric);
+
+    nextSlot_ += slotCount;
+    return metric.slot;
+}
+
+void MetricsRegistry::retireShard(Shard *shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // values of finished threads are kept
+    for(unsigned int i = 0; i < MAX_METRIC_SLOTS; ++i) {
+        retired_[i] += shard->values[i].load(std::memory_order_relaxed);
+    }
+    shards_.erase(std::remove(shards_.begin(), shards_.end(), shard), shards_.end());
+}
+
+std::vector<unsigned long long> MetricsRegistry::aggregate() {
+    std::vector<unsigned long long> totals = retired_;
+    for(auto shard : shards_) {
+        for(unsigned int i = 0; i < nextSlot_; ++i) {
+            totals[i] += shard->values[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    return totals;
+}
+
+std::string MetricsRegistry::exportText() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto totals = aggregate();
+
+    std::stringstream ss;
+    for(auto &metric : metrics_) {
+        switch(metric.type) {
+        case MetricType::Counter:
+            ss << "# TYPE " << metric.name << " counter\n" << metric.name << " " << totals[metric.slot] << "\n";
+            break;
+        case MetricType::Gauge:
+            ss << "# TYPE " << metric.name << " gauge\n" << metric.name << " " << static_cast<long long>(totals[metric.slot]) << "\n";
+            break;
+        case MetricType::Histogram: {
+            ss << "# TYPE " << metric.name << " histogram\n";
+            unsigned long long cumulative = 0;
+            for(unsigned int i = 0; i < HISTOGRAM_BUCKETS - 1; ++i) {
+                cumulative += totals[metric.slot + i];
+                ss << metric.name << "_bucket{le=\"" << (1ULL << i) << "\"} " << cumulative << "\n";
+            }
+            ss << metric.name << "_bucket{le=\"+Inf\"} " << totals[metric.slot + HISTOGRAM_BUCKETS + 1] << "\n";
+            ss << metric.name << "_sum " << totals[metric.slot + HISTOGRAM_BUCKETS] << "\n";
+            ss << metric.name << "_count " << totals[metric.slot + HISTOGRAM_BUCKETS + 1] << "\n";
+            break;
+        }
+        }
+    }
+
+    std::vector<std::shared_ptr<ConnectionMetrics>> connections;
+    for(auto &connection : connections_) {
+        if(auto metrics = connection.lock()) {
+            connections.push_back(metrics);
+        }
+    }
+
+    auto writeConnections = [&ss, &connections](const std::string &name, const std::string &type,
+                                                const std::function<long long(const ConnectionMetrics&)> &value) {
+        ss << "# TYPE " << name << " " << type << "\n";
+        for(auto &connection : connections) {
+            ss << name << "{connection=\"" << connection->id << "\",peer=\"" << connection->getPeer() << "\"} " << value(*connection) << "\n";
+        }
+    };
+    writeConnections("qtchat_connection_received_bytes_total", "counter", [](const ConnectionMetrics &c) { return c.bytesReceived.load(); });
+    writeConnections("qtchat_connection_sent_bytes_total", "counter", [](const ConnectionMetrics &c) { return c.bytesSent.load(); });
+    writeConnections("qtchat_connection_received_frames_total", "counter", [](const ConnectionMetrics &c) { return c.framesReceived.load(); });
+    writeConnections("qtchat_connection_sent_frames_total", "counter", [](const ConnectionMetrics &c) { return c.framesSent.load(); });
+    writeConnections("qtchat_connection_receive_buffer_bytes", "gauge", [](const ConnectionMetrics &c) { return c.receiveBufferBytes.load(); });
+    writeConnections("qtchat_connection_send_buffer_bytes", "gauge", [](const ConnectionMetrics &c) { return c.sendBufferBytes.load(); });
+
+    return ss.str();
+}
+
+Counter Metrics::counter(const std::string &name) {
+    return MetricsRegistry::instance().counter(name);
+}
+
+Counter Metrics::gauge(const std::string &name) {
+    return MetricsRegistry::instance().gauge(name);
+}
+
+Histogram Metrics::histogram(const std::string &name) {
+    return MetricsRegistry::instance().histogram(name);
+}
+
+MetricsExporter::MetricsExporter(QObject *parent) :
+    QObject(parent),
+    server_(new QLocalServer(this)),
+    dumpTimer_(new QTimer(this))
+{
+    QObject::connect(server_, &QLocalServer::newConnection, this, &MetricsExporter::handleNewConnection);
+    QObject::connect(dumpTimer_, &QTimer::timeout, this, &MetricsExporter::dump);
+}
+
+bool MetricsExporter::listen(const std::string &socketName) {
+    server_->close();
+
+    // a socket left behind by a crashed process would make listening fail
+    QLocalServer::removeServer(QString::fromStdString(socketName));
+    return server_->listen(QString::fromStdString(socketName));
+}
+
+void MetricsExporter::startDump(const std::string &path, int interval) {
+    dumpPath_ = path;
+    dumpTimer_->start(interval);
+}
+
+void MetricsExporter::stop() {
+    server_->close();
+    dumpTimer_->stop();
+}
+
+void MetricsExporter::handleNewConnection() {
+    auto socket = server_->nextPendingConnection();
+    if(socket == nullptr) {
+        return;
+    }
+
+    auto text = MetricsRegistry::instance().exportText();
+    QObject::connect(socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater);
+    socket->write(text.c_str(), text.length());
+    socket->disconnectFromServer();
+}
+
+void MetricsExporter::dump() {
+    auto text = MetricsRegistry::instance().exportText();
+
+    // written next to the target first, so readers never see a partial dump
+    auto temporaryPath = dumpPath_ + ".tmp";
+    std::ofstream fileStream(temporaryPath, std::ios::trunc);
+    fileStream << text;
+    fileStream.close();
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, dumpPath_, error);
+}
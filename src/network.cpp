@@ -1,71 +1,413 @@
 #include "network.h"
+#include "tracing.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
 #include <sstream>
 
 #include <QByteArray>
 
-TcpConnection::TcpConnection(QTcpSocket *socket) : socket_(socket) {
+const char HEARTBEAT_TYPE = 'H';
+const char HEARTBEAT_PING = 'i';
+const char HEARTBEAT_PONG = 'o';
+const int HEARTBEAT_TIMESTAMP_LENGTH = 16;
+const size_t CLOCK_SAMPLE_WINDOW = 16;
+const char SLICE_TYPE = 'L';
+const char LAST_SLICE = '0';
+const char MORE_SLICES = '1';
+const long long SLICE_LENGTH = 0x4000; // payload of one slice frame
+const long long SLICE_HEADER_LENGTH = 10;
+const long long MAX_FRAME_LENGTH = 0xFFFFF;
+const long long SEND_WATERMARK = 0x4000; // frames stay queued while the socket buffer holds more than this
+
+const Counter BYTES_RECEIVED = Metrics::counter("qtchat_received_bytes_total");
+const Counter BYTES_SENT = Metrics::counter("qtchat_sent_bytes_total");
+const Counter FRAMES_RECEIVED = Metrics::counter("qtchat_received_frames_total");
+const Counter FRAMES_SENT = Metrics::counter("qtchat_sent_frames_total");
+const Counter INVALID_FRAMES = Metrics::counter("qtchat_invalid_frames_total");
+const Counter BUFFERED_BYTES = Metrics::gauge("qtchat_buffered_bytes");
+const Counter OPEN_CONNECTIONS = Metrics::gauge("qtchat_connections");
+
+namespace {
+    FramePriority getFramePriority(const QByteArray &frame) {
+        if(frame.size() < 8) {
+            return FramePriority::Interactive;
+        }
+
+        switch(frame.constData()[7]) {
+        case 'K': // key
+        case 'U': // user info
+        case 'S': // session end
+        case 'T': // resumption ticket
+        case 'R': // resumption
+        case 'H': // heartbeat
+        case 'A': // acknowledgement
+        case 'C': // continuation
+        case 'P': // file acknowledgement
+            return FramePriority::Control;
+        case 'B': // file chunk
+        case 'Z': // history record
+            return FramePriority::Bulk;
+        default:
+            return FramePriority::Interactive;
+        }
+    }
+}
+
+bool FrameParser::next(std::string &frame) {
+    TraceSpan span("frame_parse", "network");
+
+    if(buffer_.length() < 5) { // first 5 bytes are message length
+        return false;
+    }
+
+    auto messageLength = getMessageSize(buffer_);
+    if(messageLength < 8) { // length includes the 8 byte header
+        throw std::runtime_error("Invalid message length.");
+    }
+    if(buffer_.length() < messageLength) {
+        return false;
+    }
+
+    frame = buffer_.substr(0, messageLength);
+    buffer_ = buffer_.substr(messageLength);
+    return true;
+}
+
+void FrameParser::clear() {
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+}
+
+unsigned int FrameParser::getMessageSize(const std::string &message) const {
+    auto hexLength = message.substr(0, 5);
+    unsigned long length = std::stoul(hexLength, 0, 16);
+
+    // no range checks required while length can be represented in 5 hex characters
+    return length;
+}
+
+TcpConnection::TcpConnection(QTcpSocket *socket) :
+    socket_(socket),
+    heartbeatTimer_(new QTimer(this)),
+    metrics_(MetricsRegistry::instance().createConnectionMetrics())
+{
+    OPEN_CONNECTIONS.add();
+
     socket->setParent(this);
     QObject::connect(socket_, &QTcpSocket::connected, this, &TcpConnection::connected);
+    QObject::connect(socket_, &QTcpSocket::connected, this, &TcpConnection::handleSocketConnected);
     QObject::connect(socket_, &QTcpSocket::disconnected, this, &TcpConnection::disconnected);
     QObject::connect(socket_, &QTcpSocket::errorOccurred, this, &TcpConnection::disconnected);
     QObject::connect(socket_, &QTcpSocket::readyRead, this, &TcpConnection::handleSocketReadyRead);
+    QObject::connect(socket_, &QTcpSocket::bytesWritten, this, &TcpConnection::handleSocketBytesWritten);
+    QObject::connect(heartbeatTimer_, &QTimer::timeout, this, &TcpConnection::handleHeartbeatTimeout);
+
+    if(isConnected()) {
+        handleSocketConnected();
+    }
+}
+
+TcpConnection::~TcpConnection() {
+    OPEN_CONNECTIONS.add(-1);
+    BUFFERED_BYTES.add(-(metrics_->receiveBufferBytes + metrics_->sendBufferBytes));
 }
 
-void TcpConnection::send(const std::string &data) const {
+void TcpConnection::send(const std::string &data) {
     if(socket_ == nullptr) {
         throw std::runtime_error("Invalid connection.");
     }
 
-    socket_->write(QByteArray(data.c_str(), data.length()));
+    sendFrame(QByteArray(data.c_str(), data.length()));
+}
+
+void TcpConnection::sendFrame(const QByteArray &frame) {
+    if(socket_ == nullptr) {
+        throw std::runtime_error("Invalid connection.");
+    }
+
+    sendQueues_[static_cast<size_t>(getFramePriority(frame))].push_back(frame);
+    queuedBytes_ += frame.size();
+    writeQueuedFrames();
+}
+
+void TcpConnection::writeQueuedFrames() {
+    // the socket only gets a little ahead of the network, anything beyond waits here where higher priorities can pass
+    while(socket_->bytesToWrite() < SEND_WATERMARK) {
+        auto queue = std::find_if(sendQueues_.begin(), sendQueues_.end(), [](const std::deque<QByteArray> &q) { return !q.empty(); });
+        if(queue == sendQueues_.end()) {
+            break;
+        }
+        writeNextSlice(queue - sendQueues_.begin());
+    }
+
+    updateBufferedBytes();
+}
+
+void TcpConnection::writeNextSlice(size_t priority) {
+    auto &queue = sendQueues_[priority];
+    auto &sent = sentSliceBytes_[priority];
+    auto &frame = queue.front();
+
+    long long written;
+    if(sent == 0 && frame.size() <= SLICE_LENGTH) {
+        socket_->write(frame);
+        written = frame.size();
+        sent = frame.size();
+    }
+    else {
+        // [5B length] QC L [1B priority] [1B more slices follow] [slice of the frame]
+        auto length = std::min<long long>(SLICE_LENGTH, frame.size() - sent);
+        std::stringstream ss;
+        ss << Utils::convertToHex(SLICE_HEADER_LENGTH + length, 5) << "QC" << SLICE_TYPE << priority
+           << (sent + length < frame.size() ? MORE_SLICES : LAST_SLICE);
+        auto header = ss.str();
+        socket_->write(header.c_str(), header.length());
+        socket_->write(frame.constData() + sent, length);
+        written = SLICE_HEADER_LENGTH + length;
+        sent += length;
+    }
+
+    BYTES_SENT.add(written);
+    metrics_->bytesSent += written;
+
+    if(sent == frame.size()) {
+        queuedBytes_ -= frame.size();
+        sent = 0;
+        queue.pop_front();
+
+        FRAMES_SENT.add();
+        ++metrics_->framesSent;
+    }
+}
+
+void TcpConnection::clearQueues() {
+    for(auto &queue : sendQueues_) {
+        queue.clear();
+    }
+    sentSliceBytes_.fill(0);
+    queuedBytes_ = 0;
+}
+
+void TcpConnection::updateBufferedBytes() const {
+    long long receiveBuffer = frameParser_.getBufferedLength();
+    for(auto &slices : receivedSlices_) {
+        receiveBuffer += slices.length();
+    }
+    long long sendBuffer = socket_->bytesToWrite() + queuedBytes_;
+
+    BUFFERED_BYTES.add(receiveBuffer - metrics_->receiveBufferBytes + sendBuffer - metrics_->sendBufferBytes);
+    metrics_->receiveBufferBytes = receiveBuffer;
+    metrics_->sendBufferBytes = sendBuffer;
 }
 
 void TcpConnection::close() {
+    heartbeatTimer_->stop();
     if(socket_->isOpen()) {
+        // the session end is queued last, the chat messages queued before it have to arrive first;
+        // remaining file chunks are useless once the session is over
+        for(auto priority : {FramePriority::Interactive, FramePriority::Control}) {
+            while(!sendQueues_[static_cast<size_t>(priority)].empty()) {
+                writeNextSlice(static_cast<size_t>(priority));
+            }
+        }
         socket_->close();
     }
+    clearQueues();
+    updateBufferedBytes();
 }
 
 bool TcpConnection::isConnected() {
     return socket_->state() == QTcpSocket::SocketState::ConnectedState;
 }
 
+void TcpConnection::setHeartbeat(int interval, int timeout) {
+    heartbeatInterval_ = interval;
+    heartbeatTimeout_ = timeout;
+
+    if(heartbeatInterval_ <= 0) {
+        heartbeatTimer_->stop();
+    }
+    else if(isConnected()) {
+        heartbeatTimer_->start(heartbeatInterval_);
+    }
+}
+
+void TcpConnection::handleSocketConnected() {
+    lastReceived_ = std::chrono::steady_clock::now();
+    metrics_->setPeer(socket_->peerAddress().toString().toStdString() + ":" + std::to_string(socket_->peerPort()));
+    if(heartbeatInterval_ > 0) {
+        heartbeatTimer_->start(heartbeatInterval_);
+    }
+}
+
 void TcpConnection::handleSocketReadyRead() {
-    auto data = socket_->readAll();
-    messageBuffer_ += data.toStdString();
+    lastReceived_ = std::chrono::steady_clock::now();
+
+    QByteArray data;
+    {
+        TraceSpan span("socket_read", "network");
+        data = socket_->readAll();
+        frameParser_.append(data.toStdString());
+    }
+
+    BYTES_RECEIVED.add(data.size());
+    metrics_->bytesReceived += data.size();
 
     try {
         tryParseCurrentMessage();
+        updateBufferedBytes();
     }
     catch (...) {
+        INVALID_FRAMES.add();
         close();
         emit disconnected();
     }
 }
 
+void TcpConnection::handleSocketBytesWritten() {
+    writeQueuedFrames();
+    emit bytesWritten();
+}
+
 void TcpConnection::tryParseCurrentMessage() {
     // Loop until there are no complete messages left in buffer
-    while(true) {
-        if(messageBuffer_.length() < 5) { // first 5 bytes are message length
-            return;
+    std::string resultMessage;
+    while(frameParser_.next(resultMessage)) {
+        if(resultMessage[7] == SLICE_TYPE) {
+            processSlice(resultMessage);
+            continue;
         }
 
-        auto messageLength = getMessageSize(messageBuffer_);
-        if(messageBuffer_.length() < messageLength) {
-            return;
+        processFrame(resultMessage);
+    }
+}
+
+void TcpConnection::processFrame(const std::string &frame) {
+    FRAMES_RECEIVED.add();
+    ++metrics_->framesReceived;
+
+    if(frame[7] == HEARTBEAT_TYPE) {
+        processHeartbeat(frame);
+        return;
+    }
+
+    emit messageReceived(frame);
+}
+
+void TcpConnection::processSlice(const std::string &slice) {
+    // every priority is sliced by the sender in order, so one partial frame per priority has to be kept
+    if(slice.length() < SLICE_HEADER_LENGTH || slice[8] < '0' || slice[8] >= '0' + static_cast<char>(FRAME_PRIORITY_COUNT)) {
+        throw std::runtime_error("Invalid slice header.");
+    }
+
+    auto &frame = receivedSlices_[slice[8] - '0'];
+    frame.append(slice, SLICE_HEADER_LENGTH, std::string::npos);
+    if(frame.length() > MAX_FRAME_LENGTH) {
+        throw std::runtime_error("Invalid sliced frame length.");
+    }
+    if(slice[9] == MORE_SLICES) {
+        return;
+    }
+
+    std::string complete;
+    complete.swap(frame);
+
+    FrameParser parser;
+    parser.append(complete);
+    std::string parsed;
+    if(!parser.next(parsed) || parsed.length() != complete.length() || parsed[7] == SLICE_TYPE) {
+        throw std::runtime_error("Invalid sliced frame length.");
+    }
+
+    processFrame(parsed);
+}
+
+void TcpConnection::handleHeartbeatTimeout() {
+    auto silence = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastReceived_).count();
+    if(silence > heartbeatTimeout_) {
+        handleDeadPeer();
+        return;
+    }
+
+    sendHeartbeat(HEARTBEAT_PING, Utils::convertToHex(Utils::getSteadyTimestamp(), HEARTBEAT_TIMESTAMP_LENGTH));
+}
+
+void TcpConnection::sendHeartbeat(char kind, const std::string &timestamp) {
+    std::stringstream ss;
+    ss << Utils::convertToHex(8 + 1 + timestamp.length(), 5) << "QC" << HEARTBEAT_TYPE << kind << timestamp;
+    auto frame = ss.str();
+    sendFrame(QByteArray(frame.c_str(), frame.length()));
+}
+
+void TcpConnection::processHeartbeat(const std::string &message) {
+    // [5B length] QC H [1B kind] [16B hex timestamp of the ping's sender] [16B hex timestamp of the pong's sender]
+    if(message.length() < 9 + HEARTBEAT_TIMESTAMP_LENGTH) {
+        return;
+    }
+
+    auto timestamp = message.substr(9, HEARTBEAT_TIMESTAMP_LENGTH);
+    if(message[8] == HEARTBEAT_PING) {
+        sendHeartbeat(HEARTBEAT_PONG, timestamp + Utils::convertToHex(Utils::getSteadyTimestamp(), HEARTBEAT_TIMESTAMP_LENGTH));
+    }
+    else if(message[8] == HEARTBEAT_PONG) {
+        auto now = Utils::getSteadyTimestamp();
+        auto sentAt = std::stoll(timestamp, 0, 16);
+        updateRtt((now - sentAt) / 1000.0);
+
+        // peers which do not stamp their pongs only provide the round trip time
+        if(message.length() >= 9 + 2 * HEARTBEAT_TIMESTAMP_LENGTH) {
+            auto answeredAt = std::stoll(message.substr(9 + HEARTBEAT_TIMESTAMP_LENGTH, HEARTBEAT_TIMESTAMP_LENGTH), 0, 16);
+            updateClockOffset(now - sentAt, answeredAt - (sentAt + (now - sentAt) / 2));
         }
+    }
+}
 
-        auto resultMessage = messageBuffer_.substr(0, messageLength);
-        messageBuffer_ = messageBuffer_.substr(messageLength);
-        emit messageReceived(resultMessage);
+void TcpConnection::updateRtt(double sample) {
+    // RFC 6298 smoothing
+    if(smoothedRtt_ == 0) {
+        smoothedRtt_ = sample;
+        rttVariation_ = sample / 2;
+        return;
     }
+
+    rttVariation_ = 0.75 * rttVariation_ + 0.25 * std::abs(smoothedRtt_ - sample);
+    smoothedRtt_ = 0.875 * smoothedRtt_ + 0.125 * sample;
 }
 
-unsigned int TcpConnection::getMessageSize(const std::string &message) const {
-    auto hexLength = message.substr(0, 5);
-    unsigned long length = std::stoul(hexLength, 0, 16);
+void TcpConnection::updateClockOffset(long long roundTrip, long long offset) {
+    clockSamples_.push_back({roundTrip, offset});
+    if(clockSamples_.size() > CLOCK_SAMPLE_WINDOW) {
+        clockSamples_.pop_front();
+    }
 
-    // no range checks required while length can be represented in 5 hex characters
-    return length;
+    // the estimate's error is at most half of the round trip time, so the fastest recent exchange is the most accurate
+    auto best = clockSamples_.front();
+    for(auto &sample : clockSamples_) {
+        if(sample.roundTrip < best.roundTrip) {
+            best = sample;
+        }
+    }
+    clockOffset_ = best.offset;
+}
+
+void TcpConnection::handleDeadPeer() {
+    heartbeatTimer_->stop();
+    frameParser_.clear();
+    for(auto &slices : receivedSlices_) {
+        slices.clear();
+    }
+    clearQueues();
+    updateBufferedBytes();
+
+    // the peer will not acknowledge a graceful close, drop the socket and its buffers right away. The socket
+    // reports the disconnect itself, which is forwarded as disconnected()
+    socket_->abort();
+}
+
+void Server::setHeartbeat(int interval, int timeout) {
+    heartbeatInterval_ = interval;
+    heartbeatTimeout_ = timeout;
 }
 
 TcpServer::TcpServer() {
@@ -77,10 +419,10 @@ TcpServer::~TcpServer() {
     delete server_;
 }
 
-void TcpServer::listen(uint port) {
+void TcpServer::listen(uint port, const QHostAddress &address) {
     stopListening();
 
-    server_->listen(QHostAddress::Any, port);
+    server_->listen(address, port);
     QObject::connect(server_, &QTcpServer::newConnection, this, &TcpServer::processNewConnection);
 }
 
@@ -98,6 +440,7 @@ void TcpServer::processNewConnection() {
     }
 
     auto connection = std::make_shared<TcpConnection>(socketPtr);
+    connection->setHeartbeat(heartbeatInterval_, heartbeatTimeout_);
     emit connectionReceived(connection);
 }
 
@@ -106,5 +449,6 @@ std::shared_ptr<Connection> TcpServer::connect(const std::string &host, uint por
     socket->connectToHost(QString::fromUtf8(host), port);
 
     auto connection = std::make_shared<TcpConnection>(socket);
+    connection->setHeartbeat(heartbeatInterval_, heartbeatTimeout_);
     return connection;
 }
@@ -0,0 +1,223 @@
+#include "outbox.h"
+#include "utils.h"
+
+#include <filesystem>
+
+const std::string OUTBOX_OPEN_ERROR = "Could not open the outbox.";
+const unsigned int OUTBOX_CURSOR_LENGTH = 16;
+const unsigned int FRAME_LENGTH_LENGTH = 5;
+const unsigned int FRAME_HEADER_LENGTH = FRAME_LENGTH_LENGTH + 3;
+
+const Counter OUTBOX_QUEUED = Metrics::counter("qtchat_outbox_queued_total");
+const Counter OUTBOX_SENT = Metrics::counter("qtchat_outbox_sent_total");
+
+void Outbox::open() {
+    Utils::createPath(path_);
+    std::ofstream(path_, std::ios::binary | std::ios::app);
+    std::ofstream(cursorPath_, std::ios::binary | std::ios::app);
+
+    std::error_code error;
+    auto size = std::filesystem::file_size(path_, error);
+    if(error) {
+        throw std::runtime_error(OUTBOX_OPEN_ERROR);
+    }
+
+    reader_.open(path_, std::ios::binary);
+    cursor_.open(cursorPath_, std::ios::binary | std::ios::in | std::ios::out);
+    if(!reader_.is_open() || !cursor_.is_open()) {
+        throw std::runtime_error(OUTBOX_OPEN_ERROR);
+    }
+
+    std::string header(OUTBOX_CURSOR_LENGTH, '\0');
+    delivered_ = 0;
+    if(cursor_.read(&header[0], OUTBOX_CURSOR_LENGTH)) {
+        try {
+            delivered_ = std::stoull(header, 0, 16);
+        }
+        catch (const std::logic_error&) {
+            delivered_ = 0;
+        }
+    }
+    cursor_.clear();
+    if(delivered_ > size) {
+        delivered_ = 0;
+    }
+
+    for(auto from : {delivered_, 0ULL}) {
+        length_ = from;
+        reader_.clear();
+        reader_.seekg(length_);
+        std::string frame;
+        while(readFrame(frame)) {
+            length_ += frame.length();
+        }
+
+        // no frame where the cursor points means it is damaged, everything is sent again
+        if(length_ > from || length_ == size || from == 0) {
+            break;
+        }
+        delivered_ = 0;
+    }
+
+    // later appends would be unreadable behind a torn frame
+    if(size > length_) {
+        std::filesystem::resize_file(path_, length_, error);
+    }
+    sent_ = delivered_;
+    writeCursor();
+
+    writer_.open(path_, std::ios::binary | std::ios::app);
+    if(!writer_.is_open()) {
+        throw std::runtime_error(OUTBOX_OPEN_ERROR);
+    }
+}
+
+void Outbox::append(Message *message) {
+    buffer_ += converter_.convertFromMessage(message);
+    OUTBOX_QUEUED.add();
+
+    if(buffer_.length() >= OUTBOX_WRITE_BATCH) {
+        flush();
+    }
+}
+
+void Outbox::flush() {
+    if(buffer_.empty() || !writer_.is_open()) {
+        return;
+    }
+
+    writer_.write(buffer_.data(), buffer_.length());
+    writer_.flush();
+    length_ += buffer_.length();
+    buffer_.clear();
+}
+
+std::vector<std::pair<std::shared_ptr<Message>, unsigned long long>> Outbox::takeUnsent(size_t count) {
+    flush();
+
+    std::vector<std::pair<std::shared_ptr<Message>, unsigned long long>> messages;
+    reader_.clear();
+    reader_.seekg(sent_);
+    std::string frame;
+    while(messages.size() < count && sent_ < length_ && readFrame(frame)) {
+        sent_ += frame.length();
+        try {
+            messages.push_back(std::make_pair(converter_.convertToMessage(frame), sent_));
+        }
+        catch (const std::runtime_error&) {
+            // an undecodable frame is skipped, it would be rejected by the peer anyway
+        }
+    }
+
+    return messages;
+}
+
+void Outbox::setDelivered(unsigned long long offset) {
+    if(offset <= delivered_ || offset > length_) {
+        return;
+    }
+
+    delivered_ = offset;
+    if(isEmpty()) {
+        // everything was delivered, the file starts over instead of growing forever
+        writer_.close();
+        std::error_code error;
+        std::filesystem::resize_file(path_, 0, error);
+        writer_.open(path_, std::ios::binary | std::ios::app);
+        length_ = sent_ = delivered_ = 0;
+    }
+    writeCursor();
+}
+
+bool Outbox::readFrame(std::string &frame) {
+    std::string length(FRAME_LENGTH_LENGTH, '\0');
+    if(!reader_.read(&length[0], FRAME_LENGTH_LENGTH)) {
+        return false;
+    }
+
+    size_t frameLength;
+    try {
+        frameLength = std::stoul(length, 0, 16);
+    }
+    catch (const std::logic_error&) {
+        return false;
+    }
+    if(frameLength < FRAME_HEADER_LENGTH) {
+        return false;
+    }
+
+    frame = length;
+    frame.resize(frameLength);
+    if(!reader_.read(&frame[FRAME_LENGTH_LENGTH], frameLength - FRAME_LENGTH_LENGTH)) {
+        return false;
+    }
+
+    return frame.compare(FRAME_LENGTH_LENGTH, 2, "QC") == 0;
+}
+
+void Outbox::writeCursor() {
+    cursor_.seekp(0);
+    cursor_ << Utils::convertToHex(delivered_, OUTBOX_CURSOR_LENGTH);
+    cursor_.flush();
+}
+
+OutboxSender::OutboxSender(std::shared_ptr<ChatSession> session, std::shared_ptr<Outbox> outbox, QObject *parent)
+    : QObject(parent),
+      session_(session),
+      outbox_(outbox),
+      flushTimer_(new QTimer(this))
+{
+    // appends made in one pass of the event loop are written together
+    flushTimer_->setSingleShot(true);
+    flushTimer_->setInterval(0);
+
+    QObject::connect(flushTimer_, &QTimer::timeout, this, &OutboxSender::sendQueued);
+    QObject::connect(session.get(), &ChatSession::bytesWritten, this, &OutboxSender::sendQueued);
+    QObject::connect(session.get(), &ChatSession::connectionRestored, this, &OutboxSender::sendQueued);
+    QObject::connect(session.get(), &ChatSession::messagesAcknowledged, this, &OutboxSender::handleAcknowledgement);
+
+    // messages sent in an earlier session but never acknowledged are sent again
+    outbox_->rewind();
+    sendQueued();
+}
+
+void OutboxSender::send(std::shared_ptr<Message> message) {
+    if(session_->isConnected() && !outbox_->hasUnsent()) {
+        session_->sendMessage(message);
+        return;
+    }
+
+    outbox_->append(message.get());
+    flushTimer_->start();
+}
+
+void OutboxSender::sendQueued() {
+    outbox_->flush();
+
+    while(session_->isConnected() && outbox_->hasUnsent() && inFlight_.size() < OUTBOX_MAX_IN_FLIGHT
+          && session_->getPendingBytes() < OUTBOX_SEND_WATERMARK) {
+        auto messages = outbox_->takeUnsent(std::min(OUTBOX_SEND_BATCH, OUTBOX_MAX_IN_FLIGHT - inFlight_.size()));
+        if(messages.empty()) {
+            break;
+        }
+        for(auto &entry : messages) {
+            session_->sendMessage(entry.first);
+            inFlight_.push_back(std::make_pair(session_->getLastSequence(), entry.second));
+        }
+        OUTBOX_SENT.add(messages.size());
+    }
+}
+
+void OutboxSender::handleAcknowledgement() {
+    auto acknowledged = session_->getAcknowledgedSequence();
+    unsigned long long delivered = 0;
+    while(!inFlight_.empty() && inFlight_.front().first <= acknowledged) {
+        delivered = inFlight_.front().second;
+        inFlight_.pop_front();
+    }
+
+    if(delivered > 0) {
+        outbox_->setDelivered(delivered);
+    }
+    sendQueued();
+}
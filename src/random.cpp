@@ -0,0 +1,85 @@
+#include "random.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <lib/cryptopp/osrng.h>
+
+const size_t SECURE_BUFFER_SIZE = 4096;
+const size_t MAX_BUFFERED_REQUEST = SECURE_BUFFER_SIZE / 4; // larger requests bypass the buffer
+
+namespace {
+    struct SecureGenerator {
+        CryptoPP::AutoSeededRandomPool pool;
+        CryptoPP::byte buffer[SECURE_BUFFER_SIZE];
+        size_t position = SECURE_BUFFER_SIZE;
+    };
+
+    SecureGenerator& getSecureGenerator() {
+        thread_local SecureGenerator generator;
+        return generator;
+    }
+
+    unsigned long long rotateLeft(unsigned long long value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    struct FastGenerator {
+        FastGenerator() {
+            // an all zero state would only ever produce zeros
+            do {
+                getSecureGenerator().pool.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(state), sizeof(state));
+            } while(state[0] == 0 && state[1] == 0 && state[2] == 0 && state[3] == 0);
+        }
+
+        unsigned long long next() {
+            auto result = rotateLeft(state[1] * 5, 7) * 9;
+            auto shifted = state[1] << 17;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= shifted;
+            state[3] = rotateLeft(state[3], 45);
+
+            return result;
+        }
+
+        unsigned long long state[4];
+    };
+}
+
+CryptoPP::RandomNumberGenerator& Random::secure() {
+    return getSecureGenerator().pool;
+}
+
+std::string Random::generateBytes(size_t length) {
+    auto &generator = getSecureGenerator();
+    std::string result(length, '\0');
+    if(length == 0) {
+        return result;
+    }
+
+    if(length > MAX_BUFFERED_REQUEST) {
+        generator.pool.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(&result[0]), length);
+        return result;
+    }
+
+    if(generator.position + length > SECURE_BUFFER_SIZE) {
+        generator.pool.GenerateBlock(generator.buffer, SECURE_BUFFER_SIZE);
+        generator.position = 0;
+    }
+
+    // handed out bytes are wiped, so nothing can be returned twice or recovered later
+    std::memcpy(&result[0], generator.buffer + generator.position, length);
+    std::fill(generator.buffer + generator.position, generator.buffer + generator.position + length, 0);
+    generator.position += length;
+
+    return result;
+}
+
+unsigned long long Random::fast() {
+    thread_local FastGenerator generator;
+    return generator.next();
+}
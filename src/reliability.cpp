@@ -0,0 +1,145 @@
+#include "reliability.h"
+#include "utils.h"
+
+#include <sstream>
+
+const char ACKNOWLEDGEMENT_TYPE = 'A';
+const char CONTINUATION_TYPE = 'C';
+const unsigned int SEQUENCE_HEADER_LENGTH = 16;
+const std::string INVALID_SEQUENCE_HEADER_ERROR = "Invalid sequence header received.";
+
+bool ReliableDelivery::isSequenced(char type) {
+    return type == 'N' || type == 'E' || type == 'D' || type == 'n' || type == 'e' || type == 'd' || type == 'I' || type == 'F' || type == 'X';
+}
+
+unsigned int ReliableDelivery::track(std::shared_ptr<Message> message) {
+    Entry entry;
+    entry.sequence = nextSequence_++;
+    entry.message = message;
+    unacknowledged_.push_back(entry);
+
+    return entry.sequence;
+}
+
+bool ReliableDelivery::markSent(unsigned int sequence) {
+    if(sequence != lastSent_ + 1 || !isInWindow(sequence)) {
+        return false;
+    }
+
+    lastSent_ = sequence;
+    return true;
+}
+
+std::vector<std::pair<unsigned int, std::shared_ptr<Message>>> ReliableDelivery::takeSendable() {
+    std::vector<std::pair<unsigned int, std::shared_ptr<Message>>> result;
+    for(auto &entry : unacknowledged_) {
+        if(entry.sequence <= lastSent_) {
+            continue;
+        }
+        if(!isInWindow(entry.sequence)) {
+            break;
+        }
+        result.push_back(std::make_pair(entry.sequence, entry.message));
+        lastSent_ = entry.sequence;
+    }
+
+    return result;
+}
+
+void ReliableDelivery::restartSending() {
+    lastSent_ = unacknowledged_.empty() ? nextSequence_ - 1 : unacknowledged_.front().sequence - 1;
+}
+
+std::string ReliableDelivery::frame(const std::string &encodedMessage, unsigned int sequence) {
+    acknowledgementPending_ = false;
+
+    std::stringstream ss;
+    ss << Utils::convertToHex(encodedMessage.length() + SEQUENCE_HEADER_LENGTH, 5) << encodedMessage.substr(5, 3)
+       << Utils::convertToHex(sequence, 8) << Utils::convertToHex(lastReceived_, 8) << encodedMessage.substr(8);
+    return ss.str();
+}
+
+std::string ReliableDelivery::frameUnsequenced(const std::string &encodedMessage) {
+    std::stringstream ss;
+    ss << Utils::convertToHex(encodedMessage.length() + SEQUENCE_HEADER_LENGTH, 5) << encodedMessage.substr(5, 3)
+       << Utils::convertToHex(0, 8) << Utils::convertToHex(0, 8) << encodedMessage.substr(8);
+    return ss.str();
+}
+
+std::string ReliableDelivery::frameAcknowledgement() {
+    return frameControl(ACKNOWLEDGEMENT_TYPE);
+}
+
+std::string ReliableDelivery::frameContinuation() {
+    return frameControl(CONTINUATION_TYPE);
+}
+
+std::string ReliableDelivery::frameControl(char type) {
+    std::stringstream ss;
+    ss << Utils::convertToHex(8, 5) << "QC" << type;
+    return frame(ss.str(), 0);
+}
+
+bool ReliableDelivery::receive(const std::string &frame, std::string &encodedMessage) {
+    if(frame.length() < 8 + SEQUENCE_HEADER_LENGTH) {
+        throw std::runtime_error(INVALID_SEQUENCE_HEADER_ERROR);
+    }
+
+    unsigned int sequence;
+    unsigned int acknowledged;
+    try {
+        sequence = std::stoul(frame.substr(8, 8), 0, 16);
+        acknowledged = std::stoul(frame.substr(16, 8), 0, 16);
+    }
+    catch (const std::logic_error&) {
+        throw std::runtime_error(INVALID_SEQUENCE_HEADER_ERROR);
+    }
+
+    if(continuationExpected_) {
+        continuationExpected_ = false;
+        if(frame[7] != CONTINUATION_TYPE) {
+            // the other side did not continue the session, its sequence numbers start over
+            lastReceived_ = 0;
+        }
+    }
+
+    // acknowledgements are cumulative
+    if(acknowledged > acknowledged_) {
+        acknowledged_ = acknowledged;
+    }
+    while(!unacknowledged_.empty() && unacknowledged_.front().sequence <= acknowledged) {
+        unacknowledged_.pop_front();
+    }
+
+    if(sequence == 0) {
+        if(frame[7] == ACKNOWLEDGEMENT_TYPE || frame[7] == CONTINUATION_TYPE) {
+            return false;
+        }
+    }
+    else {
+        // duplicates are still acknowledged so the peer can release them
+        acknowledgementPending_ = true;
+        if(sequence <= lastReceived_) {
+            return false;
+        }
+        lastReceived_ = sequence;
+    }
+
+    std::stringstream ss;
+    ss << Utils::convertToHex(frame.length() - SEQUENCE_HEADER_LENGTH, 5) << frame.substr(5, 3) << frame.substr(8 + SEQUENCE_HEADER_LENGTH);
+    encodedMessage = ss.str();
+    return true;
+}
+
+bool ReliableDelivery::isInWindow(unsigned int sequence) const {
+    return unacknowledged_.empty() || sequence < unacknowledged_.front().sequence + capacity_;
+}
+
+std::vector<std::pair<unsigned int, std::shared_ptr<Message>>> ReliableDelivery::getUnacknowledged() const {
+    std::vector<std::pair<unsigned int, std::shared_ptr<Message>>> result;
+    for(auto &entry : unacknowledged_) {
+        result.push_back(std::make_pair(entry.sequence, entry.message));
+    }
+
+    return result;
+}
@@ -0,0 +1,122 @@
+#include "resumption.h"
+#include "random.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include <lib/cryptopp/aes.h>
+#include <lib/cryptopp/filters.h>
+#include <lib/cryptopp/gcm.h>
+#include <lib/cryptopp/hex.h>
+#include <lib/cryptopp/hkdf.h>
+#include <lib/cryptopp/sha.h>
+
+using namespace CryptoPP;
+
+const unsigned int TICKET_IV_LENGTH = 12;
+const unsigned int TICKET_TAG_LENGTH = 16;
+const unsigned int TICKET_EXPIRY_LENGTH = 16;
+const std::string KEY_DERIVATION_INFO = "qtchat session resumption";
+
+namespace {
+    long long currentTime() {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+}
+
+SessionTicketIssuer::SessionTicketIssuer(unsigned int lifetime) :
+    key_(Random::generateBytes(AES::MAX_KEYLENGTH)),
+    lifetime_(lifetime) {}
+
+std::string SessionTicketIssuer::issue(const std::string &sessionId, const std::string &secret) const {
+    std::stringstream plain;
+    plain << std::hex << std::setw(TICKET_EXPIRY_LENGTH) << std::setfill('0') << currentTime() + lifetime_ << sessionId << secret;
+
+    auto iv = Random::generateBytes(TICKET_IV_LENGTH);
+    GCM<AES>::Encryption encryptor;
+    encryptor.SetKeyWithIV(reinterpret_cast<const CryptoPP::byte*>(key_.data()), key_.length(),
+                           reinterpret_cast<const CryptoPP::byte*>(iv.data()), iv.length());
+
+    std::string sealed;
+    StringSource ss(plain.str(), true,
+        new AuthenticatedEncryptionFilter(encryptor, new StringSink(sealed), false, TICKET_TAG_LENGTH)
+    );
+
+    return iv + sealed;
+}
+
+bool SessionTicketIssuer::tryOpen(const std::string &ticket, SessionTicket &result) const {
+    if(ticket.length() < TICKET_IV_LENGTH + TICKET_TAG_LENGTH + TICKET_EXPIRY_LENGTH + Resumption::SESSION_ID_LENGTH) {
+        return false;
+    }
+
+    std::string plain;
+    try {
+        GCM<AES>::Decryption decryptor;
+        decryptor.SetKeyWithIV(reinterpret_cast<const CryptoPP::byte*>(key_.data()), key_.length(),
+                               reinterpret_cast<const CryptoPP::byte*>(ticket.data()), TICKET_IV_LENGTH);
+
+        AuthenticatedDecryptionFilter filter(decryptor, new StringSink(plain),
+                                             AuthenticatedDecryptionFilter::DEFAULT_FLAGS, TICKET_TAG_LENGTH);
+        StringSource ss(ticket.substr(TICKET_IV_LENGTH), true, new Redirector(filter));
+    }
+    catch (const CryptoPP::Exception&) {
+        return false;
+    }
+
+    auto expiry = std::stoll(plain.substr(0, TICKET_EXPIRY_LENGTH), 0, 16);
+    if(expiry < currentTime()) {
+        return false;
+    }
+
+    result.sessionId = plain.substr(TICKET_EXPIRY_LENGTH, Resumption::SESSION_ID_LENGTH);
+    result.secret = plain.substr(TICKET_EXPIRY_LENGTH + Resumption::SESSION_ID_LENGTH);
+    return true;
+}
+
+void SessionTicketStore::store(const std::string &peer, const std::string &ticket, const std::string &secret, unsigned int lifetime) {
+    Entry entry;
+    entry.ticket = ticket;
+    entry.secret = secret;
+    entry.expiry = std::chrono::steady_clock::now() + std::chrono::seconds(lifetime);
+    tickets_[peer] = entry;
+}
+
+bool SessionTicketStore::tryTake(const std::string &peer, Entry &result) {
+    auto it = tickets_.find(peer);
+    if(it == tickets_.end()) {
+        return false;
+    }
+
+    result = it->second;
+    tickets_.erase(it);
+
+    return result.expiry > std::chrono::steady_clock::now();
+}
+
+void SessionTicketStore::remove(const std::string &peer) {
+    tickets_.erase(peer);
+}
+
+std::string Resumption::generateNonce() {
+    return Random::generateBytes(NONCE_LENGTH);
+}
+
+std::string Resumption::generateSessionId() {
+    std::string result;
+    StringSource ss(Random::generateBytes(SESSION_ID_LENGTH / 2), true, new HexEncoder(new StringSink(result), false));
+    return result;
+}
+
+std::string Resumption::deriveKey(const std::string &secret, const std::string &clientNonce, const std::string &serverNonce) {
+    auto salt = clientNonce + serverNonce;
+    CryptoPP::byte derived[AES::DEFAULT_KEYLENGTH];
+
+    HKDF<SHA256> hkdf;
+    hkdf.DeriveKey(derived, sizeof(derived),
+                   reinterpret_cast<const CryptoPP::byte*>(secret.data()), secret.length(),
+                   reinterpret_cast<const CryptoPP::byte*>(salt.data()), salt.length(),
+                   reinterpret_cast<const CryptoPP::byte*>(KEY_DERIVATION_INFO.data()), KEY_DERIVATION_INFO.length());
+
+    return std::string(reinterpret_cast<const char*>(derived), sizeof(derived));
+}
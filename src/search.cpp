@@ -0,0 +1,532 @@
+#include "search.h"
+#include "tracing.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <lib/cryptopp/seckey.h>
+#include <lib/cryptopp/siphash.h>
+
+const std::string SEGMENT_OPEN_ERROR = "Could not open the search index segment.";
+const char SEGMENT_MAGIC[] = "QCSI";
+const size_t SEGMENT_MAGIC_LENGTH = 4;
+const size_t SEGMENT_HEADER_LENGTH = SEGMENT_MAGIC_LENGTH + sizeof(uint32_t) + sizeof(uint64_t);
+const size_t SEGMENT_ENTRY_LENGTH = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+const unsigned int MANIFEST_LENGTH_DIGITS = 16;
+const unsigned int MANIFEST_SEGMENT_DIGITS = 8;
+
+namespace {
+
+template<typename T>
+T readValue(const uchar *data) {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void writeValue(std::ostream &output, T value) {
+    output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+std::vector<uint32_t> getTrigrams(const std::string &text, const std::string &key) {
+    std::vector<uint32_t> trigrams;
+    if(key.empty()) {
+        for(size_t i = 0; i + MIN_SEARCH_QUERY_LENGTH <= text.length(); ++i) {
+            trigrams.push_back(static_cast<uint32_t>(static_cast<unsigned char>(text[i])) << 16
+                               | static_cast<uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8
+                               | static_cast<unsigned char>(text[i + 2]));
+        }
+    }
+    else {
+        // collisions of the truncated hashes only add candidates, which are checked against the messages anyway
+        CryptoPP::SipHash<2, 4, false> hash(reinterpret_cast<const CryptoPP::byte*>(key.data()), SEARCH_KEY_LENGTH);
+        uint32_t digest[2];
+        for(size_t i = 0; i + MIN_SEARCH_QUERY_LENGTH <= text.length(); ++i) {
+            hash.CalculateDigest(reinterpret_cast<CryptoPP::byte*>(digest), reinterpret_cast<const CryptoPP::byte*>(&text[i]), MIN_SEARCH_QUERY_LENGTH);
+            trigrams.push_back(digest[0]);
+        }
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+void sortPositions(std::vector<uint32_t> &positions) {
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+}
+
+/**
+ * @brief Writes a segment from posting lists added in ascending trigram order.
+ */
+class SegmentWriter {
+public:
+    explicit SegmentWriter(const std::string &path) : output_(path, std::ios::binary | std::ios::trunc) {
+        // the header is completed once the table has been written
+        output_.write(SEGMENT_MAGIC, SEGMENT_MAGIC_LENGTH);
+        writeValue<uint32_t>(output_, 0);
+        writeValue<uint64_t>(output_, 0);
+    }
+
+    /**
+     * @brief Adds the sorted, distinct positions of a trigram.
+     */
+    void add(uint32_t trigram, const std::vector<uint32_t> &positions) {
+        if(positions.empty()) {
+            return;
+        }
+
+        table_.push_back({trigram, static_cast<uint32_t>(positions.size()), offset_});
+        buffer_.clear();
+        uint32_t previous = 0;
+        for(auto position : positions) {
+            auto delta = position - previous;
+            previous = position;
+            while(delta >= 0x80) {
+                buffer_ += static_cast<char>((delta & 0x7F) | 0x80);
+                delta >>= 7;
+            }
+            buffer_ += static_cast<char>(delta);
+        }
+        output_.write(buffer_.data(), buffer_.length());
+        offset_ += buffer_.length();
+    }
+
+    bool finish() {
+        for(auto &entry : table_) {
+            writeValue(output_, entry.trigram);
+            writeValue(output_, entry.count);
+            writeValue(output_, entry.offset);
+        }
+        output_.seekp(SEGMENT_MAGIC_LENGTH);
+        writeValue<uint32_t>(output_, table_.size());
+        writeValue<uint64_t>(output_, offset_);
+        output_.flush();
+        return static_cast<bool>(output_);
+    }
+
+private:
+    struct Entry {
+        uint32_t trigram;
+        uint32_t count;
+        uint64_t offset;
+    };
+
+    std::ofstream output_;
+    std::vector<Entry> table_;
+    std::string buffer_;
+    uint64_t offset_ = SEGMENT_HEADER_LENGTH;
+};
+
+std::shared_ptr<SearchSegment> openWrittenSegment(SegmentWriter &writer, const std::string &path) {
+    try {
+        if(writer.finish()) {
+            return std::make_shared<SearchSegment>(path);
+        }
+    }
+    catch (const std::runtime_error&) {
+    }
+
+    std::error_code error;
+    std::filesystem::remove(path, error);
+    return nullptr;
+}
+
+std::shared_ptr<SearchSegment> mergeSegments(const std::vector<std::shared_ptr<SearchSegment>> &segments, const std::string &path) {
+    TraceSpan span("search_merge", "history");
+
+    SegmentWriter writer(path);
+    std::vector<size_t> next(segments.size(), 0);
+    std::vector<uint32_t> positions;
+    while(true) {
+        bool found = false;
+        uint32_t trigram = 0;
+        for(size_t i = 0; i < segments.size(); ++i) {
+            if(next[i] < segments[i]->getTrigramCount() && (!found || segments[i]->getTrigram(next[i]) < trigram)) {
+                trigram = segments[i]->getTrigram(next[i]);
+                found = true;
+            }
+        }
+        if(!found) {
+            break;
+        }
+
+        positions.clear();
+        for(size_t i = 0; i < segments.size(); ++i) {
+            if(next[i] < segments[i]->getTrigramCount() && segments[i]->getTrigram(next[i]) == trigram) {
+                segments[i]->readPostings(next[i]++, positions);
+            }
+        }
+        sortPositions(positions);
+        writer.add(trigram, positions);
+    }
+
+    return openWrittenSegment(writer, path);
+}
+
+}
+
+SearchSegment::SearchSegment(const std::string &path) :
+    path_(path),
+    file_(QString::fromStdString(path))
+{
+    if(!file_.open(QIODevice::ReadOnly) || file_.size() < static_cast<qint64>(SEGMENT_HEADER_LENGTH)) {
+        throw std::runtime_error(SEGMENT_OPEN_ERROR);
+    }
+
+    size_ = file_.size();
+    data_ = file_.map(0, size_);
+    if(data_ == nullptr || std::memcmp(data_, SEGMENT_MAGIC, SEGMENT_MAGIC_LENGTH) != 0) {
+        throw std::runtime_error(SEGMENT_OPEN_ERROR);
+    }
+
+    trigramCount_ = readValue<uint32_t>(data_ + SEGMENT_MAGIC_LENGTH);
+    tableOffset_ = readValue<uint64_t>(data_ + SEGMENT_MAGIC_LENGTH + sizeof(uint32_t));
+    if(tableOffset_ < SEGMENT_HEADER_LENGTH || tableOffset_ > size_ || (size_ - tableOffset_) / SEGMENT_ENTRY_LENGTH < trigramCount_) {
+        throw std::runtime_error(SEGMENT_OPEN_ERROR);
+    }
+}
+
+SearchSegment::~SearchSegment() {
+    file_.unmap(const_cast<uchar*>(data_));
+    file_.close();
+    if(obsolete_) {
+        std::error_code error;
+        std::filesystem::remove(path_, error);
+    }
+}
+
+uint32_t SearchSegment::getTrigram(size_t index) const {
+    return readValue<uint32_t>(getEntry(index));
+}
+
+size_t SearchSegment::getPostingCount(size_t index) const {
+    return readValue<uint32_t>(getEntry(index) + sizeof(uint32_t));
+}
+
+void SearchSegment::readPostings(size_t index, std::vector<uint32_t> &positions) const {
+    auto count = getPostingCount(index);
+    auto offset = readValue<uint64_t>(getEntry(index) + 2 * sizeof(uint32_t));
+    if(offset < SEGMENT_HEADER_LENGTH || offset > tableOffset_) {
+        return;
+    }
+
+    auto data = data_ + offset;
+    auto end = data_ + tableOffset_;
+    uint32_t position = 0;
+    for(size_t i = 0; i < count && data < end; ++i) {
+        uint32_t delta = 0;
+        for(unsigned int shift = 0; data < end && shift < 32; shift += 7) {
+            auto byte = *data++;
+            delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        position += delta;
+        positions.push_back(position);
+    }
+}
+
+size_t SearchSegment::find(uint32_t trigram) const {
+    size_t low = 0;
+    size_t high = trigramCount_;
+    while(low < high) {
+        auto middle = low + (high - low) / 2;
+        if(getTrigram(middle) < trigram) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low < trigramCount_ && getTrigram(low) == trigram ? low : trigramCount_;
+}
+
+const uchar* SearchSegment::getEntry(size_t index) const {
+    return data_ + tableOffset_ + index * SEGMENT_ENTRY_LENGTH;
+}
+
+SearchIndex::~SearchIndex() {
+    if(merger_.joinable()) {
+        merger_.join();
+    }
+}
+
+void SearchIndex::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segments_.clear();
+    pending_.clear();
+    pendingPostings_ = 0;
+    indexedLength_ = 0;
+    indexedMessages_ = 0;
+    incomplete_ = false;
+
+    std::ifstream manifest(path_);
+    std::string header;
+    if(!std::getline(manifest, header) || header.length() != 2 * MANIFEST_LENGTH_DIGITS + MANIFEST_SEGMENT_DIGITS) {
+        return;
+    }
+
+    unsigned long long indexedLength;
+    size_t indexedMessages;
+    try {
+        indexedLength = std::stoull(header.substr(0, MANIFEST_LENGTH_DIGITS), 0, 16);
+        indexedMessages = std::stoull(header.substr(MANIFEST_LENGTH_DIGITS, MANIFEST_LENGTH_DIGITS), 0, 16);
+        nextSegment_ = std::stoul(header.substr(2 * MANIFEST_LENGTH_DIGITS), 0, 16);
+    }
+    catch (const std::logic_error&) {
+        return;
+    }
+
+    // with a segment missing the index starts over, the log is indexed again from the beginning
+    std::vector<std::shared_ptr<SearchSegment>> segments;
+    auto directory = std::filesystem::path(path_).parent_path();
+    std::string name;
+    while(std::getline(manifest, name)) {
+        try {
+            segments.push_back(std::make_shared<SearchSegment>((directory / name).string()));
+        }
+        catch (const std::runtime_error&) {
+            for(auto &segment : segments) {
+                segment->setObsolete();
+            }
+            return;
+        }
+    }
+
+    segments_ = segments;
+    indexedLength_ = indexedLength;
+    indexedMessages_ = indexedMessages;
+}
+
+void SearchIndex::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto &segment : segments_) {
+        segment->setObsolete();
+    }
+    segments_.clear();
+    pending_.clear();
+    pendingPostings_ = 0;
+    indexedLength_ = 0;
+    indexedMessages_ = 0;
+    incomplete_ = false;
+    writeManifest();
+}
+
+void SearchIndex::add(size_t position, const std::string &content) {
+    auto trigrams = getTrigrams(normalize(content), key_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto trigram : trigrams) {
+        auto &positions = pending_[trigram];
+        if(positions.empty() || positions.back() != position) {
+            positions.push_back(position);
+            ++pendingPostings_;
+        }
+    }
+}
+
+size_t SearchIndex::getPendingPostings() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pendingPostings_;
+}
+
+void SearchIndex::flush(unsigned long long indexedLength, size_t indexedMessages) {
+    TraceSpan span("search_flush", "history");
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(!pending_.empty()) {
+        auto path = getSegmentPath(nextSegment_++);
+        SegmentWriter writer(path);
+        for(auto &entry : pending_) {
+            // edits add older positions behind newer ones
+            sortPositions(entry.second);
+            writer.add(entry.first, entry.second);
+        }
+        pending_.clear();
+        pendingPostings_ = 0;
+
+        // the postings are dropped rather than kept growing, opening the log again indexes the lost messages
+        auto segment = openWrittenSegment(writer, path);
+        if(segment == nullptr) {
+            incomplete_ = true;
+            return;
+        }
+        segments_.push_back(segment);
+    }
+
+    if(!incomplete_) {
+        indexedLength_ = indexedLength;
+        indexedMessages_ = indexedMessages;
+    }
+    writeManifest();
+    startMerge();
+}
+
+unsigned long long SearchIndex::getIndexedLength() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return indexedLength_;
+}
+
+size_t SearchIndex::getIndexedMessages() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return indexedMessages_;
+}
+
+std::vector<size_t> SearchIndex::find(const std::string &query) const {
+    TraceSpan span("search_query", "history");
+
+    auto trigrams = getTrigrams(normalize(query), key_);
+    if(trigrams.empty()) {
+        return {};
+    }
+
+    // the posting lists are read without holding the lock, the segments stay mapped while they are referenced
+    std::vector<std::shared_ptr<SearchSegment>> segments;
+    std::vector<std::vector<uint32_t>> lists(trigrams.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        segments = segments_;
+        for(size_t i = 0; i < trigrams.size(); ++i) {
+            auto pending = pending_.find(trigrams[i]);
+            if(pending != pending_.end()) {
+                lists[i] = pending->second;
+            }
+        }
+    }
+
+    // starting with the rarest trigram keeps the intermediate results small
+    std::vector<std::pair<size_t, size_t>> order;
+    for(size_t i = 0; i < trigrams.size(); ++i) {
+        auto count = lists[i].size();
+        for(auto &segment : segments) {
+            auto index = segment->find(trigrams[i]);
+            if(index < segment->getTrigramCount()) {
+                count += segment->getPostingCount(index);
+            }
+        }
+        if(count == 0) {
+            return {};
+        }
+        order.push_back({count, i});
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<uint32_t> result;
+    std::vector<uint32_t> intersection;
+    for(auto &entry : order) {
+        auto &positions = lists[entry.second];
+        for(auto &segment : segments) {
+            auto index = segment->find(trigrams[entry.second]);
+            if(index < segment->getTrigramCount()) {
+                segment->readPostings(index, positions);
+            }
+        }
+        sortPositions(positions);
+
+        if(&entry == &order.front()) {
+            result.swap(positions);
+        }
+        else {
+            intersection.clear();
+            std::set_intersection(result.begin(), result.end(), positions.begin(), positions.end(), std::back_inserter(intersection));
+            result.swap(intersection);
+        }
+        if(result.empty()) {
+            return {};
+        }
+    }
+    return std::vector<size_t>(result.rbegin(), result.rend());
+}
+
+std::string SearchIndex::normalize(const std::string &text) {
+    auto normalized = text;
+    for(auto &character : normalized) {
+        if(character >= 'A' && character <= 'Z') {
+            character += 'a' - 'A';
+        }
+    }
+    return normalized;
+}
+
+std::string SearchIndex::getSegmentPath(unsigned int number) const {
+    return path_ + "." + std::to_string(number);
+}
+
+void SearchIndex::writeManifest() {
+    auto temporaryPath = path_ + ".tmp";
+    {
+        std::ofstream manifest(temporaryPath, std::ios::trunc);
+        manifest << Utils::convertToHex(indexedLength_, MANIFEST_LENGTH_DIGITS) << Utils::convertToHex(indexedMessages_, MANIFEST_LENGTH_DIGITS)
+                 << Utils::convertToHex(nextSegment_, MANIFEST_SEGMENT_DIGITS) << '\n';
+        for(auto &segment : segments_) {
+            manifest << std::filesystem::path(segment->getPath()).filename().string() << '\n';
+        }
+        if(!manifest.flush()) {
+            return;
+        }
+    }
+
+    // replaced in one step, a crash leaves either the old or the new manifest
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path_, error);
+}
+
+bool SearchIndex::shouldMerge() const {
+    if(segments_.size() < SEARCH_MERGE_SEGMENTS) {
+        return false;
+    }
+
+    auto bounds = std::minmax_element(segments_.end() - SEARCH_MERGE_SEGMENTS, segments_.end(), [](const auto &first, const auto &second) {
+        return first->getSize() < second->getSize();
+    });
+    return (*bounds.second)->getSize() < SEARCH_MERGE_SEGMENTS * (*bounds.first)->getSize();
+}
+
+void SearchIndex::startMerge() {
+    if(merging_ || !shouldMerge()) {
+        return;
+    }
+
+    // a merger which is not merging has finished and only needs to be joined
+    if(merger_.joinable()) {
+        merger_.join();
+    }
+    merging_ = true;
+    merger_ = std::thread(&SearchIndex::runMerges, this);
+}
+
+void SearchIndex::runMerges() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(shouldMerge()) {
+        std::vector<std::shared_ptr<SearchSegment>> segments(segments_.end() - SEARCH_MERGE_SEGMENTS, segments_.end());
+        auto path = getSegmentPath(nextSegment_++);
+
+        lock.unlock();
+        auto merged = mergeSegments(segments, path);
+        lock.lock();
+
+        if(merged == nullptr) {
+            break;
+        }
+
+        // segments flushed in the meantime are newer and stay behind the merged one, a cleared index drops it
+        auto first = std::find(segments_.begin(), segments_.end(), segments.front());
+        if(static_cast<size_t>(segments_.end() - first) < segments.size() || !std::equal(segments.begin(), segments.end(), first)) {
+            merged->setObsolete();
+            break;
+        }
+        for(auto &segment : segments) {
+            segment->setObsolete();
+        }
+        *first = merged;
+        segments_.erase(first + 1, first + segments.size());
+        writeManifest();
+    }
+    merging_ = false;
+}
@@ -1,6 +1,8 @@
+#include <cctype>
 #include <iomanip>
 #include <sstream>
 #include "session.h"
+#include "tracing.h"
 #include "utils.h"
 
 const std::string INVALID_MESSAGE_ERROR = "Invalid message received.";
@@ -9,8 +11,184 @@ const std::string HANDSHAKE_ALREADY_FINISHED_ERROR = "Handshake processing was a
 const std::string DUPLICATE_KEY_ERROR = "Duplicate key received.";
 const std::string HANDSHAKE_TERMINATED_ERROR = "Session terminated by the other side.";
 const std::string DATA_RECEIVED_BEFORE_KEY = "Data was received before encryption was established.";
+const std::string UNEXPECTED_RESUMPTION_ERROR = "Unexpected session resumption message received.";
+const std::string INVALID_IDENTITY_ERROR = "The other side could not prove the possession of its key.";
+
+const int ACKNOWLEDGEMENT_DELAY = 200;
+const int RESUMPTION_GRACE_PERIOD = 30000;
+const int RECONNECT_DELAY = 1000;
+const unsigned int TIMESTAMP_LENGTH = 16;
+const unsigned int VERSION_LENGTH = 8;
+const unsigned int FILE_OFFSET_LENGTH = 16;
+const unsigned int SYNC_COUNT_LENGTH = 8;
+const unsigned int SYNC_FINGERPRINT_LENGTH = 16;
+const unsigned int IDENTITY_LENGTH_LENGTH = 4;
+
+const Histogram ENCODE_LATENCY = Metrics::histogram("qtchat_message_encode_ns");
+const Histogram DECODE_LATENCY = Metrics::histogram("qtchat_message_decode_ns");
+const Histogram ENCRYPT_LATENCY = Metrics::histogram("qtchat_encrypt_ns");
+const Histogram DECRYPT_LATENCY = Metrics::histogram("qtchat_decrypt_ns");
+const Histogram HANDSHAKE_KEY_EXCHANGE_DURATION = Metrics::histogram("qtchat_handshake_key_exchange_ns");
+const Histogram HANDSHAKE_RESUMPTION_DURATION = Metrics::histogram("qtchat_handshake_resumption_ns");
+const Histogram HANDSHAKE_USER_INFO_DURATION = Metrics::histogram("qtchat_handshake_user_info_ns");
+const Histogram HANDSHAKE_TOTAL_DURATION = Metrics::histogram("qtchat_handshake_total_ns");
+const Counter HANDSHAKE_ERRORS = Metrics::counter("qtchat_handshake_errors_total");
+const Counter INVALID_MESSAGES = Metrics::counter("qtchat_invalid_messages_total");
+const Counter ALLOCATED_SESSIONS = Metrics::gauge("qtchat_sessions_allocated"); // sessions not destroyed yet, whatever their state
+const Histogram SEND_QUEUE_LATENCY = Metrics::histogram("qtchat_latency_send_queue_ns");
+const Histogram PEER_SEND_QUEUE_LATENCY = Metrics::histogram("qtchat_latency_peer_send_queue_ns");
+const Histogram NETWORK_LATENCY = Metrics::histogram("qtchat_latency_network_ns");
+const Histogram RECEIVE_DECODE_LATENCY = Metrics::histogram("qtchat_latency_decode_ns");
+const Histogram RENDER_LATENCY = Metrics::histogram("qtchat_latency_render_ns");
+const Histogram END_TO_END_LATENCY = Metrics::histogram("qtchat_latency_end_to_end_ns");
+const double LATENCY_AVERAGE_WEIGHT = 0.125;
+const size_t MAX_PENDING_RENDERS = 1024; // received messages no window has shown
+
+namespace {
+    void recordMicroseconds(const Histogram &histogram, long long duration) {
+        // estimated clock offsets can make short network times slightly negative
+        histogram.record(duration > 0 ? duration * 1000 : 0);
+    }
+
+    double updateAverage(double average, double sample, bool first) {
+        return first ? sample : (1 - LATENCY_AVERAGE_WEIGHT) * average + LATENCY_AVERAGE_WEIGHT * sample;
+    }
+
+    std::string encodeMessageId(MessageId id) {
+        std::string result(MESSAGE_ID_LENGTH, '\0');
+        for(auto i = MESSAGE_ID_LENGTH; i > 0; --i) {
+            result[i - 1] = static_cast<char>(id & 0xFF);
+            id >>= 8;
+        }
+        return result;
+    }
+
+    MessageId readMessageId(const std::string &content) {
+        MessageId id = 0;
+        for(unsigned int i = 0; i < MESSAGE_ID_LENGTH; ++i) {
+            id = (id << 8) | static_cast<unsigned char>(content[i]);
+        }
+        return id;
+    }
+
+    MessageId decodeMessageId(const std::string &content) {
+        auto id = readMessageId(content);
+        if(id == 0) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        return id;
+    }
+
+    unsigned long long decodeFileOffset(const std::string &content) {
+        try {
+            return std::stoull(content.substr(MESSAGE_ID_LENGTH, FILE_OFFSET_LENGTH), 0, 16);
+        }
+        catch (const std::logic_error&) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+    }
+
+    /**
+     * [8B hex range count] ranges [8B requested id]...
+     * range: [8B lower] [8B upper] F [16B hex count] [16B hex fingerprint], or [8B lower] [8B upper] L [8B hex count] items
+     * item: [8B id] [8B hex version]
+     */
+    std::shared_ptr<HistorySyncMessage> decodeHistorySync(const std::string &content) {
+        size_t position = 0;
+        auto take = [&content, &position](size_t length) {
+            if(content.length() - position < length) {
+                throw std::runtime_error(INVALID_MESSAGE_ERROR);
+            }
+            position += length;
+            return content.substr(position - length, length);
+        };
+        auto takeHex = [&take](size_t length) {
+            try {
+                return std::stoull(take(length), 0, 16);
+            }
+            catch (const std::logic_error&) {
+                throw std::runtime_error(INVALID_MESSAGE_ERROR);
+            }
+        };
+
+        // every range takes some bytes, so the counts cannot make us allocate more than the content's size
+        std::vector<SyncRange> ranges;
+        auto rangeCount = takeHex(SYNC_COUNT_LENGTH);
+        for(unsigned long long i = 0; i < rangeCount; ++i) {
+            SyncRange range;
+            range.lower = readMessageId(take(MESSAGE_ID_LENGTH));
+            range.upper = readMessageId(take(MESSAGE_ID_LENGTH));
+            auto kind = take(1)[0];
+            if(kind == 'L') {
+                range.listed = true;
+                auto itemCount = takeHex(SYNC_COUNT_LENGTH);
+                for(unsigned long long j = 0; j < itemCount; ++j) {
+                    auto id = decodeMessageId(take(MESSAGE_ID_LENGTH));
+                    range.items.push_back({id, static_cast<unsigned int>(takeHex(VERSION_LENGTH))});
+                }
+                range.count = range.items.size();
+            }
+            else if(kind == 'F') {
+                range.count = takeHex(SYNC_FINGERPRINT_LENGTH);
+                range.fingerprint = takeHex(SYNC_FINGERPRINT_LENGTH);
+            }
+            else {
+                throw std::runtime_error(INVALID_MESSAGE_ERROR);
+            }
+            ranges.push_back(range);
+        }
+
+        std::vector<MessageId> requested;
+        while(position < content.length()) {
+            requested.push_back(decodeMessageId(take(MESSAGE_ID_LENGTH)));
+        }
+        return std::make_shared<HistorySyncMessage>(ranges, requested);
+    }
+
+    std::shared_ptr<AbstractChatMessage> decodeChatMessage(char type, const std::string &content) {
+        // timestamped variants use the lowercase type and carry the timestamps right after the id
+        auto timestamped = std::islower(type) != 0;
+        auto kind = static_cast<char>(std::toupper(type));
+        auto headerLength = MESSAGE_ID_LENGTH + (timestamped ? 2 * TIMESTAMP_LENGTH : 0) + (kind != 'N' ? VERSION_LENGTH : 0);
+
+        // a delta may be empty, full contents may not
+        if(content.length() < headerLength || (kind != 'D' && content.length() == headerLength)) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+
+        try {
+            auto id = decodeMessageId(content);
+            auto body = content.substr(headerLength);
+
+            std::shared_ptr<AbstractChatMessage> chatMessage;
+            if(kind == 'N') {
+                chatMessage = std::make_shared<NewChatMessage>(id, body);
+            }
+            else {
+                auto version = std::stoul(content.substr(headerLength - VERSION_LENGTH, VERSION_LENGTH), 0, 16);
+                if(kind == 'E') {
+                    chatMessage = std::make_shared<EditChatMessage>(id, version, body);
+                }
+                else {
+                    chatMessage = std::make_shared<EditChatMessage>(id, version, MessageDelta::decode(body));
+                }
+            }
+
+            if(timestamped) {
+                chatMessage->setCreatedAt(std::stoll(content.substr(MESSAGE_ID_LENGTH, TIMESTAMP_LENGTH), 0, 16));
+                chatMessage->setSentAt(std::stoll(content.substr(MESSAGE_ID_LENGTH + TIMESTAMP_LENGTH, TIMESTAMP_LENGTH), 0, 16));
+            }
+            return chatMessage;
+        }
+        catch (const std::logic_error&) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+    }
+}
 
 std::shared_ptr<Message> StandardMessageConverter::convertToMessage(const std::string &message) const {
+    ScopedLatency latency(DECODE_LATENCY);
+    TraceSpan span("decode", "messaging");
     auto messageData = MessageData(message);
 
     switch(messageData.typeIdentifier) {
@@ -21,24 +199,125 @@ std::shared_ptr<Message> StandardMessageConverter::convertToMessage(const std::s
         auto userInfo = UserInfo(messageData.messageContent);
         return std::make_shared<UserInfoMessage>(userInfo);
     }
+    case 'V': {
+        // user info with the sender's public key and signature, each preceded by its length
+        auto &content = messageData.messageContent;
+        try {
+            auto keyLength = std::stoul(content.substr(0, IDENTITY_LENGTH_LENGTH), 0, 16);
+            auto signatureStart = IDENTITY_LENGTH_LENGTH + keyLength;
+            auto signatureLength = std::stoul(content.substr(signatureStart, IDENTITY_LENGTH_LENGTH), 0, 16);
+            auto usernameStart = signatureStart + IDENTITY_LENGTH_LENGTH + signatureLength;
+            if(content.length() < usernameStart) {
+                throw std::runtime_error(INVALID_MESSAGE_ERROR);
+            }
+
+            auto userInfo = UserInfo(content.substr(usernameStart));
+            return std::make_shared<UserInfoMessage>(userInfo, content.substr(IDENTITY_LENGTH_LENGTH, keyLength),
+                                                     content.substr(signatureStart + IDENTITY_LENGTH_LENGTH, signatureLength));
+        }
+        catch (const std::logic_error&) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+    }
     case 'S': {
         return std::make_shared<SessionEndMessage>();
     }
-    case 'N': {
-        if(messageData.messageContent.length() < 9) {
+    case 'T': {
+        if(messageData.messageContent.length() <= 8 + Resumption::SESSION_ID_LENGTH) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        unsigned long lifetime;
+        try {
+            lifetime = std::stoul(messageData.messageContent.substr(0, 8), 0, 16);
+        }
+        catch (const std::logic_error&) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto sessionId = messageData.messageContent.substr(8, Resumption::SESSION_ID_LENGTH);
+        auto ticket = messageData.messageContent.substr(8 + Resumption::SESSION_ID_LENGTH);
+        return std::make_shared<SessionTicketMessage>(sessionId, ticket, lifetime);
+    }
+    case 'R': {
+        if(messageData.messageContent.length() < Resumption::NONCE_LENGTH) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto nonce = messageData.messageContent.substr(0, Resumption::NONCE_LENGTH);
+        auto ticket = messageData.messageContent.substr(Resumption::NONCE_LENGTH);
+        return std::make_shared<ResumeSessionMessage>(nonce, ticket);
+    }
+    case 'I': {
+        if(messageData.messageContent.length() <= GROUP_ID_LENGTH) {
             throw std::runtime_error(INVALID_MESSAGE_ERROR);
         }
-        auto id = messageData.messageContent.substr(0, 8);
-        auto messageContent = messageData.messageContent.substr(8);
-        return std::make_shared<NewChatMessage>(id, messageContent);
+        auto groupId = messageData.messageContent.substr(0, GROUP_ID_LENGTH);
+        auto key = messageData.messageContent.substr(GROUP_ID_LENGTH);
+        return std::make_shared<GroupKeyMessage>(groupId, key);
     }
-    case 'E': {
-        if(messageData.messageContent.length() < 9) {
+    case 'G': {
+        if(messageData.messageContent.length() <= GROUP_ID_LENGTH) {
             throw std::runtime_error(INVALID_MESSAGE_ERROR);
         }
-        auto id = messageData.messageContent.substr(0, 8);
-        auto messageContent = messageData.messageContent.substr(8);
-        return std::make_shared<EditChatMessage>(id, messageContent);
+        auto groupId = messageData.messageContent.substr(0, GROUP_ID_LENGTH);
+        auto payload = messageData.messageContent.substr(GROUP_ID_LENGTH);
+        return std::make_shared<GroupChatMessage>(groupId, payload);
+    }
+    case 'F': {
+        if(messageData.messageContent.length() <= MESSAGE_ID_LENGTH + FILE_OFFSET_LENGTH) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto transferId = decodeMessageId(messageData.messageContent);
+        auto size = decodeFileOffset(messageData.messageContent);
+        auto name = messageData.messageContent.substr(MESSAGE_ID_LENGTH + FILE_OFFSET_LENGTH);
+        return std::make_shared<FileOfferMessage>(transferId, size, name);
+    }
+    case 'P': {
+        if(messageData.messageContent.length() != MESSAGE_ID_LENGTH + FILE_OFFSET_LENGTH) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto transferId = decodeMessageId(messageData.messageContent);
+        return std::make_shared<FileAcknowledgementMessage>(transferId, decodeFileOffset(messageData.messageContent));
+    }
+    case 'B': {
+        if(messageData.messageContent.length() <= MESSAGE_ID_LENGTH + FILE_OFFSET_LENGTH) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto transferId = decodeMessageId(messageData.messageContent);
+        auto offset = decodeFileOffset(messageData.messageContent);
+        auto data = messageData.messageContent.substr(MESSAGE_ID_LENGTH + FILE_OFFSET_LENGTH);
+        return std::make_shared<FileChunkMessage>(transferId, offset, data);
+    }
+    case 'X': {
+        if(messageData.messageContent.length() != MESSAGE_ID_LENGTH) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        return std::make_shared<FileCancelMessage>(decodeMessageId(messageData.messageContent));
+    }
+    case 'Y': {
+        return decodeHistorySync(messageData.messageContent);
+    }
+    case 'Z': {
+        if(messageData.messageContent.length() <= MESSAGE_ID_LENGTH + VERSION_LENGTH + 1) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto id = decodeMessageId(messageData.messageContent);
+        unsigned long version;
+        try {
+            version = std::stoul(messageData.messageContent.substr(MESSAGE_ID_LENGTH, VERSION_LENGTH), 0, 16);
+        }
+        catch (const std::logic_error&) {
+            throw std::runtime_error(INVALID_MESSAGE_ERROR);
+        }
+        auto authored = messageData.messageContent[MESSAGE_ID_LENGTH + VERSION_LENGTH] == '1';
+        auto content = messageData.messageContent.substr(MESSAGE_ID_LENGTH + VERSION_LENGTH + 1);
+        return std::make_shared<HistoryRecordMessage>(id, version, authored, content);
+    }
+    case 'N':
+    case 'E':
+    case 'D':
+    case 'n':
+    case 'e':
+    case 'd': {
+        return decodeChatMessage(messageData.typeIdentifier, messageData.messageContent);
     }
     default:
         throw std::runtime_error(UNKNOWN_MESSAGE_TYPE_ERROR);
@@ -60,6 +339,8 @@ StandardMessageConverter::MessageData::MessageData(const std::string &content) {
 }
 
 std::string StandardMessageConverter::convertFromMessage(Message *message) {
+    ScopedLatency latency(ENCODE_LATENCY);
+    TraceSpan span("encode", "messaging");
     message->process(this);
 
     std::stringstream ss;
@@ -78,26 +359,130 @@ void StandardMessageConverter::processMessage(SessionEndMessage *message) {
 }
 
 void StandardMessageConverter::processMessage(UserInfoMessage *message) {
-    current_.typeIdentifier = 'U';
-    current_.messageContent = message->getUserInfo().getUsername();
+    if(message->getPublicKey().empty()) {
+        current_.typeIdentifier = 'U';
+        current_.messageContent = message->getUserInfo().getUsername();
+        return;
+    }
+
+    current_.typeIdentifier = 'V';
+    current_.messageContent = Utils::convertToHex(message->getPublicKey().length(), IDENTITY_LENGTH_LENGTH) + message->getPublicKey()
+            + Utils::convertToHex(message->getSignature().length(), IDENTITY_LENGTH_LENGTH) + message->getSignature()
+            + message->getUserInfo().getUsername();
+}
+
+void StandardMessageConverter::processMessage(SessionTicketMessage *message) {
+    current_.typeIdentifier = 'T';
+    current_.messageContent = Utils::convertToHex(message->getLifetime(), 8) + message->getSessionId() + message->getTicket();
+}
+
+void StandardMessageConverter::processMessage(ResumeSessionMessage *message) {
+    current_.typeIdentifier = 'R';
+    current_.messageContent = message->getNonce() + message->getTicket();
+}
+
+void StandardMessageConverter::processMessage(GroupKeyMessage *message) {
+    current_.typeIdentifier = 'I';
+    current_.messageContent = message->getGroupId() + message->getKey();
+}
+
+void StandardMessageConverter::processMessage(GroupChatMessage *message) {
+    current_.typeIdentifier = 'G';
+    current_.messageContent = message->getGroupId() + message->getPayload();
+}
+
+void StandardMessageConverter::processMessage(FileOfferMessage *message) {
+    current_.typeIdentifier = 'F';
+    current_.messageContent = encodeMessageId(message->getTransferId()) + Utils::convertToHex(message->getSize(), FILE_OFFSET_LENGTH) + message->getName();
+}
+
+void StandardMessageConverter::processMessage(FileAcknowledgementMessage *message) {
+    current_.typeIdentifier = 'P';
+    current_.messageContent = encodeMessageId(message->getTransferId()) + Utils::convertToHex(message->getOffset(), FILE_OFFSET_LENGTH);
+}
+
+void StandardMessageConverter::processMessage(FileChunkMessage *message) {
+    current_.typeIdentifier = 'B';
+    current_.messageContent = encodeMessageId(message->getTransferId()) + Utils::convertToHex(message->getOffset(), FILE_OFFSET_LENGTH);
+    current_.messageContent += message->getData();
+}
+
+void StandardMessageConverter::processMessage(FileCancelMessage *message) {
+    current_.typeIdentifier = 'X';
+    current_.messageContent = encodeMessageId(message->getTransferId());
+}
+
+void StandardMessageConverter::processMessage(HistorySyncMessage *message) {
+    current_.typeIdentifier = 'Y';
+    current_.messageContent = Utils::convertToHex(message->getRanges().size(), SYNC_COUNT_LENGTH);
+    for(auto &range : message->getRanges()) {
+        current_.messageContent += encodeMessageId(range.lower) + encodeMessageId(range.upper);
+        if(range.listed) {
+            current_.messageContent += 'L' + Utils::convertToHex(range.items.size(), SYNC_COUNT_LENGTH);
+            for(auto &item : range.items) {
+                current_.messageContent += encodeMessageId(item.id) + Utils::convertToHex(item.version, VERSION_LENGTH);
+            }
+        }
+        else {
+            current_.messageContent += 'F' + Utils::convertToHex(range.count, SYNC_FINGERPRINT_LENGTH) + Utils::convertToHex(range.fingerprint, SYNC_FINGERPRINT_LENGTH);
+        }
+    }
+    for(auto id : message->getRequested()) {
+        current_.messageContent += encodeMessageId(id);
+    }
+}
+
+void StandardMessageConverter::processMessage(HistoryRecordMessage *message) {
+    current_.typeIdentifier = 'Z';
+    current_.messageContent = encodeMessageId(message->getId()) + Utils::convertToHex(message->getVersion(), VERSION_LENGTH)
+            + (message->isAuthored() ? '1' : '0') + message->getContent();
 }
 
 void StandardMessageConverter::processMessage(NewChatMessage *message) {
     current_.typeIdentifier = 'N';
-    current_.messageContent = message->getId() + message->getContent();
+    current_.messageContent = encodeMessageId(message->getId()) + message->getContent();
+    addTimestamps(message);
 }
 
 void StandardMessageConverter::processMessage(EditChatMessage *message) {
-    current_.typeIdentifier = 'E';
-    current_.messageContent = message->getId() + message->getContent();
+    auto header = encodeMessageId(message->getId()) + Utils::convertToHex(message->getVersion(), VERSION_LENGTH);
+
+    // the delta is sent whenever it is smaller, so that small fixes of long messages cost only a few bytes
+    auto delta = message->hasDelta() ? message->getDelta().encode() : "";
+    if(message->hasDelta() && (message->getContent().empty() || delta.length() < message->getContent().length())) {
+        current_.typeIdentifier = 'D';
+        current_.messageContent = header + delta;
+    }
+    else {
+        current_.typeIdentifier = 'E';
+        current_.messageContent = header + message->getContent();
+    }
+    addTimestamps(message);
+}
+
+void StandardMessageConverter::addTimestamps(AbstractChatMessage *message) {
+    if(message->getCreatedAt() == 0) {
+        return;
+    }
+
+    // stamped on every encoding, so a retransmitted message carries the time it was actually sent again
+    message->setSentAt(Utils::getSteadyTimestamp());
+    current_.typeIdentifier = std::tolower(current_.typeIdentifier);
+    current_.messageContent.insert(MESSAGE_ID_LENGTH, Utils::convertToHex(message->getCreatedAt(), TIMESTAMP_LENGTH) + Utils::convertToHex(message->getSentAt(), TIMESTAMP_LENGTH));
 }
 
 std::shared_ptr<Message> EncryptedMessageConverter::convertToMessage(const std::string &message) const {
-    if(decryptor_ == nullptr) {
+    if(decryptor_ == nullptr || (message.length() > 7 && isPlaintextType(message[7]))) {
         return StandardMessageConverter::convertToMessage(message);
     }
 
-    auto decryptedMessageContent = decryptor_->decrypt(message.substr(8));
+    std::string decryptedMessageContent;
+    {
+        ScopedLatency latency(DECRYPT_LATENCY);
+        TraceSpan span("decrypt", "crypto");
+        decryptedMessageContent = decryptor_->decrypt(message.substr(8));
+    }
+
     std::stringstream ss;
     ss << Utils::convertToHex(decryptedMessageContent.length() + 8, 5) << "QC" << message[7] << decryptedMessageContent;
     return StandardMessageConverter::convertToMessage(ss.str());
@@ -105,25 +490,52 @@ std::shared_ptr<Message> EncryptedMessageConverter::convertToMessage(const std::
 
 std::string EncryptedMessageConverter::convertFromMessage(Message *message) {
     auto encodedMessage = StandardMessageConverter::convertFromMessage(message);
-    if(encryptor_ == nullptr) {
+    if(encryptor_ == nullptr || isPlaintextType(encodedMessage[7])) {
         return encodedMessage;
     }
 
-    auto encryptedContent = encryptor_->encrypt(encodedMessage.substr(8));
+    std::string encryptedContent;
+    {
+        ScopedLatency latency(ENCRYPT_LATENCY);
+        TraceSpan span("encrypt", "crypto");
+        encryptedContent = encryptor_->encrypt(encodedMessage.substr(8));
+    }
+
     auto type = encodedMessage[7];
     std::stringstream ss;
     ss << Utils::convertToHex(encryptedContent.length() + 8, 5) << "QC" << type << encryptedContent;
     return ss.str();
 }
 
+bool EncryptedMessageConverter::isPlaintextType(char type) {
+    return type == 'R' || type == 'G';
+}
+
 EncryptedSessionHandshakeProcessor::EncryptedSessionHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo)
     : keys_(keys),
       decryptor_(keys.getPrivateKey()),
-      userInfo_(userInfo)
+      userInfo_(userInfo),
+      handshakeStarted_(std::chrono::steady_clock::now()),
+      stageStarted_(handshakeStarted_)
 {
     messageConverter_ = std::make_shared<StandardMessageConverter>();
 }
 
+void EncryptedSessionHandshakeProcessor::recordStage(const Histogram &stage) {
+    auto now = std::chrono::steady_clock::now();
+    stage.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - stageStarted_).count());
+    stageStarted_ = now;
+}
+
+void EncryptedSessionHandshakeProcessor::recordFinish() {
+    recordStage(HANDSHAKE_USER_INFO_DURATION);
+    HANDSHAKE_TOTAL_DURATION.record(std::chrono::duration_cast<std::chrono::nanoseconds>(stageStarted_ - handshakeStarted_).count());
+}
+
+std::string EncryptedSessionHandshakeProcessor::getIdentityPayload(const std::string &receiverKey) const {
+    return "qtchat identity" + sessionKey_->encode() + receiverKey;
+}
+
 void EncryptedSessionHandshakeProcessor::end() {
     auto message = std::make_shared<SessionEndMessage>();
     auto encodedMessage = messageConverter_->convertFromMessage(message.get());
@@ -131,6 +543,8 @@ void EncryptedSessionHandshakeProcessor::end() {
 }
 
 void EncryptedSessionHandshakeProcessor::processMessage(const std::string &message) {
+    TraceSpan span("handshake_message", "handshake");
+
     if(finished_) {
         emit handshakeError(HANDSHAKE_ALREADY_FINISHED_ERROR);
     }
@@ -149,6 +563,38 @@ void EncryptedSessionHandshakeProcessor::processMessage(SessionEndMessage *messa
     emit handshakeError(HANDSHAKE_TERMINATED_ERROR);
 }
 
+void EncryptedSessionHandshakeProcessor::processMessage(GroupKeyMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(GroupChatMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(FileOfferMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(FileAcknowledgementMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(FileChunkMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(FileCancelMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(HistorySyncMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionHandshakeProcessor::processMessage(HistoryRecordMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
 void EncryptedSessionHandshakeProcessor::processMessage(NewChatMessage *message) {
     emit handshakeError(INVALID_MESSAGE_ERROR);
 }
@@ -157,6 +603,15 @@ void EncryptedSessionHandshakeProcessor::processMessage(EditChatMessage *message
     emit handshakeError(INVALID_MESSAGE_ERROR);
 }
 
+EncryptedSessionSenderHandshakeProcessor::EncryptedSessionSenderHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo,
+                                                                                   std::shared_ptr<SessionTicketStore> ticketStore, const std::string &ticketKey,
+                                                                                   bool resume, bool pipelined)
+    : EncryptedSessionHandshakeProcessor(keys, userInfo),
+      ticketStore_(ticketStore),
+      ticketKey_(ticketKey),
+      resume_(resume),
+      pipelined_(pipelined) {}
+
 void EncryptedSessionSenderHandshakeProcessor::startHandshake() {
     // do nothing, wait for public key from connection receiver
 }
@@ -167,7 +622,28 @@ void EncryptedSessionSenderHandshakeProcessor::processMessage(KeyMessage *messag
         emit handshakeError(DUPLICATE_KEY_ERROR);
     }
 
-    std::shared_ptr<RSAPublicKey> rsaKey(RSAPublicKey::decodeFromPEM(message->getEncodedKey()));
+    // present a resumption ticket instead of a new key if we have one; a second public key means it was rejected
+    SessionTicketStore::Entry ticket;
+    if(resume_ && !resumptionAttempted_ && ticketStore_ != nullptr && ticketStore_->tryTake(ticketKey_, ticket)) {
+        TraceSpan span("handshake_present_ticket", "handshake");
+        resumptionAttempted_ = true;
+        resumptionSecret_ = ticket.secret;
+        clientNonce_ = Resumption::generateNonce();
+
+        auto resumeMessage = std::make_shared<ResumeSessionMessage>(clientNonce_, ticket.ticket);
+        emit messageReady(messageConverter_->convertFromMessage(resumeMessage.get()));
+        return;
+    }
+
+    std::shared_ptr<RSAPublicKey> rsaKey;
+    {
+        // parsed only the first time a peer's key is seen
+        TraceSpan span("handshake_parse_public_key", "handshake");
+        rsaKey = PublicKeyCache::shared().get(message->getEncodedKey());
+    }
+    receiverKey_ = message->getEncodedKey();
+
+    TraceSpan span("handshake_wrap_session_key", "handshake");
     auto aesKey = std::make_shared<AESKey>();
     auto tempMessageConverter = std::make_shared<EncryptedMessageConverter>(rsaKey, aesKey);
     publicKeyReceived_ = true;
@@ -175,54 +651,203 @@ void EncryptedSessionSenderHandshakeProcessor::processMessage(KeyMessage *messag
     auto messageToSend = std::make_shared<KeyMessage>(aesKey->encode());
     auto encryptedMessage = tempMessageConverter->convertFromMessage(messageToSend.get());
 
+    sessionKey_ = aesKey;
     messageConverter_ = std::make_shared<EncryptedMessageConverter>(aesKey, aesKey);
     emit messageReady(encryptedMessage);
+    recordStage(HANDSHAKE_KEY_EXCHANGE_DURATION);
+
+    if(pipelined_) {
+        sendUserInfo();
+    }
 }
 
 void EncryptedSessionSenderHandshakeProcessor::processMessage(UserInfoMessage *message) {
-    auto ownUserInfoMessage = std::make_shared<UserInfoMessage>(userInfo_);
+    if(!publicKeyReceived_) {
+        finished_ = true;
+        emit handshakeError(DATA_RECEIVED_BEFORE_KEY);
+        return;
+    }
+
+    TraceSpan span("handshake_finish", "handshake");
+    if(!pipelined_) {
+        sendUserInfo();
+    }
+
+    // a resumed session keeps the identity proven when it was established
+    recordFinish();
+    emit handshakeFinished(messageConverter_, message->getUserInfo(), receiverKey_.empty() ? "" : PublicKeyCache::getFingerprint(receiverKey_));
+}
+
+void EncryptedSessionSenderHandshakeProcessor::processMessage(SessionTicketMessage *message) {
+    if(!publicKeyReceived_) {
+        finished_ = true;
+        emit handshakeError(DATA_RECEIVED_BEFORE_KEY);
+        return;
+    }
+
+    TraceSpan span("handshake_store_ticket", "handshake");
+    if(ticketStore_ != nullptr && !ticketKey_.empty()) {
+        ticketStore_->store(ticketKey_, message->getTicket(), sessionKey_->encode(), message->getLifetime());
+    }
+
+    emit sessionIdentified(message->getSessionId(), resumed_);
+}
+
+void EncryptedSessionSenderHandshakeProcessor::processMessage(ResumeSessionMessage *message) {
+    if(!resumptionAttempted_ || publicKeyReceived_) {
+        finished_ = true;
+        emit handshakeError(UNEXPECTED_RESUMPTION_ERROR);
+        return;
+    }
+
+    // resumption accepted, derive the new session key from the ticket secret and both nonces
+    TraceSpan span("handshake_derive_resumed_key", "handshake");
+    auto aesKey = std::make_shared<AESKey>(Resumption::deriveKey(resumptionSecret_, clientNonce_, message->getNonce()));
+    publicKeyReceived_ = true;
+    resumed_ = true;
+
+    sessionKey_ = aesKey;
+    messageConverter_ = std::make_shared<EncryptedMessageConverter>(aesKey, aesKey);
+    recordStage(HANDSHAKE_RESUMPTION_DURATION);
+
+    if(pipelined_) {
+        sendUserInfo();
+    }
+}
+
+void EncryptedSessionSenderHandshakeProcessor::sendUserInfo() {
+    TraceSpan span("handshake_send_user_info", "handshake");
+    std::string publicKey;
+    std::string signature;
+    auto privateKey = std::dynamic_pointer_cast<RSAPrivateKey>(keys_.getPrivateKey());
+    if(privateKey != nullptr) {
+        publicKey = keys_.getPublicKey()->encode();
+        signature = privateKey->sign(getIdentityPayload(receiverKey_));
+    }
+
+    auto ownUserInfoMessage = std::make_shared<UserInfoMessage>(userInfo_, publicKey, signature);
     auto encryptedMessage = messageConverter_->convertFromMessage(ownUserInfoMessage.get());
     emit messageReady(encryptedMessage);
-    emit handshakeFinished(messageConverter_, message->getUserInfo());
 }
 
-EncryptedSessionReceiverHandshakeProcessor::EncryptedSessionReceiverHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo)
-    : EncryptedSessionHandshakeProcessor(keys, userInfo)
+EncryptedSessionReceiverHandshakeProcessor::EncryptedSessionReceiverHandshakeProcessor(const KeyCombination &keys, UserInfo userInfo,
+                                                                                       std::shared_ptr<SessionTicketIssuer> ticketIssuer)
+    : EncryptedSessionHandshakeProcessor(keys, userInfo),
+      ticketIssuer_(ticketIssuer)
 {
     messageConverter_ = std::make_shared<EncryptedMessageConverter>(nullptr, keys_.getPrivateKey());
 }
 
 void EncryptedSessionReceiverHandshakeProcessor::startHandshake() {
+    TraceSpan span("handshake_send_public_key", "handshake");
     auto message = std::make_shared<KeyMessage>(keys_.getPublicKey()->encode());
     auto encodedMessage = messageConverter_->convertFromMessage(message.get());
     emit messageReady(encodedMessage);
 }
 
 void EncryptedSessionReceiverHandshakeProcessor::processMessage(KeyMessage *message) {
-    // AES key expected
+    // AES key expected, it was already unwrapped with the private key while decoding
+    TraceSpan span("handshake_accept_session_key", "handshake");
     auto aesKey = std::make_shared<AESKey>(message->getEncodedKey());
-    messageConverter_ = std::make_shared<EncryptedMessageConverter>(aesKey, aesKey);
-    auto messageToSend = std::make_shared<UserInfoMessage>(userInfo_);
-    auto encryptedMessage = messageConverter_->convertFromMessage(messageToSend.get());
-    publicKeyReceived_ = true;
-
-    emit messageReady(encryptedMessage);
+    sessionId_ = Resumption::generateSessionId();
+    establishSessionKey(aesKey, false);
 }
 
 void EncryptedSessionReceiverHandshakeProcessor::processMessage(UserInfoMessage *message) {
     if(!publicKeyReceived_) {
         finished_ = true;
         emit handshakeError(DATA_RECEIVED_BEFORE_KEY);
+        return;
+    }
+
+    TraceSpan span("handshake_finish", "handshake");
+    std::string fingerprint;
+    if(!message->getPublicKey().empty()) {
+        TraceSpan verifySpan("handshake_verify_identity", "handshake");
+        auto verified = false;
+        try {
+            auto payload = getIdentityPayload(resumed_ ? "" : keys_.getPublicKey()->encode());
+            verified = PublicKeyCache::shared().get(message->getPublicKey())->verify(payload, message->getSignature());
+        }
+        catch (const CryptoPP::Exception&) {}
+
+        if(!verified) {
+            finished_ = true;
+            emit handshakeError(INVALID_IDENTITY_ERROR);
+            return;
+        }
+        fingerprint = PublicKeyCache::getFingerprint(message->getPublicKey());
+    }
+
+    recordFinish();
+    emit handshakeFinished(messageConverter_, message->getUserInfo(), fingerprint);
+}
+
+void EncryptedSessionReceiverHandshakeProcessor::processMessage(SessionTicketMessage *message) {
+    emit handshakeError(INVALID_MESSAGE_ERROR);
+}
+
+void EncryptedSessionReceiverHandshakeProcessor::processMessage(ResumeSessionMessage *message) {
+    if(publicKeyReceived_) {
+        finished_ = true;
+        emit handshakeError(UNEXPECTED_RESUMPTION_ERROR);
+        return;
+    }
+
+    TraceSpan span("handshake_open_ticket", "handshake");
+    SessionTicket ticket;
+    if(ticketIssuer_ == nullptr || !ticketIssuer_->tryOpen(message->getTicket(), ticket)) {
+        // unknown or expired ticket, fall back to the full handshake by offering the public key again
+        startHandshake();
+        return;
+    }
+
+    auto serverNonce = Resumption::generateNonce();
+    auto aesKey = std::make_shared<AESKey>(Resumption::deriveKey(ticket.secret, message->getNonce(), serverNonce));
+
+    auto acceptMessage = std::make_shared<ResumeSessionMessage>(serverNonce);
+    emit messageReady(messageConverter_->convertFromMessage(acceptMessage.get()));
+
+    sessionId_ = ticket.sessionId;
+    establishSessionKey(aesKey, true);
+}
+
+void EncryptedSessionReceiverHandshakeProcessor::establishSessionKey(std::shared_ptr<AESKey> aesKey, bool resumed) {
+    sessionKey_ = aesKey;
+    messageConverter_ = std::make_shared<EncryptedMessageConverter>(aesKey, aesKey);
+    publicKeyReceived_ = true;
+    resumed_ = resumed;
+    recordStage(resumed ? HANDSHAKE_RESUMPTION_DURATION : HANDSHAKE_KEY_EXCHANGE_DURATION);
+
+    // the ticket is sent ahead of user info so the sender stores it before finishing its handshake
+    if(ticketIssuer_ != nullptr) {
+        TraceSpan span("handshake_issue_ticket", "handshake");
+        auto ticket = ticketIssuer_->issue(sessionId_, aesKey->encode());
+        auto ticketMessage = std::make_shared<SessionTicketMessage>(sessionId_, ticket, ticketIssuer_->getLifetime());
+        emit messageReady(messageConverter_->convertFromMessage(ticketMessage.get()));
+        emit sessionIdentified(sessionId_, resumed);
     }
 
-    emit handshakeFinished(messageConverter_, message->getUserInfo());
+    auto messageToSend = std::make_shared<UserInfoMessage>(userInfo_);
+    auto encryptedMessage = messageConverter_->convertFromMessage(messageToSend.get());
+    emit messageReady(encryptedMessage);
 }
 
 ChatSession::ChatSession(std::shared_ptr<Connection> connection, UserInfo userInfo, const KeyCombination &keyCombination) :
     connection_(connection),
+    acknowledgementTimer_(new QTimer(this)),
+    resumptionTimer_(new QTimer(this)),
+    keyCombination_(keyCombination),
     ownUserInfo_(userInfo),
-    keyCombination_(keyCombination)
+    ticketKey_(Resumption::generateSessionId())
 {
+    acknowledgementTimer_->setSingleShot(true);
+    resumptionTimer_->setSingleShot(true);
+    QObject::connect(acknowledgementTimer_, &QTimer::timeout, this, &ChatSession::sendAcknowledgement);
+    QObject::connect(resumptionTimer_, &QTimer::timeout, this, &ChatSession::handleResumptionTimeout);
+    QObject::connect(this, &ChatSession::invalidMessageReceived, this, [] { INVALID_MESSAGES.add(); });
+    ALLOCATED_SESSIONS.add();
+
     if(connection->isConnected()) {
         connected_ = true;
         emit connectionEstablished();
@@ -232,29 +857,83 @@ ChatSession::ChatSession(std::shared_ptr<Connection> connection, UserInfo userIn
     }
 }
 
+ChatSession::~ChatSession() {
+    ALLOCATED_SESSIONS.add(-1);
+}
+
 void ChatSession::initialize(std::unique_ptr<SessionHandshakeProcessor> &&handshakeProcessor) {
     if(!connected_) {
         throw std::runtime_error("Connection has not been established yet.");
     }
 
-    QObject::connect(connection_.get(), &Connection::disconnected, this, &ChatSession::handleDisconnect);
+    QObject::connect(connection_.get(), &Connection::disconnected, this, &ChatSession::handleDisconnect, Qt::UniqueConnection);
 
+    initiator_ = handshakeProcessor->isInitiator();
     handshakeProcessor_ = std::move(handshakeProcessor);
     QObject::connect(connection_.get(), &Connection::messageReceived, handshakeProcessor_.get(), &SessionHandshakeProcessor::processMessage);
     QObject::connect(handshakeProcessor_.get(), &SessionHandshakeProcessor::messageReady, connection_.get(), &Connection::send);
+    QObject::connect(handshakeProcessor_.get(), &SessionHandshakeProcessor::sessionIdentified, this, &ChatSession::handleSessionIdentified);
     QObject::connect(handshakeProcessor_.get(), &SessionHandshakeProcessor::handshakeFinished, this, &ChatSession::handleHandshakeFinish);
     QObject::connect(handshakeProcessor_.get(), &SessionHandshakeProcessor::handshakeError, this, &ChatSession::handleHandshakeError);
     handshakeProcessor_->startHandshake();
 }
 
+void ChatSession::resume(std::shared_ptr<Connection> connection, std::unique_ptr<SessionHandshakeProcessor> &&handshakeProcessor) {
+    if(!isAwaitingResumption()) {
+        return;
+    }
+
+    QObject::disconnect(connection_.get(), nullptr, this, nullptr);
+    connection_ = connection;
+    pendingHandshakeProcessor_ = std::move(handshakeProcessor);
+    resuming_ = true;
+    connected_ = false;
+
+    QObject::connect(connection_.get(), &Connection::disconnected, this, &ChatSession::handleDisconnect, Qt::UniqueConnection);
+    if(connection_->isConnected()) {
+        handleConnectionEstablished();
+    }
+    else {
+        QObject::connect(connection_.get(), &Connection::connected, this, &ChatSession::handleConnectionEstablished);
+    }
+}
+
+void ChatSession::takeOver(ChatSession &other) {
+    QObject::disconnect(connection_.get(), nullptr, this, nullptr);
+    QObject::disconnect(other.connection_.get(), nullptr, &other, nullptr);
+
+    connection_ = other.connection_;
+    handshakeProcessor_ = std::move(other.handshakeProcessor_);
+    messageConverter_ = other.messageConverter_;
+    otherUserInfo_ = other.otherUserInfo_;
+    otherKeyFingerprint_ = other.otherKeyFingerprint_;
+    other.transferred_ = true;
+    other.ended_ = true;
+
+    connected_ = true;
+    resuming_ = false;
+    resumptionTimer_->stop();
+
+    QObject::connect(connection_.get(), &Connection::disconnected, this, &ChatSession::handleDisconnect, Qt::UniqueConnection);
+    attachConnection();
+    replayUnacknowledged();
+    emit connectionRestored();
+}
+
+bool ChatSession::isAwaitingResumption() const {
+    return initialized_ && !ended_ && resumptionTimer_->isActive();
+}
+
 void ChatSession::end() {
     if(ended_) {
         return;
     }
 
     ended_ = true;
+    acknowledgementTimer_->stop();
+    resumptionTimer_->stop();
 
-    if(initialized_) {
+    if(initialized_ && connected_ && !resuming_) {
         auto sessionEndMessage = std::make_shared<SessionEndMessage>();
         sendMessage(sessionEndMessage);
     }
@@ -269,7 +948,40 @@ void ChatSession::end() {
 
 void ChatSession::sendMessage(std::shared_ptr<Message> message) {
     auto encoded = messageConverter_->convertFromMessage(message.get());
-    connection_->send(encoded);
+
+    unsigned int sequence = 0;
+    if(ReliableDelivery::isSequenced(encoded[7])) {
+        sequence = reliability_.track(message);
+    }
+
+    // while the connection is lost, sequenced messages wait in the retransmit buffer until the session is resumed
+    if(!connected_ || resuming_) {
+        return;
+    }
+    // beyond the retransmit window they wait as well, until the other side acknowledges earlier ones
+    if(sequence != 0 && !reliability_.markSent(sequence)) {
+        return;
+    }
+
+    acknowledgementTimer_->stop();
+    connection_->send(reliability_.frame(encoded, sequence));
+    recordSendQueueLatency(message.get());
+}
+
+long long ChatSession::getPendingBytes() const {
+    if(!connected_ || resuming_) {
+        return 0;
+    }
+
+    return connection_->getPendingBytes();
+}
+
+void ChatSession::sendFrame(const QByteArray &frame) {
+    if(!initialized_ || ended_ || !connected_ || resuming_) {
+        return;
+    }
+
+    connection_->sendFrame(frame);
 }
 
 void ChatSession::processMessage(KeyMessage *message) {
@@ -280,44 +992,136 @@ void ChatSession::processMessage(UserInfoMessage *message) {
     otherUserInfo_ = message->getUserInfo();
 }
 
+void ChatSession::processMessage(SessionTicketMessage *message) {
+    emit invalidMessageReceived(INVALID_MESSAGE_ERROR);
+}
+
+void ChatSession::processMessage(ResumeSessionMessage *message) {
+    emit invalidMessageReceived(UNEXPECTED_RESUMPTION_ERROR);
+}
+
 void ChatSession::processMessage(SessionEndMessage *message) {
     ended_ = true;
     emit sessionEndedByOtherSide();
 }
 
+void ChatSession::processMessage(GroupKeyMessage *message) {
+    emit groupKeyReceived(message);
+}
+
+void ChatSession::processMessage(GroupChatMessage *message) {
+    emit groupMessageReceived(message);
+}
+
+void ChatSession::processMessage(FileOfferMessage *message) {
+    emit fileOfferReceived(message);
+}
+
+void ChatSession::processMessage(FileAcknowledgementMessage *message) {
+    emit fileAcknowledgementReceived(message);
+}
+
+void ChatSession::processMessage(FileChunkMessage *message) {
+    emit fileChunkReceived(message);
+}
+
+void ChatSession::processMessage(FileCancelMessage *message) {
+    emit fileCancelReceived(message);
+}
+
+void ChatSession::processMessage(HistorySyncMessage *message) {
+    emit historySyncReceived(message);
+}
+
+void ChatSession::processMessage(HistoryRecordMessage *message) {
+    emit historyRecordReceived(message);
+}
+
 void ChatSession::processMessage(NewChatMessage *message) {
     emit newChatMessageReceived(message);
+    recordLatency(message);
 }
 
 void ChatSession::processMessage(EditChatMessage *message) {
     emit editedChatMessageReceived(message);
+    recordLatency(message);
 }
 
 void ChatSession::handleConnectionEstablished() {
     connected_ = true;
     QObject::disconnect(connection_.get(), &Connection::connected, this, nullptr);
+
+    if(resuming_) {
+        initialize(std::move(pendingHandshakeProcessor_));
+        return;
+    }
+
     emit connectionEstablished();
 }
 
-void ChatSession::handleHandshakeFinish(std::shared_ptr<MessageConverter> messagePreprocessor, UserInfo otherUserInfo) {
-    initialized_ = true;
+void ChatSession::handleSessionIdentified(const std::string &sessionId, bool resumed) {
+    sessionId_ = sessionId;
+    resumedHandshake_ = resumed;
+}
+
+void ChatSession::handleHandshakeFinish(std::shared_ptr<MessageConverter> messagePreprocessor, UserInfo otherUserInfo, const std::string &otherKeyFingerprint) {
     messageConverter_ = messagePreprocessor;
     otherUserInfo_ = otherUserInfo;
+    if(!resuming_ || !otherKeyFingerprint.empty()) {
+        otherKeyFingerprint_ = otherKeyFingerprint;
+    }
     QObject::disconnect(connection_.get(), &Connection::messageReceived, handshakeProcessor_.get(), &SessionHandshakeProcessor::processMessage);
     QObject::disconnect(handshakeProcessor_.get(), nullptr, this, nullptr);
-    QObject::connect(connection_.get(), &Connection::messageReceived, this, &ChatSession::processReceivedMessage);
+
+    if(resuming_) {
+        resuming_ = false;
+        resumptionTimer_->stop();
+        attachConnection();
+        replayUnacknowledged();
+        emit connectionRestored();
+        return;
+    }
+
+    if(!sessionId_.empty()) {
+        // a receiver of this signal may hand the connection over to an earlier session being resumed
+        emit sessionIdentified(sessionId_, resumedHandshake_);
+        if(transferred_) {
+            emit sessionTransferred();
+            return;
+        }
+    }
+
+    initialized_ = true;
+    attachConnection();
     emit sessionInitialized();
 }
 
 void ChatSession::handleHandshakeError() {
+    HANDSHAKE_ERRORS.add();
     QObject::disconnect(connection_.get(), &Connection::messageReceived, handshakeProcessor_.get(), &SessionHandshakeProcessor::processMessage);
     QObject::disconnect(handshakeProcessor_.get(), nullptr, this, nullptr);
+
+    if(resuming_) {
+        QObject::disconnect(connection_.get(), nullptr, this, nullptr);
+        connection_->close();
+        connected_ = false;
+        awaitResumption();
+        return;
+    }
+
     emit sessionInitializationError();
 }
 
 void ChatSession::handleDisconnect() {
     QObject::disconnect(connection_.get(), nullptr, this, nullptr);
     QObject::disconnect(handshakeProcessor_.get(), nullptr, this, nullptr);
+    connected_ = false;
+
+    if(initialized_ && !ended_ && !sessionId_.empty()) {
+        awaitResumption();
+        return;
+    }
+
     if(!initialized_) {
         emit sessionInitializationError();
     }
@@ -327,24 +1131,181 @@ void ChatSession::handleDisconnect() {
 }
 
 void ChatSession::processReceivedMessage(const std::string &message) {
+    receivedAt_ = Utils::getSteadyTimestamp();
+    auto acknowledged = reliability_.getAcknowledged();
+
     try {
-        auto convertedMessage = messageConverter_->convertToMessage(message);
-        convertedMessage->process(this);
+        std::string encodedMessage;
+        if(reliability_.receive(message, encodedMessage)) {
+            auto convertedMessage = messageConverter_->convertToMessage(encodedMessage);
+            decodedAt_ = Utils::getSteadyTimestamp();
+            TraceSpan span("dispatch", "messaging");
+            convertedMessage->process(this);
+        }
     }
     catch (std::runtime_error &error) {
         emit invalidMessageReceived(error.what());
     }
+
+    // acknowledgements are piggybacked on outgoing messages, a standalone one is only sent if there are none
+    if(reliability_.isAcknowledgementPending() && !acknowledgementTimer_->isActive()) {
+        acknowledgementTimer_->start(ACKNOWLEDGEMENT_DELAY);
+    }
+    if(reliability_.getAcknowledged() > acknowledged) {
+        if(connected_ && !resuming_) {
+            sendHeld();
+        }
+        emit messagesAcknowledged();
+    }
+}
+
+void ChatSession::sendAcknowledgement() {
+    if(!connected_ || resuming_ || ended_ || !reliability_.isAcknowledgementPending()) {
+        return;
+    }
+
+    connection_->send(reliability_.frameAcknowledgement());
+}
+
+void ChatSession::handleResumptionTimeout() {
+    ended_ = true;
+    resuming_ = false;
+    QObject::disconnect(connection_.get(), nullptr, this, nullptr);
+    QObject::disconnect(handshakeProcessor_.get(), nullptr, this, nullptr);
+    connection_->close();
+
+    emit sessionEndedByOtherSide();
+}
+
+void ChatSession::attachConnection() {
+    QObject::connect(connection_.get(), &Connection::messageReceived, this, &ChatSession::processReceivedMessage, Qt::UniqueConnection);
+    QObject::connect(connection_.get(), &Connection::bytesWritten, this, &ChatSession::bytesWritten, Qt::UniqueConnection);
+}
+
+void ChatSession::awaitResumption() {
+    acknowledgementTimer_->stop();
+    if(!resumptionTimer_->isActive()) {
+        resumptionTimer_->start(RESUMPTION_GRACE_PERIOD);
+    }
+
+    emit connectionLost();
+}
+
+void ChatSession::replayUnacknowledged() {
+    // the continuation frame also tells the other side what arrived, so it can release its own retransmit buffer
+    reliability_.expectContinuation();
+    connection_->send(reliability_.frameContinuation());
+
+    reliability_.restartSending();
+    sendHeld();
+}
+
+void ChatSession::sendHeld() {
+    for(auto &entry : reliability_.takeSendable()) {
+        auto encoded = messageConverter_->convertFromMessage(entry.second.get());
+        connection_->send(reliability_.frame(encoded, entry.first));
+        recordSendQueueLatency(entry.second.get());
+    }
+}
+
+void ChatSession::recordSendQueueLatency(Message *message) {
+    auto chatMessage = dynamic_cast<AbstractChatMessage*>(message);
+    if(chatMessage != nullptr && chatMessage->getCreatedAt() != 0) {
+        recordMicroseconds(SEND_QUEUE_LATENCY, chatMessage->getSentAt() - chatMessage->getCreatedAt());
+    }
+}
+
+void ChatSession::recordLatency(AbstractChatMessage *message) {
+    if(message->getCreatedAt() == 0) {
+        return;
+    }
+
+    recordMicroseconds(PEER_SEND_QUEUE_LATENCY, message->getSentAt() - message->getCreatedAt());
+    recordMicroseconds(RECEIVE_DECODE_LATENCY, decodedAt_ - receivedAt_);
+
+    PendingRender pending;
+    pending.decodedAt = decodedAt_;
+    pending.latency.sendQueue = (message->getSentAt() - message->getCreatedAt()) / 1000.0;
+    pending.latency.decode = (decodedAt_ - receivedAt_) / 1000.0;
+
+    // the sender's timestamps are converted to our clock
+    if(connection_->isClockOffsetKnown()) {
+        auto offset = connection_->getClockOffset();
+        recordMicroseconds(NETWORK_LATENCY, receivedAt_ - (message->getSentAt() - offset));
+        pending.latency.network = (receivedAt_ - (message->getSentAt() - offset)) / 1000.0;
+        pending.createdAt = message->getCreatedAt() - offset;
+    }
+
+    // the user interface shows received messages in batches, the rest is recorded once the batch is applied
+    auto id = message->getId();
+    pendingRenders_.insert(id, pending);
+    pendingRenderOrder_.emplace_back(id, decodedAt_);
+    while(pendingRenderOrder_.size() > MAX_PENDING_RENDERS) {
+        auto oldest = pendingRenderOrder_.front();
+        auto found = pendingRenders_.find(oldest.first);
+        if(found != nullptr && found->decodedAt == oldest.second) {
+            pendingRenders_.erase(oldest.first);
+        }
+        pendingRenderOrder_.pop_front();
+    }
+}
+
+void ChatSession::recordRendered(const std::vector<MessageId> &ids) {
+    auto renderedAt = Utils::getSteadyTimestamp();
+    for(auto id : ids) {
+        auto found = pendingRenders_.find(id);
+        if(found == nullptr) {
+            continue;
+        }
+
+        auto latency = found->latency;
+        latency.render = (renderedAt - found->decodedAt) / 1000.0;
+        recordMicroseconds(RENDER_LATENCY, renderedAt - found->decodedAt);
+        if(found->createdAt != 0) {
+            recordMicroseconds(END_TO_END_LATENCY, renderedAt - found->createdAt);
+            latency.total = (renderedAt - found->createdAt) / 1000.0;
+        }
+        pendingRenders_.erase(id);
+
+        auto first = latencySamples_ == 0;
+        averageLatency_.sendQueue = updateAverage(averageLatency_.sendQueue, latency.sendQueue, first);
+        averageLatency_.network = updateAverage(averageLatency_.network, latency.network, first);
+        averageLatency_.decode = updateAverage(averageLatency_.decode, latency.decode, first);
+        averageLatency_.render = updateAverage(averageLatency_.render, latency.render, first);
+        averageLatency_.total = updateAverage(averageLatency_.total, latency.total, first);
+        lastLatency_ = latency;
+        ++latencySamples_;
+    }
+
+    // everything left in the queue was either shown now or is older
+    while(!pendingRenderOrder_.empty() && pendingRenders_.find(pendingRenderOrder_.front().first) == nullptr) {
+        pendingRenderOrder_.pop_front();
+    }
+}
+
+SessionDiagnostics ChatSession::getDiagnostics() const {
+    SessionDiagnostics diagnostics;
+    diagnostics.smoothedRtt = connection_->getSmoothedRtt();
+    diagnostics.rttVariation = connection_->getRttVariation();
+    diagnostics.clockOffsetKnown = connection_->isClockOffsetKnown();
+    diagnostics.clockOffset = connection_->getClockOffset() / 1000.0;
+    diagnostics.latencySamples = latencySamples_;
+    diagnostics.lastLatency = lastLatency_;
+    diagnostics.averageLatency = averageLatency_;
+    return diagnostics;
 }
 
 ChatSessionCreator::ChatSessionCreator(UserInfo userInfo, const KeyCombination &keyCombination) :
     userInfo_(userInfo),
-    encryptionKeys_(keyCombination)
+    encryptionKeys_(keyCombination),
+    ticketIssuer_(std::make_shared<SessionTicketIssuer>()),
+    ticketStore_(std::make_shared<SessionTicketStore>())
 {
     connectionManager_ = std::make_unique<TcpServer>();
 }
 
-void ChatSessionCreator::allowConnections(int port) {
-    connectionManager_->listen(port);
+void ChatSessionCreator::allowConnections(int port, const QHostAddress &address) {
+    connectionManager_->listen(port, address);
     QObject::connect(connectionManager_.get(), &Server::connectionReceived, this, &ChatSessionCreator::handleConnectionReceived);
 }
 
@@ -355,7 +1316,18 @@ void ChatSessionCreator::disallowConnections() {
 
 std::shared_ptr<ChatSession> ChatSessionCreator::tryConnect(std::string &host, int port) {
     auto connection = connectionManager_->connect(host, port);
-    return createSession(connection);
+    auto session = createSession(connection);
+
+    // the initiating side re-establishes lost connections, the receiving side waits to be resumed
+    std::weak_ptr<ChatSession> weakSession = session;
+    QObject::connect(session.get(), &ChatSession::connectionLost, this, [this, weakSession, host, port] {
+        QTimer::singleShot(RECONNECT_DELAY, this, [this, weakSession, host, port] { reconnect(weakSession, host, port); });
+    });
+    auto ticketStore = ticketStore_;
+    auto ticketKey = session->getTicketKey();
+    QObject::connect(session.get(), &QObject::destroyed, [ticketStore, ticketKey] { ticketStore->remove(ticketKey); });
+
+    return session;
 }
 
 void ChatSessionCreator::setUserInfo(UserInfo userInfo) {
@@ -366,8 +1338,18 @@ void ChatSessionCreator::setKeys(const KeyCombination &keyCombination) {
     encryptionKeys_ = keyCombination;
 }
 
+void ChatSessionCreator::setHeartbeat(int interval, int timeout) {
+    connectionManager_->setHeartbeat(interval, timeout);
+}
+
 void ChatSessionCreator::handleConnectionReceived(std::shared_ptr<Connection> connection) {
     auto session = createSession(connection);
+
+    std::weak_ptr<ChatSession> weakSession = session;
+    QObject::connect(session.get(), &ChatSession::sessionIdentified, this, [this, weakSession](const std::string &sessionId, bool resumed) {
+        handleSessionIdentified(weakSession, sessionId, resumed);
+    });
+
     emit chatRequestReceived(session);
 }
 
@@ -375,3 +1357,40 @@ std::shared_ptr<ChatSession> ChatSessionCreator::createSession(std::shared_ptr<C
     auto session = std::make_shared<ChatSession>(connection, userInfo_, encryptionKeys_);
     return session;
 }
+
+void ChatSessionCreator::handleSessionIdentified(std::weak_ptr<ChatSession> weakSession, const std::string &sessionId, bool resumed) {
+    auto session = weakSession.lock();
+    if(session == nullptr) {
+        return;
+    }
+
+    if(resumed && resumableSessions_.count(sessionId) > 0) {
+        auto previous = resumableSessions_[sessionId].lock();
+        if(previous != nullptr && previous != session && previous->isAwaitingResumption()) {
+            previous->takeOver(*session);
+            return;
+        }
+    }
+
+    for(auto it = resumableSessions_.begin(); it != resumableSessions_.end();) {
+        if(it->second.expired()) {
+            it = resumableSessions_.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    resumableSessions_[sessionId] = session;
+}
+
+void ChatSessionCreator::reconnect(std::weak_ptr<ChatSession> weakSession, const std::string &host, int port) {
+    auto session = weakSession.lock();
+    if(session == nullptr || !session->isAwaitingResumption()) {
+        return;
+    }
+
+    auto connection = connectionManager_->connect(host, port);
+    auto handshakeProcessor = std::make_unique<EncryptedSessionSenderHandshakeProcessor>(encryptionKeys_, userInfo_, ticketStore_, session->getTicketKey(), true);
+    session->resume(connection, std::move(handshakeProcessor));
+}
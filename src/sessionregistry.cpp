@@ -0,0 +1,110 @@
+#include "sessionregistry.h"
+
+const Counter CONNECTING_SESSIONS = Metrics::gauge("qtchat_sessions_connecting");
+const Counter HANDSHAKING_SESSIONS = Metrics::gauge("qtchat_sessions_handshaking");
+const Counter ACTIVE_SESSIONS = Metrics::gauge("qtchat_sessions_active");
+const Counter ENDED_SESSIONS = Metrics::counter("qtchat_sessions_ended_total");
+
+namespace {
+    const Counter* getGauge(SessionState state) {
+        switch(state) {
+        case SessionState::Connecting:
+            return &CONNECTING_SESSIONS;
+        case SessionState::Handshaking:
+            return &HANDSHAKING_SESSIONS;
+        case SessionState::Active:
+            return &ACTIVE_SESSIONS;
+        default:
+            return nullptr;
+        }
+    }
+}
+
+SessionRegistry::~SessionRegistry() {
+    while(!sessions_.empty()) {
+        end(sessions_.begin()->first);
+    }
+    ended_.clear();
+}
+
+void SessionRegistry::add(std::shared_ptr<ChatSession> session, SessionState state) {
+    auto raw = session.get();
+    if(state == SessionState::Ended || sessions_.count(raw) > 0) {
+        return;
+    }
+
+    sessions_.emplace(raw, std::make_pair(session, state));
+    getGauge(state)->add();
+
+    // the connections hold no reference to the session, it is only kept alive by the registry
+    QObject::connect(raw, &ChatSession::connectionEstablished, this, [this, raw] { setState(raw, SessionState::Handshaking); });
+    QObject::connect(raw, &ChatSession::sessionInitialized, this, [this, raw] { setState(raw, SessionState::Active); });
+    QObject::connect(raw, &ChatSession::sessionInitializationError, this, [this, raw] { end(raw); });
+    QObject::connect(raw, &ChatSession::sessionTransferred, this, [this, raw] { end(raw); });
+    QObject::connect(raw, &ChatSession::sessionEndedByOtherSide, this, [this, raw] { end(raw); });
+}
+
+void SessionRegistry::end(ChatSession *session) {
+    auto found = sessions_.find(session);
+    if(found == sessions_.end()) {
+        return;
+    }
+
+    auto owned = found->second.first;
+    getGauge(found->second.second)->add(-1);
+    ENDED_SESSIONS.add();
+    sessions_.erase(found);
+
+    QObject::disconnect(session, nullptr, this, nullptr);
+    session->end();
+    emit sessionStateChanged(session, SessionState::Ended);
+
+    if(ended_.empty()) {
+        QMetaObject::invokeMethod(this, &SessionRegistry::release, Qt::QueuedConnection);
+    }
+    ended_.push_back(owned);
+}
+
+std::shared_ptr<ChatSession> SessionRegistry::find(ChatSession *session) const {
+    auto found = sessions_.find(session);
+    return found == sessions_.end() ? nullptr : found->second.first;
+}
+
+SessionState SessionRegistry::getState(ChatSession *session) const {
+    auto found = sessions_.find(session);
+    return found == sessions_.end() ? SessionState::Ended : found->second.second;
+}
+
+size_t SessionRegistry::getCount(SessionState state) const {
+    if(state == SessionState::Ended) {
+        return ended_.size();
+    }
+
+    size_t count = 0;
+    for(auto &session : sessions_) {
+        if(session.second.second == state) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+size_t SessionRegistry::getLiveCount() const {
+    return sessions_.size();
+}
+
+void SessionRegistry::setState(ChatSession *session, SessionState state) {
+    auto found = sessions_.find(session);
+    if(found == sessions_.end() || found->second.second == state) {
+        return;
+    }
+
+    getGauge(found->second.second)->add(-1);
+    getGauge(state)->add();
+    found->second.second = state;
+    emit sessionStateChanged(session, state);
+}
+
+void SessionRegistry::release() {
+    ended_.clear();
+}
@@ -59,6 +59,12 @@ void SettingsWindow::onSaveButtonClicked()
     auto port = std::stoi(ui->portEdit->text().toStdString());
 
     auto config = Configuration(publicKeyFile, privateKeyFile, username, port);
+    config.metricsSocket = config_.metricsSocket;
+    config.metricsDumpPath = config_.metricsDumpPath;
+    config.metricsDumpInterval = config_.metricsDumpInterval;
+    config.latencyTimestamps = config_.latencyTimestamps;
+    config.historyPath = config_.historyPath;
+    config.outboxPath = config_.outboxPath;
     emit configurationChanged(config);
 
     close();
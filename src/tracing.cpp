@@ -0,0 +1,120 @@
+#include "tracing.h"
+
+#include <iomanip>
+#include <stdexcept>
+
+#include <QCoreApplication>
+
+const std::string TRACE_FILE_ERROR = "Trace file could not be opened.";
+const std::string TRACING_ALREADY_STARTED_ERROR = "Tracing was already started.";
+
+const std::chrono::milliseconds FLUSH_INTERVAL(100);
+const size_t FLUSH_THRESHOLD = 4096;
+
+std::atomic<bool> Tracer::enabled_{false};
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::~Tracer() {
+    stop();
+}
+
+void Tracer::start(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(running_) {
+        throw std::runtime_error(TRACING_ALREADY_STARTED_ERROR);
+    }
+
+    fileStream_.open(path, std::ios::trunc);
+    if(!fileStream_.is_open()) {
+        throw std::runtime_error(TRACE_FILE_ERROR);
+    }
+
+    fileStream_ << std::fixed << std::setprecision(3);
+    // the array format stays readable when the process is killed before the closing bracket is written
+    fileStream_ << "[";
+    origin_ = std::chrono::steady_clock::now();
+    processId_ = QCoreApplication::applicationPid();
+    firstEvent_ = true;
+    running_ = true;
+
+    writer_ = std::thread(&Tracer::writeEvents, this);
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::stop() {
+    enabled_.store(false, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!running_) {
+            return;
+        }
+        running_ = false;
+    }
+
+    condition_.notify_one();
+    writer_.join();
+
+    fileStream_ << "]" << std::endl;
+    fileStream_.close();
+}
+
+void Tracer::record(const char *name, const char *category, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    auto threadId = getThreadId();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // spans which were started before tracing was stopped are dropped
+    if(!running_) {
+        return;
+    }
+
+    TraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.start = std::chrono::duration<double, std::micro>(start - origin_).count();
+    event.duration = std::chrono::duration<double, std::micro>(end - start).count();
+    event.threadId = threadId;
+    pending_.push_back(event);
+
+    if(pending_.size() == FLUSH_THRESHOLD) {
+        condition_.notify_one();
+    }
+}
+
+void Tracer::writeEvents() {
+    std::vector<TraceEvent> events;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while(true) {
+        condition_.wait_for(lock, FLUSH_INTERVAL, [this] { return !running_ || pending_.size() >= FLUSH_THRESHOLD; });
+        events.swap(pending_);
+        auto running = running_;
+
+        // recording threads only wait for the swap, not for the file
+        lock.unlock();
+        for(auto &event : events) {
+            fileStream_ << (firstEvent_ ? "\n" : ",\n");
+            fileStream_ << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":" << event.start
+                        << ",\"dur\":" << event.duration << ",\"pid\":" << processId_ << ",\"tid\":" << event.threadId << "}";
+            firstEvent_ = false;
+        }
+        fileStream_.flush();
+        events.clear();
+        lock.lock();
+
+        if(!running) {
+            return;
+        }
+    }
+}
+
+unsigned int Tracer::getThreadId() {
+    static std::atomic<unsigned int> nextThreadId{1};
+    thread_local unsigned int threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+    return threadId;
+}
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -9,12 +10,16 @@
 
 namespace fs = std::filesystem;
 
-std::string Utils::convertToHex(int num, int digits) {
+std::string Utils::convertToHex(long long num, int digits) {
     std::stringstream ss;
     ss << std::hex << std::setw(digits) << std::setfill('0') << num;
     return ss.str();
 }
 
+long long Utils::getSteadyTimestamp() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 std::string Utils::loadFile(const std::string &path) {
     std::ifstream fileStream;
     fileStream.open(path);
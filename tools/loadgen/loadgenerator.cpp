@@ -0,0 +1,214 @@
+#include "loadgenerator.h"
+#include "utils.h"
+
+#include <algorithm>
+
+const std::string LOCALHOST = "127.0.0.1";
+const int TICK_INTERVAL = 10;
+const unsigned int TIMESTAMP_LENGTH = 16;
+const double MAX_DUE_SECONDS = 0.1; // bounds bursts after the event loop stalls
+
+namespace {
+    long long currentTimestamp() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double secondsSince(std::chrono::steady_clock::time_point &last) {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration<double>(now - last).count();
+        last = now;
+        return elapsed;
+    }
+}
+
+LoadResponder::LoadResponder(const LoadConfiguration &configuration, UserInfo userInfo, const KeyCombination &keys) :
+    configuration_(configuration),
+    userInfo_(userInfo),
+    keys_(keys),
+    sessionCreator_(userInfo, keys)
+{
+    QObject::connect(&sessionCreator_, &ChatSessionCreator::chatRequestReceived, this, &LoadResponder::handleChatRequest);
+}
+
+void LoadResponder::start() {
+    sessionCreator_.allowConnections(configuration_.port, QHostAddress::LocalHost);
+}
+
+void LoadResponder::stop() {
+    sessionCreator_.disallowConnections();
+    for(auto &session : sessions_) {
+        QObject::disconnect(session.get(), nullptr, this, nullptr);
+        session->end();
+    }
+}
+
+void LoadResponder::handleChatRequest(std::shared_ptr<ChatSession> session) {
+    sessions_.push_back(session);
+
+    auto ticketIssuer = configuration_.resumption ? sessionCreator_.getTicketIssuer() : nullptr;
+    auto handshakeProcessor = std::make_unique<EncryptedSessionReceiverHandshakeProcessor>(keys_, userInfo_, ticketIssuer);
+
+    QObject::connect(session.get(), &ChatSession::sessionInitialized, this, [this] { ++statistics_.sessionsEstablished; });
+    QObject::connect(session.get(), &ChatSession::sessionInitializationError, this, [this] { ++statistics_.sessionErrors; });
+    QObject::connect(session.get(), &ChatSession::sessionEndedByOtherSide, this, [this] { ++statistics_.sessionsEnded; });
+    QObject::connect(session.get(), &ChatSession::connectionLost, this, [this] { ++statistics_.connectionsLost; });
+    QObject::connect(session.get(), &ChatSession::invalidMessageReceived, this, [this] { ++statistics_.invalidMessages; });
+    QObject::connect(session.get(), &ChatSession::newChatMessageReceived, this, [this](NewChatMessage *message) { handleChatMessage(message, false); });
+    QObject::connect(session.get(), &ChatSession::editedChatMessageReceived, this, [this](EditChatMessage *message) { handleChatMessage(message, true); });
+
+    session->initialize(std::move(handshakeProcessor));
+}
+
+void LoadResponder::handleChatMessage(AbstractChatMessage *message, bool edit) {
+    auto content = message->getContent();
+    ++statistics_.messagesReceived;
+    statistics_.bytesReceived += content.length();
+    if(edit) {
+        ++statistics_.editsReceived;
+    }
+
+    // the steady clock is shared by all processes on this machine, so the sender's timestamp can be compared directly
+    if(content.length() >= TIMESTAMP_LENGTH) {
+        try {
+            auto sentAt = std::stoll(content.substr(0, TIMESTAMP_LENGTH), 0, 16);
+            statistics_.deliveryLatencies.push_back((currentTimestamp() - sentAt) / 1000.0);
+        }
+        catch (const std::logic_error&) {
+            // not sent by the load generator
+        }
+    }
+}
+
+LoadGenerator::LoadGenerator(const LoadConfiguration &configuration, UserInfo userInfo, const KeyCombination &keys) :
+    configuration_(configuration),
+    userInfo_(userInfo),
+    keys_(keys),
+    sessionCreator_(userInfo, keys),
+    connectTimer_(new QTimer(this)),
+    sendTimer_(new QTimer(this)),
+    random_(std::random_device()())
+{
+    QObject::connect(connectTimer_, &QTimer::timeout, this, &LoadGenerator::openSessions);
+    QObject::connect(sendTimer_, &QTimer::timeout, this, &LoadGenerator::sendMessages);
+}
+
+void LoadGenerator::start() {
+    started_ = std::chrono::steady_clock::now();
+    lastConnect_ = started_;
+    lastSend_ = started_;
+
+    peers_.reserve(configuration_.sessions);
+    connectTimer_->start(TICK_INTERVAL);
+    sendTimer_->start(TICK_INTERVAL);
+    QTimer::singleShot(configuration_.duration * 1000, this, &LoadGenerator::finished);
+}
+
+void LoadGenerator::stop() {
+    connectTimer_->stop();
+    sendTimer_->stop();
+}
+
+void LoadGenerator::closeSessions() {
+    for(auto &peer : peers_) {
+        QObject::disconnect(peer.session.get(), nullptr, this, nullptr);
+        peer.session->end();
+    }
+}
+
+double LoadGenerator::getElapsedTime() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - started_).count();
+}
+
+void LoadGenerator::openSessions() {
+    connectsDue_ = std::min(connectsDue_ + configuration_.connectRate * secondsSince(lastConnect_), configuration_.connectRate * MAX_DUE_SECONDS + 1);
+    while(connectsDue_ >= 1 && peers_.size() < static_cast<size_t>(configuration_.sessions)) {
+        openSession();
+        connectsDue_ -= 1;
+    }
+
+    if(peers_.size() >= static_cast<size_t>(configuration_.sessions)) {
+        connectTimer_->stop();
+    }
+}
+
+void LoadGenerator::openSession() {
+    auto host = LOCALHOST;
+    auto index = peers_.size();
+
+    PeerSession peer;
+    peer.session = sessionCreator_.tryConnect(host, configuration_.port);
+    peer.connectStarted = std::chrono::steady_clock::now();
+    peers_.push_back(peer);
+
+    auto session = peer.session.get();
+    auto ticketStore = configuration_.resumption ? sessionCreator_.getTicketStore() : nullptr;
+    QObject::connect(session, &ChatSession::connectionEstablished, this, [this, session, ticketStore] {
+        session->initialize(std::make_unique<EncryptedSessionSenderHandshakeProcessor>(keys_, userInfo_, ticketStore, session->getTicketKey()));
+    });
+    QObject::connect(session, &ChatSession::sessionInitialized, this, [this, index] { handleSessionEstablished(index); });
+    QObject::connect(session, &ChatSession::sessionInitializationError, this, [this] { ++statistics_.sessionErrors; });
+    QObject::connect(session, &ChatSession::sessionEndedByOtherSide, this, [this, index] { handleSessionEnded(index); });
+    QObject::connect(session, &ChatSession::connectionLost, this, [this] { ++statistics_.connectionsLost; });
+    QObject::connect(session, &ChatSession::invalidMessageReceived, this, [this] { ++statistics_.invalidMessages; });
+}
+
+void LoadGenerator::handleSessionEstablished(size_t index) {
+    auto &peer = peers_[index];
+    peer.established = true;
+    established_.push_back(index);
+
+    ++statistics_.sessionsEstablished;
+    statistics_.handshakeLatencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - peer.connectStarted).count());
+}
+
+void LoadGenerator::handleSessionEnded(size_t index) {
+    ++statistics_.sessionsEnded;
+    peers_[index].established = false;
+    established_.erase(std::remove(established_.begin(), established_.end(), index), established_.end());
+}
+
+void LoadGenerator::sendMessages() {
+    auto rate = configuration_.messageRate * established_.size();
+    messagesDue_ = std::min(messagesDue_ + rate * secondsSince(lastSend_), rate * MAX_DUE_SECONDS + 1);
+    if(established_.empty()) {
+        messagesDue_ = 0;
+        return;
+    }
+
+    // spread messages over the sessions round robin
+    while(messagesDue_ >= 1) {
+        nextSender_ = (nextSender_ + 1) % established_.size();
+        sendMessage(peers_[established_[nextSender_]]);
+        messagesDue_ -= 1;
+    }
+}
+
+void LoadGenerator::sendMessage(PeerSession &peer) {
+    auto content = createContent();
+
+    std::uniform_real_distribution<double> editDistribution(0, 1);
+    std::shared_ptr<AbstractChatMessage> message;
+    if(peer.lastMessageId != 0 && editDistribution(random_) < configuration_.editRatio) {
+        // edits carry the whole content, the responder keeps no history to apply deltas to
+        message = std::make_shared<EditChatMessage>(peer.lastMessageId, ++peer.lastMessageVersion, content);
+        ++statistics_.editsSent;
+    }
+    else {
+        message = std::make_shared<NewChatMessage>(content);
+        peer.lastMessageId = message->getId();
+        peer.lastMessageVersion = 0;
+    }
+
+    peer.session->sendMessage(message);
+    ++statistics_.messagesSent;
+    statistics_.bytesSent += content.length();
+}
+
+std::string LoadGenerator::createContent() {
+    std::uniform_int_distribution<size_t> sizeDistribution(configuration_.minMessageSize, configuration_.maxMessageSize);
+    auto size = std::max<size_t>(sizeDistribution(random_), TIMESTAMP_LENGTH);
+
+    auto content = Utils::convertToHex(currentTimestamp(), TIMESTAMP_LENGTH);
+    content.resize(size, 'x');
+    return content;
+}
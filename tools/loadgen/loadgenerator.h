@@ -0,0 +1,140 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include "session.h"
+
+#include <chrono>
+#include <random>
+
+/**
+ * @brief Parameters of a load test. All connections are made to and accepted on the loopback interface only.
+ */
+struct LoadConfiguration {
+    int port = 47000;
+    int sessions = 100;
+    double connectRate = 200; // new sessions per second
+    double messageRate = 1; // messages per second per established session
+    size_t minMessageSize = 32;
+    size_t maxMessageSize = 256;
+    double editRatio = 0.1; // share of sent messages which edit an earlier message
+    int duration = 10; // seconds of sending, counted from the start
+    unsigned int keySize = 1024;
+    bool resumption = true;
+    bool serve = true; // accept the sessions in the same process
+    bool generate = true; // open sessions and send messages
+};
+
+/**
+ * @brief Collected counters and latency samples of either side of a load test.
+ */
+struct LoadStatistics {
+    int sessionsEstablished = 0;
+    int sessionErrors = 0;
+    int sessionsEnded = 0;
+    int connectionsLost = 0;
+    int invalidMessages = 0;
+
+    long long messagesSent = 0;
+    long long editsSent = 0;
+    long long bytesSent = 0;
+    long long messagesReceived = 0;
+    long long editsReceived = 0;
+    long long bytesReceived = 0;
+
+    std::vector<double> handshakeLatencies; // milliseconds
+    std::vector<double> deliveryLatencies; // milliseconds, only known for messages sent on this machine
+};
+
+/**
+ * @brief Accepts chat sessions on localhost with the real receiver handshake and counts what is received.
+ */
+class LoadResponder : public QObject {
+    Q_OBJECT
+
+public:
+    LoadResponder(const LoadConfiguration &configuration, UserInfo userInfo, const KeyCombination &keys);
+    void start();
+    void stop();
+    const LoadStatistics& getStatistics() const { return statistics_; }
+
+private slots:
+    void handleChatRequest(std::shared_ptr<ChatSession> session);
+
+private:
+    void handleChatMessage(AbstractChatMessage *message, bool edit);
+
+    LoadConfiguration configuration_;
+    UserInfo userInfo_;
+    KeyCombination keys_;
+    ChatSessionCreator sessionCreator_;
+    std::vector<std::shared_ptr<ChatSession>> sessions_;
+    LoadStatistics statistics_;
+};
+
+/**
+ * @brief Opens chat sessions to a local target through ChatSessionCreator::tryConnect and the real sender handshake,
+ * then sends new and edited messages at the configured rate and size distribution.
+ */
+class LoadGenerator : public QObject {
+    Q_OBJECT
+
+public:
+    LoadGenerator(const LoadConfiguration &configuration, UserInfo userInfo, const KeyCombination &keys);
+    void start();
+
+    /**
+     * @brief Stops opening sessions and sending messages. Established sessions stay open until closeSessions is called.
+     */
+    void stop();
+    void closeSessions();
+    const LoadStatistics& getStatistics() const { return statistics_; }
+
+    /**
+     * @brief Returns the time since the first session was opened in seconds.
+     */
+    double getElapsedTime() const;
+
+signals:
+    void finished();
+
+private slots:
+    void openSessions();
+    void sendMessages();
+
+private:
+    struct PeerSession {
+        std::shared_ptr<ChatSession> session;
+        std::chrono::steady_clock::time_point connectStarted;
+        MessageId lastMessageId = 0;
+        unsigned int lastMessageVersion = 0;
+        bool established = false;
+    };
+
+    void openSession();
+    void handleSessionEstablished(size_t index);
+    void handleSessionEnded(size_t index);
+    void sendMessage(PeerSession &peer);
+    std::string createContent();
+
+    LoadConfiguration configuration_;
+    UserInfo userInfo_;
+    KeyCombination keys_;
+    ChatSessionCreator sessionCreator_;
+
+    std::vector<PeerSession> peers_;
+    std::vector<size_t> established_;
+    size_t nextSender_ = 0;
+
+    QTimer *connectTimer_;
+    QTimer *sendTimer_;
+    std::chrono::steady_clock::time_point started_;
+    std::chrono::steady_clock::time_point lastConnect_;
+    std::chrono::steady_clock::time_point lastSend_;
+    double connectsDue_ = 0;
+    double messagesDue_ = 0;
+
+    std::mt19937 random_;
+    LoadStatistics statistics_;
+};
+
+#endif // LOADGENERATOR_H
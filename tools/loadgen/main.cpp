@@ -0,0 +1,186 @@
+#include "loadgenerator.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+const int DRAIN_TIME = 1000;
+const int PROGRESS_INTERVAL = 1000;
+const int METRICS_DUMP_INTERVAL = 1000;
+
+namespace {
+    double percentile(std::vector<double> samples, double fraction) {
+        if(samples.empty()) {
+            return 0;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        auto index = static_cast<size_t>(fraction * (samples.size() - 1) + 0.5);
+        return samples[index];
+    }
+
+    void printLatencies(const std::string &name, const std::vector<double> &samples) {
+        std::cout << name << " latency (ms, " << samples.size() << " samples): "
+                  << "p50 " << percentile(samples, 0.5)
+                  << ", p90 " << percentile(samples, 0.9)
+                  << ", p99 " << percentile(samples, 0.99)
+                  << ", max " << percentile(samples, 1) << std::endl;
+    }
+
+    void printErrors(const LoadStatistics &statistics) {
+        std::cout << "errors: " << statistics.sessionErrors << " failed sessions, "
+                  << statistics.sessionsEnded << " ended by the other side, "
+                  << statistics.connectionsLost << " lost connections, "
+                  << statistics.invalidMessages << " invalid messages" << std::endl;
+    }
+
+    void printReport(const LoadConfiguration &configuration, const LoadGenerator *generator, const LoadResponder *responder, double elapsed) {
+        std::cout << std::fixed << std::setprecision(2);
+
+        if(generator != nullptr) {
+            auto &statistics = generator->getStatistics();
+            std::cout << "== generator ==" << std::endl;
+            std::cout << "sessions: " << statistics.sessionsEstablished << " of " << configuration.sessions << " established" << std::endl;
+            printLatencies("handshake", statistics.handshakeLatencies);
+            std::cout << "sent: " << statistics.messagesSent << " messages (" << statistics.editsSent << " edits), "
+                      << statistics.messagesSent / elapsed << " msg/s, " << statistics.bytesSent / elapsed / 1024 << " KiB/s" << std::endl;
+            printErrors(statistics);
+        }
+
+        if(responder != nullptr) {
+            auto &statistics = responder->getStatistics();
+            std::cout << "== responder ==" << std::endl;
+            std::cout << "sessions: " << statistics.sessionsEstablished << " accepted" << std::endl;
+            std::cout << "received: " << statistics.messagesReceived << " messages (" << statistics.editsReceived << " edits), "
+                      << statistics.messagesReceived / elapsed << " msg/s, " << statistics.bytesReceived / elapsed / 1024 << " KiB/s" << std::endl;
+            printLatencies("delivery", statistics.deliveryLatencies);
+            printErrors(statistics);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+    QCoreApplication::setApplicationName("qtchat_loadgen");
+
+    LoadConfiguration configuration;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Opens many QtChat sessions on localhost and sends messages through them.\n"
+                                     "By default the sessions are also accepted in the same process; use --target-only to load a separately "
+                                     "running QtChat or --respond-only to run just the accepting side.");
+    parser.addHelpOption();
+    QCommandLineOption portOption({"p", "port"}, "Local port to connect to and listen on.", "port", QString::number(configuration.port));
+    QCommandLineOption sessionsOption({"n", "sessions"}, "Number of concurrent sessions.", "count", QString::number(configuration.sessions));
+    QCommandLineOption connectRateOption("connect-rate", "New sessions opened per second.", "rate", QString::number(configuration.connectRate));
+    QCommandLineOption messageRateOption({"r", "rate"}, "Messages per second per session.", "rate", QString::number(configuration.messageRate));
+    QCommandLineOption minSizeOption("min-size", "Minimal message size in bytes.", "bytes", QString::number(configuration.minMessageSize));
+    QCommandLineOption maxSizeOption("max-size", "Maximal message size in bytes, sizes are uniformly distributed.", "bytes", QString::number(configuration.maxMessageSize));
+    QCommandLineOption editRatioOption("edit-ratio", "Share of messages sent as edits of an earlier message.", "ratio", QString::number(configuration.editRatio));
+    QCommandLineOption durationOption({"d", "duration"}, "Length of the test in seconds.", "seconds", QString::number(configuration.duration));
+    QCommandLineOption keySizeOption("key-size", "RSA key size of both sides.", "bits", QString::number(configuration.keySize));
+    QCommandLineOption noResumptionOption("no-resumption", "Issue no resumption tickets, so sessions reconnecting after a lost connection run the full RSA handshake.");
+    QCommandLineOption targetOnlyOption("target-only", "Do not accept sessions, connect to an already running QtChat.");
+    QCommandLineOption respondOnlyOption("respond-only", "Only accept sessions, until interrupted.");
+    QCommandLineOption metricsSocketOption("metrics-socket", "Serve the internal metrics on this local socket.", "name");
+    QCommandLineOption metricsDumpOption("metrics-dump", "Write the internal metrics to this file every second.", "path");
+    QCommandLineOption traceOption("trace", "Write a Chrome trace of the session and message pipeline to this file.", "path");
+    parser.addOptions({portOption, sessionsOption, connectRateOption, messageRateOption, minSizeOption, maxSizeOption,
+                       editRatioOption, durationOption, keySizeOption, noResumptionOption, targetOnlyOption, respondOnlyOption,
+                       metricsSocketOption, metricsDumpOption, traceOption});
+    parser.process(application);
+
+    configuration.port = parser.value(portOption).toInt();
+    configuration.sessions = parser.value(sessionsOption).toInt();
+    configuration.connectRate = parser.value(connectRateOption).toDouble();
+    configuration.messageRate = parser.value(messageRateOption).toDouble();
+    configuration.minMessageSize = parser.value(minSizeOption).toULongLong();
+    configuration.maxMessageSize = std::max<size_t>(parser.value(maxSizeOption).toULongLong(), configuration.minMessageSize);
+    configuration.editRatio = parser.value(editRatioOption).toDouble();
+    configuration.duration = parser.value(durationOption).toInt();
+    configuration.keySize = parser.value(keySizeOption).toUInt();
+    configuration.resumption = !parser.isSet(noResumptionOption);
+    configuration.serve = !parser.isSet(targetOnlyOption);
+    configuration.generate = !parser.isSet(respondOnlyOption);
+
+    if(!configuration.serve && !configuration.generate) {
+        std::cerr << "--target-only and --respond-only cannot be combined." << std::endl;
+        return 1;
+    }
+
+    MetricsExporter metricsExporter;
+    if(parser.isSet(metricsSocketOption) && !metricsExporter.listen(parser.value(metricsSocketOption).toStdString())) {
+        std::cerr << "Could not listen on the metrics socket." << std::endl;
+        return 1;
+    }
+    if(parser.isSet(metricsDumpOption)) {
+        metricsExporter.startDump(parser.value(metricsDumpOption).toStdString(), METRICS_DUMP_INTERVAL);
+    }
+
+    if(parser.isSet(traceOption)) {
+        try {
+            Tracer::instance().start(parser.value(traceOption).toStdString());
+        }
+        catch (const std::runtime_error &error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+    }
+
+    auto keys = RSAKeyGenerator::generateKey(configuration.keySize);
+
+    std::unique_ptr<LoadResponder> responder;
+    if(configuration.serve) {
+        responder = std::make_unique<LoadResponder>(configuration, UserInfo("loadgen-responder"), keys);
+        responder->start();
+    }
+
+    QTimer progressTimer;
+    if(!configuration.generate) {
+        QObject::connect(&progressTimer, &QTimer::timeout, responder.get(), [&responder] {
+            auto &statistics = responder->getStatistics();
+            std::cerr << statistics.sessionsEstablished << " sessions, " << statistics.messagesReceived << " messages received, "
+                      << statistics.sessionErrors << " session errors" << std::endl;
+        });
+        progressTimer.start(PROGRESS_INTERVAL);
+        return application.exec();
+    }
+
+    LoadGenerator generator(configuration, UserInfo("loadgen"), keys);
+
+    QObject::connect(&progressTimer, &QTimer::timeout, &generator, [&generator] {
+        auto &statistics = generator.getStatistics();
+        std::cerr << std::fixed << std::setprecision(1) << generator.getElapsedTime() << " s: "
+                  << statistics.sessionsEstablished << " sessions, " << statistics.messagesSent << " messages sent, "
+                  << statistics.sessionErrors << " session errors" << std::endl;
+    });
+
+    double elapsed = 0;
+    QObject::connect(&generator, &LoadGenerator::finished, &generator, [&] {
+        elapsed = generator.getElapsedTime();
+        progressTimer.stop();
+        generator.stop();
+
+        // let in-flight messages arrive before the responder's counters are read
+        QTimer::singleShot(DRAIN_TIME, &generator, [&] {
+            printReport(configuration, &generator, responder.get(), elapsed);
+            generator.closeSessions();
+            if(responder != nullptr) {
+                responder->stop();
+            }
+            QCoreApplication::quit();
+        });
+    });
+
+    generator.start();
+    progressTimer.start(PROGRESS_INTERVAL);
+
+    auto result = application.exec();
+    Tracer::instance().stop();
+    return result;
+}